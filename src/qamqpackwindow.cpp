@@ -0,0 +1,179 @@
+#include "qamqpackwindow_p.h"
+
+QAmqpAckWindow::QAmqpAckWindow()
+    : head_(0),
+      size_(0),
+      pending_(0),
+      base_(1),
+      contiguous_(true)
+{
+}
+
+void QAmqpAckWindow::reset(bool contiguous)
+{
+    head_ = 0;
+    size_ = 0;
+    pending_ = 0;
+    base_ = 1;
+    contiguous_ = contiguous;
+}
+
+bool QAmqpAckWindow::isContiguous() const
+{
+    return contiguous_;
+}
+
+int QAmqpAckWindow::pendingAcks() const
+{
+    return pending_;
+}
+
+bool QAmqpAckWindow::contains(qlonglong tag) const
+{
+    return tag >= base_ && tag < base_ + size_;
+}
+
+quint8 &QAmqpAckWindow::at(int offset)
+{
+    // the capacity is always a power of two
+    return ring_[(head_ + offset) & (ring_.size() - 1)];
+}
+
+void QAmqpAckWindow::grow(int capacity)
+{
+    int newCapacity = qMax(ring_.size(), 64);
+    while (newCapacity < capacity)
+        newCapacity *= 2;
+    if (newCapacity == ring_.size())
+        return;
+
+    QVector<quint8> ring(newCapacity);
+    for (int i = 0; i < size_; ++i)
+        ring[i] = at(i);
+    ring_ = ring;
+    head_ = 0;
+}
+
+void QAmqpAckWindow::advance()
+{
+    while (size_ > 0 && at(0) == Settled) {
+        head_ = (head_ + 1) & (ring_.size() - 1);
+        ++base_;
+        --size_;
+    }
+
+    // an empty window starts over at the next tag
+    if (size_ == 0)
+        head_ = 0;
+}
+
+void QAmqpAckWindow::deliver(qlonglong tag, bool settled)
+{
+    const qlonglong next = base_ + size_;
+    if (tag < next)
+        return;
+
+    if (tag > next) {
+        // some other consumer on the channel got the tags in between
+        contiguous_ = false;
+        if (size_ == 0) {
+            base_ = tag;
+        } else {
+            const int gap = int(tag - next);
+            grow(size_ + gap + 1);
+            for (int i = 0; i < gap; ++i)
+                at(size_ + i) = Settled;
+            size_ += gap;
+        }
+    }
+
+    if (size_ + 1 > ring_.size())
+        grow(size_ + 1);
+    at(size_) = settled ? Settled : Outstanding;
+    ++size_;
+    advance();
+}
+
+int QAmqpAckWindow::ack(qlonglong tag, bool multiple)
+{
+    if (multiple && tag == 0)
+        tag = base_ + size_ - 1;
+    if (!contains(tag))
+        return 0;
+
+    const int offset = int(tag - base_);
+    int acked = 0;
+    for (int i = multiple ? 0 : offset; i <= offset; ++i) {
+        quint8 &state = at(i);
+        if (state == Outstanding) {
+            state = Acked;
+            ++acked;
+        }
+    }
+
+    pending_ += acked;
+    return acked;
+}
+
+void QAmqpAckWindow::settle(qlonglong tag, bool multiple)
+{
+    if (multiple && tag == 0)
+        tag = base_ + size_ - 1;
+    if (!contains(tag))
+        return;
+
+    const int offset = int(tag - base_);
+    for (int i = multiple ? 0 : offset; i <= offset; ++i) {
+        quint8 &state = at(i);
+        if (state == Acked)
+            --pending_;
+        state = Settled;
+    }
+
+    advance();
+}
+
+QVector<qlonglong> QAmqpAckWindow::outstanding(qlonglong tag) const
+{
+    QVector<qlonglong> tags;
+    const int count = tag == 0 ? size_ : int(qBound(qlonglong(0), tag - base_ + 1, qlonglong(size_)));
+    for (int i = 0; i < count; ++i) {
+        if (ring_.at((head_ + i) & (ring_.size() - 1)) == Outstanding)
+            tags.append(base_ + i);
+    }
+
+    return tags;
+}
+
+qlonglong QAmqpAckWindow::take(bool stragglers, QVector<qlonglong> *single)
+{
+    qlonglong multipleTag = 0;
+    if (contiguous_) {
+        int run = 0;
+        while (run < size_ && at(run) == Acked) {
+            at(run) = Settled;
+            ++run;
+        }
+
+        pending_ -= run;
+        if (run > 0)
+            multipleTag = base_ + run - 1;
+        advance();
+    }
+
+    if (!stragglers && contiguous_)
+        return multipleTag;
+
+    for (int i = 0; i < size_ && pending_ > 0; ++i) {
+        quint8 &state = at(i);
+        if (state != Acked)
+            continue;
+
+        state = Settled;
+        --pending_;
+        single->append(base_ + i);
+    }
+
+    advance();
+    return multipleTag;
+}
@@ -0,0 +1,66 @@
+#ifndef QAMQPACKWINDOW_P_H
+#define QAMQPACKWINDOW_P_H
+
+#include <QVector>
+
+/*!
+ * QAmqpAckWindow follows the delivery tags of one channel while acks are
+ * being coalesced. Tags are kept in a ring indexed by their distance from
+ * the oldest one still outstanding, so marking a tag acked is O(1) and the
+ * acked prefix can go out as a single multiple ack.
+ *
+ * A multiple ack settles every unacked tag up to it on the channel, so it
+ * is only used while the window has seen every tag the channel handed out.
+ * Once a tag is skipped, e.g. because another consumer shares the channel,
+ * every ack goes out on its own.
+ */
+class QAmqpAckWindow
+{
+public:
+    enum State {
+        Settled,
+        Outstanding,
+        Acked
+    };
+
+    QAmqpAckWindow();
+
+    // forgets every tag, the channel starts over from tag 1
+    void reset(bool contiguous = true);
+
+    bool isContiguous() const;
+    int pendingAcks() const;
+    bool contains(qlonglong tag) const;
+
+    // records a delivery, settled ones were received with no-ack
+    void deliver(qlonglong tag, bool settled);
+
+    // marks tag, or every outstanding tag up to it, acked. Returns the
+    // number of newly acked tags, 0 if the window does not know tag
+    int ack(qlonglong tag, bool multiple);
+
+    // tag, or every tag up to it, was settled some other way
+    void settle(qlonglong tag, bool multiple);
+
+    // the outstanding tags up to tag, every outstanding one for a tag of 0
+    QVector<qlonglong> outstanding(qlonglong tag) const;
+
+    // takes the acked tags, returning the last tag of the acked prefix to be
+    // acked with multiple set, or 0. Tags acked behind an outstanding one
+    // are appended to single only when stragglers is set.
+    qlonglong take(bool stragglers, QVector<qlonglong> *single);
+
+private:
+    quint8 &at(int offset);
+    void grow(int capacity);
+    void advance();
+
+    QVector<quint8> ring_;  // State per tag
+    int head_;              // ring index of base_
+    int size_;              // tags from base_ up to the last delivery
+    int pending_;           // acked but not taken
+    qlonglong base_;
+    bool contiguous_;
+};
+
+#endif // QAMQPACKWINDOW_P_H
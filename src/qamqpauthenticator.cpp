@@ -1,5 +1,5 @@
 #include "qamqptable.h"
-#include "qamqpframe_p.h"
+#include "qamqpcodec_p.h"
 #include "qamqpauthenticator.h"
 
 QAmqpPlainAuthenticator::QAmqpPlainAuthenticator(const QString &l, const QString &p)
@@ -39,9 +39,13 @@ void QAmqpPlainAuthenticator::setPassword(const QString &p)
 
 void QAmqpPlainAuthenticator::write(QDataStream &out)
 {
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, type());
+    QByteArray data;
+    QAmqpCodecWriter writer(&data);
+    writer.writeShortString(type());
+
     QAmqpTable response;
     response["LOGIN"] = login_;
     response["PASSWORD"] = password_;
-    out << response;
+    writer.writeTable(response);
+    out.writeRawData(data.constData(), data.size());
 }
@@ -1,12 +1,12 @@
-#include <QDataStream>
 #include <QDebug>
 
 #include "qamqpchannel.h"
 #include "qamqpchannel_p.h"
 #include "qamqpclient.h"
 #include "qamqpclient_p.h"
+#include "qamqpcodec_p.h"
+#include "qamqplogging_p.h"
 
-quint16 QAmqpChannelPrivate::nextChannelNumber = 0;
 QAmqpChannelPrivate::QAmqpChannelPrivate(QAmqpChannel *q)
     : channelNumber(0),
       opened(false),
@@ -22,18 +22,39 @@ QAmqpChannelPrivate::QAmqpChannelPrivate(QAmqpChannel *q)
 
 QAmqpChannelPrivate::~QAmqpChannelPrivate()
 {
-    if (!client.isNull()) {
+    if (!client.isNull() && channelNumber) {
+        // the release decides on the channel state the slot still holds
         QAmqpClientPrivate *priv = client->d_func();
-        priv->methodHandlersByChannel[channelNumber].removeAll(this);
+        priv->releaseChannel(channelNumber);
+        priv->removeMethodHandler(channelNumber, this);
     }
 }
 
 void QAmqpChannelPrivate::init(int channel, QAmqpClient *c)
 {
     client = c;
-    needOpen = (channel <= nextChannelNumber && channel != -1) ? false : true;
-    channelNumber = channel == -1 ? ++nextChannelNumber : channel;
-    nextChannelNumber = qMax(channelNumber, nextChannelNumber);
+    QAmqpChannelAllocator &allocator = client->d_func()->channelAllocator;
+    if (channel == 0) {
+        error = QAMQP::ChannelError;
+        errorString = QLatin1String("channel 0 is reserved for the connection");
+        qAmqpChannelDebug() << Q_FUNC_INFO << errorString;
+        return;
+    }
+
+    if (channel != -1) {
+        // an explicit number in use already shares that channel
+        channelNumber = quint16(channel);
+        needOpen = allocator.reserve(channelNumber);
+        return;
+    }
+
+    channelNumber = allocator.allocate();
+    needOpen = channelNumber != 0;
+    if (!channelNumber) {
+        error = QAMQP::ResourceError;
+        errorString = QLatin1String("no free channel number");
+        qAmqpChannelDebug() << Q_FUNC_INFO << "all" << allocator.count() << "channels in use";
+    }
 }
 
 bool QAmqpChannelPrivate::_q_method(const QAmqpMethodFrame &frame)
@@ -83,13 +104,47 @@ void QAmqpChannelPrivate::_q_open()
 void QAmqpChannelPrivate::sendFrame(const QAmqpFrame &frame)
 {
     if (!client) {
-        qAmqpDebug() << Q_FUNC_INFO << "invalid client";
+        qAmqpChannelDebug() << Q_FUNC_INFO << "invalid client";
+        return;
+    }
+
+    // without a channel number the object stays inert, frames would end
+    // up on the connection channel
+    if (!channelNumber) {
+        qAmqpChannelDebug() << Q_FUNC_INFO << "no channel number";
         return;
     }
 
     client->d_func()->sendFrame(frame);
 }
 
+QByteArray *QAmqpChannelPrivate::beginWrite(qint64 size)
+{
+    if (!client) {
+        qAmqpChannelDebug() << Q_FUNC_INFO << "invalid client";
+        return 0;
+    }
+
+    if (!channelNumber) {
+        qAmqpChannelDebug() << Q_FUNC_INFO << "no channel number";
+        return 0;
+    }
+
+    return client->d_func()->beginWrite(size);
+}
+
+void QAmqpChannelPrivate::endWrite()
+{
+    client->d_func()->endWrite();
+}
+
+QAmqpShortStringCache *QAmqpChannelPrivate::shortStringCache() const
+{
+    if (!client)
+        return 0;
+    return &client->d_func()->shortStrings;
+}
+
 void QAmqpChannelPrivate::resetInternalState()
 {
     if (!opened) return;
@@ -99,13 +154,20 @@ void QAmqpChannelPrivate::resetInternalState()
 
 void QAmqpChannelPrivate::open()
 {
-    if (!needOpen || opened)
+    if (opened || !channelNumber)
+        return;
+
+    if (!needOpen) {
+        // joining a channel another object has opened already
+        if (!client.isNull() && client->d_func()->channelSlot(channelNumber).opened)
+            openOk(QAmqpMethodFrame());
         return;
+    }
 
     if (!client->isConnected())
         return;
 
-    qAmqpDebug("<- channel#open( channel=%d, name=%s )", channelNumber, qPrintable(name));
+    qAmqpChannelDebug("<- channel#open( channel=%d, name=%s )", channelNumber, qPrintable(name));
     QAmqpMethodFrame frame(QAmqpFrame::Channel, miOpen);
     frame.setChannel(channelNumber);
 
@@ -120,8 +182,8 @@ void QAmqpChannelPrivate::open()
 void QAmqpChannelPrivate::flow(bool active)
 {
     QByteArray arguments;
-    QDataStream stream(&arguments, QIODevice::WriteOnly);
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortShortUint, (active ? 1 : 0));
+    QAmqpCodecWriter writer(&arguments);
+    writer.writeBoolean(active);
 
     QAmqpMethodFrame frame(QAmqpFrame::Channel, miFlow);
     frame.setChannel(channelNumber);
@@ -135,22 +197,21 @@ void QAmqpChannelPrivate::flow(bool active)
 void QAmqpChannelPrivate::flow(const QAmqpMethodFrame &frame)
 {
     Q_UNUSED(frame);
-    qAmqpDebug("-> channel#flow( channel=%d, name=%s )", channelNumber, qPrintable(name));
+    qAmqpChannelDebug("-> channel#flow( channel=%d, name=%s )", channelNumber, qPrintable(name));
 }
 
 void QAmqpChannelPrivate::flowOk()
 {
-    qAmqpDebug("<- channel#flowOk( channel=%d, name=%s )", channelNumber, qPrintable(name));
+    qAmqpChannelDebug("<- channel#flowOk( channel=%d, name=%s )", channelNumber, qPrintable(name));
 }
 
 void QAmqpChannelPrivate::flowOk(const QAmqpMethodFrame &frame)
 {
     Q_Q(QAmqpChannel);
-    qAmqpDebug("-> channel#flowOk( channel=%d, name=%s )", channelNumber, qPrintable(name));
+    qAmqpChannelDebug("-> channel#flowOk( channel=%d, name=%s )", channelNumber, qPrintable(name));
 
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
-    bool active = QAmqpFrame::readAmqpField(stream, QAmqpMetaType::Boolean).toBool();
+    QAmqpCodecReader reader(frame.arguments());
+    bool active = reader.readBoolean();
     if (active)
         Q_EMIT q->resumed();
     else
@@ -159,41 +220,40 @@ void QAmqpChannelPrivate::flowOk(const QAmqpMethodFrame &frame)
 
 void QAmqpChannelPrivate::close(int code, const QString &text, int classId, int methodId)
 {
-    qAmqpDebug("<- channel#close( channel=%d, name=%s, reply-code=%d, text=%s class-id=%d, method-id:%d, )",
-               channelNumber, qPrintable(name), code, qPrintable(text), classId, methodId);
+    qAmqpChannelDebug("<- channel#close( channel=%d, name=%s, reply-code=%d, text=%s class-id=%d, method-id:%d, )",
+                      channelNumber, qPrintable(name), code, qPrintable(text), classId, methodId);
 
     QByteArray arguments;
-    QDataStream stream(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter writer(&arguments);
 
     if (!code) code = 200;
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortUint, code);
+    writer.writeShort(quint16(code));
     if (!text.isEmpty()) {
-      QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortString, text);
+      writer.writeShortString(text);
     } else {
-      QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortString, QLatin1String("OK"));
+      writer.writeShortString(QByteArray("OK"));
     }
 
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortUint, classId);
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortUint, methodId);
+    writer.writeShort(quint16(classId));
+    writer.writeShort(quint16(methodId));
 
     QAmqpMethodFrame frame(QAmqpFrame::Channel, miClose);
     frame.setChannel(channelNumber);
     frame.setArguments(arguments);
     sendFrame(frame);
+
+    if (!client.isNull())
+        client->d_func()->channelSlot(channelNumber).closing = true;
 }
 
 void QAmqpChannelPrivate::close(const QAmqpMethodFrame &frame)
 {
     Q_Q(QAmqpChannel);
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
-    qint16 code = 0, classId, methodId;
-    stream >> code;
-    QString text =
-        QAmqpFrame::readAmqpField(stream, QAmqpMetaType::ShortString).toString();
-
-    stream >> classId;
-    stream >> methodId;
+    QAmqpCodecReader reader(frame.arguments());
+    qint16 code = qint16(reader.readShort());
+    QString text = reader.readShortString();
+    qint16 classId = qint16(reader.readShort());
+    qint16 methodId = qint16(reader.readShort());
 
     QAMQP::Error checkError = static_cast<QAMQP::Error>(code);
     if (checkError != QAMQP::NoError) {
@@ -202,8 +262,8 @@ void QAmqpChannelPrivate::close(const QAmqpMethodFrame &frame)
         Q_EMIT q->error(error);
     }
 
-    qAmqpDebug("-> channel#close( channel=%d, name=%s, reply-code=%d, reply-text=%s, class-id=%d, method-id=%d, )",
-               channelNumber, qPrintable(name), code, qPrintable(text), classId, methodId);
+    qAmqpChannelDebug("-> channel#close( channel=%d, name=%s, reply-code=%d, reply-text=%s, class-id=%d, method-id=%d, )",
+                      channelNumber, qPrintable(name), code, qPrintable(text), classId, methodId);
 
     // complete handshake
     QAmqpMethodFrame closeOkFrame(QAmqpFrame::Channel, miCloseOk);
@@ -216,13 +276,17 @@ void QAmqpChannelPrivate::close(const QAmqpMethodFrame &frame)
 
 void QAmqpChannelPrivate::closeOk(const QAmqpMethodFrame &)
 {
-    qAmqpDebug("-> channel#closeOk( channel=%d, name=%s )", channelNumber, qPrintable(name));
+    qAmqpChannelDebug("-> channel#closeOk( channel=%d, name=%s )", channelNumber, qPrintable(name));
     notifyClosed();
 }
 
 void QAmqpChannelPrivate::notifyClosed()
 {
     Q_Q(QAmqpChannel);
+    // requests still waiting for a reply died with the channel
+    if (!client.isNull())
+        client->d_func()->channelSlot(channelNumber).reset();
+
     Q_EMIT q->closed();
     q->channelClosed();
     opened = false;
@@ -231,15 +295,16 @@ void QAmqpChannelPrivate::notifyClosed()
 void QAmqpChannelPrivate::openOk(const QAmqpMethodFrame &)
 {
     Q_Q(QAmqpChannel);
-    qAmqpDebug("-> channel#openOk( channel=%d, name=%s )", channelNumber, qPrintable(name));
+    qAmqpChannelDebug("-> channel#openOk( channel=%d, name=%s )", channelNumber, qPrintable(name));
     opened = true;
+    if (!client.isNull())
+        client->d_func()->channelSlot(channelNumber).opened = true;
     Q_EMIT q->opened();
     q->channelOpened();
 }
 
 void QAmqpChannelPrivate::_q_disconnected()
 {
-    nextChannelNumber = 0;
     opened = false;
 }
 
@@ -247,7 +312,7 @@ void QAmqpChannelPrivate::qosOk(const QAmqpMethodFrame &frame)
 {
     Q_Q(QAmqpChannel);
     Q_UNUSED(frame)
-    qAmqpDebug("-> basic#qosOk( channel=%d, name=%s )", channelNumber, qPrintable(name));
+    qAmqpBasicDebug("-> basic#qosOk( channel=%d, name=%s )", channelNumber, qPrintable(name));
 
     prefetchCount = requestedPrefetchCount;
     prefetchSize = requestedPrefetchSize;
@@ -313,17 +378,17 @@ void QAmqpChannel::qos(qint16 prefetchCount, qint32 prefetchSize)
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream stream(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter writer(&arguments);
 
     d->requestedPrefetchSize = prefetchSize;
     d->requestedPrefetchCount = prefetchCount;
 
-    stream << qint32(prefetchSize);
-    stream << qint16(prefetchCount);
-    stream << qint8(0x0);   // global
+    writer.writeLong(quint32(prefetchSize));
+    writer.writeShort(quint16(prefetchCount));
+    writer.writeOctet(0x0);   // global
 
-    qAmqpDebug("<- basic#qos( channel=%d, name=%s, prefetch-size=%d, prefetch-count=%d, global=%d )",
-               d->channelNumber, qPrintable(d->name), prefetchSize, prefetchCount, 0);
+    qAmqpBasicDebug("<- basic#qos( channel=%d, name=%s, prefetch-size=%d, prefetch-count=%d, global=%d )",
+                    d->channelNumber, qPrintable(d->name), prefetchSize, prefetchCount, 0);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
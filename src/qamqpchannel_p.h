@@ -10,6 +10,7 @@
 class QAmqpChannel;
 class QAmqpClient;
 class QAmqpClientPrivate;
+class QAmqpShortStringCache;
 class QAmqpChannelPrivate : public QAmqpMethodFrameHandler
 {
 public:
@@ -40,6 +41,9 @@ public:
 
     void init(int channel, QAmqpClient *client);
     void sendFrame(const QAmqpFrame &frame);
+    QByteArray *beginWrite(qint64 size);
+    void endWrite();
+    QAmqpShortStringCache *shortStringCache() const;
     virtual void resetInternalState();
 
     void open();
@@ -64,7 +68,6 @@ public:
     QPointer<QAmqpClient> client;
     QString name;
     quint16 channelNumber;
-    static quint16 nextChannelNumber;
     bool opened;
     bool needOpen;
 
@@ -0,0 +1,93 @@
+#include "qamqpchannelallocator_p.h"
+
+QAmqpChannelAllocator::QAmqpChannelAllocator()
+    : highest_(0),
+      channelMax_(0),
+      count_(0)
+{
+}
+
+int QAmqpChannelAllocator::channelMax() const
+{
+    return channelMax_;
+}
+
+void QAmqpChannelAllocator::setChannelMax(int channelMax)
+{
+    channelMax_ = qBound(0, channelMax, 65535);
+}
+
+int QAmqpChannelAllocator::limit() const
+{
+    return channelMax_ ? channelMax_ : 65535;
+}
+
+quint16 QAmqpChannelAllocator::allocate()
+{
+    const int max = limit();
+    while (!free_.isEmpty()) {
+        const quint16 channel = free_.last();
+        free_.removeLast();
+
+        // entries go stale when a number is reserved explicitly after its
+        // release, or when the limit drops below it
+        if (channel <= max && !references_.at(channel)) {
+            references_[channel] = 1;
+            ++count_;
+            return channel;
+        }
+    }
+
+    while (highest_ < max) {
+        const quint16 channel = quint16(++highest_);
+        if (channel >= references_.size())
+            references_.resize(channel + 1);
+        if (!references_.at(channel)) {
+            references_[channel] = 1;
+            ++count_;
+            return channel;
+        }
+    }
+
+    return 0;
+}
+
+bool QAmqpChannelAllocator::reserve(quint16 channel)
+{
+    if (channel >= references_.size())
+        references_.resize(channel + 1);
+
+    if (references_.at(channel)++)
+        return false;
+
+    ++count_;
+    return true;
+}
+
+void QAmqpChannelAllocator::release(quint16 channel)
+{
+    if (channel >= references_.size() || !references_.at(channel))
+        return;
+
+    if (--references_[channel])
+        return;
+
+    --count_;
+    if (channel <= highest_)
+        free_.append(channel);
+}
+
+bool QAmqpChannelAllocator::isAllocated(quint16 channel) const
+{
+    return channel < references_.size() && references_.at(channel);
+}
+
+bool QAmqpChannelAllocator::isShared(quint16 channel) const
+{
+    return channel < references_.size() && references_.at(channel) > 1;
+}
+
+int QAmqpChannelAllocator::count() const
+{
+    return count_;
+}
@@ -0,0 +1,46 @@
+#ifndef QAMQPCHANNELALLOCATOR_P_H
+#define QAMQPCHANNELALLOCATOR_P_H
+
+#include <QVector>
+
+/*!
+ * QAmqpChannelAllocator hands out channel numbers for one connection.
+ * Released numbers are recycled through a free list before new ones are
+ * taken, so allocate() and release() are O(1) amortized, and no number
+ * above channelMax() is handed out.
+ *
+ * Several channel objects may share a number when it is requested
+ * explicitly, the number is only released when the last of them is gone.
+ */
+class QAmqpChannelAllocator
+{
+public:
+    QAmqpChannelAllocator();
+
+    // 0 means the protocol limit of 65535
+    int channelMax() const;
+    void setChannelMax(int channelMax);
+
+    // returns the allocated number, or 0 if all numbers are in use
+    quint16 allocate();
+
+    // takes a reference on a specific number, returns true if it was not
+    // in use before
+    bool reserve(quint16 channel);
+    void release(quint16 channel);
+
+    bool isAllocated(quint16 channel) const;
+    bool isShared(quint16 channel) const;
+    int count() const;
+
+private:
+    int limit() const;
+
+    QVector<quint16> references_;   // indexed by channel number
+    QVector<quint16> free_;         // released numbers, may be stale
+    int highest_;                   // numbers above have never been handed out
+    int channelMax_;
+    int count_;
+};
+
+#endif // QAMQPCHANNELALLOCATOR_P_H
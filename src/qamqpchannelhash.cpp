@@ -80,11 +80,12 @@ void QAmqpChannelHash::put(QAmqpQueue* queue)
 */
 void QAmqpChannelHash::channelDestroyed(QObject* object)
 {
-    QList<QString> names(m_channels.keys());
-    QList<QString>::iterator it;
-    for (it = names.begin(); it != names.end(); it++) {
-        if (m_channels.value(*it) == object)
-            m_channels.remove(*it);
+    QMultiHash<QObject*, QString>::iterator it = m_names.find(object);
+    while (it != m_names.end() && it.key() == object) {
+        QHash<QString, QAmqpChannel*>::iterator channel = m_channels.find(it.value());
+        if (channel != m_channels.end() && channel.value() == object)
+            m_channels.erase(channel);
+        it = m_names.erase(it);
     }
 }
 
@@ -106,7 +107,17 @@ void QAmqpChannelHash::queueDeclared()
 */
 void QAmqpChannelHash::put(const QString& name, QAmqpChannel* channel)
 {
-    connect(channel, SIGNAL(destroyed(QObject*)), this, SLOT(channelDestroyed(QObject*)));
+    QAmqpChannel *previous = m_channels.value(name);
+    if (previous == channel)
+        return;
+
+    // a channel replaced under this name is no longer reachable by it
+    if (previous)
+        m_names.remove(previous, name);
+
+    if (!m_names.contains(channel))
+        connect(channel, SIGNAL(destroyed(QObject*)), this, SLOT(channelDestroyed(QObject*)));
+    m_names.insert(channel, name);
     m_channels[name] = channel;
 }
 
@@ -73,7 +73,8 @@ public:
 
 private Q_SLOTS:
     /*!
-     * Handle destruction of a channel.  Do a full garbage collection run.
+     * Handle destruction of a channel.  Removes it through the reverse
+     * index, without scanning all names.
      */
     void channelDestroyed(QObject* object);
 
@@ -92,6 +93,9 @@ private:
 
     /*! A collection of channels.  Key is the channel's "name". */
     QHash<QString, QAmqpChannel*> m_channels;
+
+    /*! Reverse index of m_channels, the names each channel is stored under. */
+    QMultiHash<QObject*, QString> m_names;
 };
 
 /* vim: set ts=4 sw=4 et */
@@ -1,3 +1,4 @@
+#include <QThread>
 #include <QTimer>
 #include <QTextStream>
 #include <QStringList>
@@ -11,6 +12,9 @@
 #include "qamqpqueue_p.h"
 #include "qamqpauthenticator.h"
 #include "qamqptable.h"
+#include "qamqpcodec_p.h"
+#include "qamqpiothread_p.h"
+#include "qamqplogging_p.h"
 #include "qamqpclient_p.h"
 #include "qamqpclient.h"
 
@@ -18,12 +22,22 @@ QAmqpClientPrivate::QAmqpClientPrivate(QAmqpClient *q)
     : port(AMQP_PORT),
       host(AMQP_HOST),
       virtualHost(AMQP_VHOST),
+      bufferOffset(0),
       autoReconnect(false),
       reconnectFixedTimeout(false),
       timeout(0),
       connecting(false),
       useSsl(false),
+      writeTimeout(1000),
+      writeFlushScheduled(false),
+      writeBufferFull(false),
+      writeBufferLowWatermark(AMQP_WRITE_BUFFER_LOW_WATERMARK),
+      writeBufferHighWatermark(AMQP_WRITE_BUFFER_HIGH_WATERMARK),
       socket(0),
+      ioThread(0),
+      ioWorker(0),
+      ioThreadCpu(-1),
+      readPauseCount(0),
       closed(false),
       connected(false),
       channelMax(0),
@@ -37,12 +51,14 @@ QAmqpClientPrivate::QAmqpClientPrivate(QAmqpClient *q)
 
 QAmqpClientPrivate::~QAmqpClientPrivate()
 {
+    stopIoThread();
 }
 
 void QAmqpClientPrivate::init()
 {
     Q_Q(QAmqpClient);
     initSocket();
+    buffer.reserve(AMQP_FRAME_MAX);
     heartbeatTimer = new QTimer(q);
     QObject::connect(heartbeatTimer, SIGNAL(timeout()), q, SLOT(_q_heartbeat()));
     reconnectTimer = new QTimer(q);
@@ -59,9 +75,20 @@ void QAmqpClientPrivate::initSocket()
     socket = new QSslSocket(q);
     socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
     socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    QObject::connect(socket, SIGNAL(readyRead()), q, SLOT(_q_readyRead()));
+    connectSocket();
+}
+
+/*!
+ * Connects the socket notifications the client handles itself. With an I/O
+ * thread these are queued over from it, reads are done by the worker.
+ */
+void QAmqpClientPrivate::connectSocket()
+{
+    Q_Q(QAmqpClient);
     QObject::connect(socket, SIGNAL(connected()), q, SLOT(_q_socketConnected()));
     QObject::connect(socket, SIGNAL(disconnected()), q, SLOT(_q_socketDisconnected()));
-    QObject::connect(socket, SIGNAL(readyRead()), q, SLOT(_q_readyRead()));
+    QObject::connect(socket, SIGNAL(bytesWritten(qint64)), q, SLOT(_q_bytesWritten(qint64)));
     QObject::connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
                           q, SLOT(_q_socketError(QAbstractSocket::SocketError)));
     QObject::connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
@@ -72,8 +99,124 @@ void QAmqpClientPrivate::initSocket()
                           q, SIGNAL(sslErrors(QList<QSslError>)));
 }
 
+/*!
+ * Moves socket I/O, frame splitting and heartbeats to a dedicated thread,
+ * optionally pinned to cpu. Frames are still decoded and dispatched on the
+ * thread the client lives in.
+ */
+void QAmqpClientPrivate::startIoThread(int cpu)
+{
+    Q_Q(QAmqpClient);
+    if (ioWorker)
+        return;
+
+    qRegisterMetaType<QAbstractSocket::SocketError>("QAbstractSocket::SocketError");
+    qRegisterMetaType<QAbstractSocket::SocketState>("QAbstractSocket::SocketState");
+    qRegisterMetaType<QList<QSslError> >("QList<QSslError>");
+
+    delete socket;
+    ioThreadCpu = cpu;
+    ioThread = new QThread;
+    ioWorker = new QAmqpIoWorker;
+    ioWorker->moveToThread(ioThread);
+    ioThread->start();
+    QMetaObject::invokeMethod(ioWorker, "init", Qt::BlockingQueuedConnection, Q_ARG(int, cpu));
+
+    socket = ioWorker->socket();
+    connectSocket();
+    QObject::connect(ioWorker, SIGNAL(framesAvailable()), q, SLOT(_q_readyRead()));
+    QObject::connect(ioWorker, SIGNAL(frameError(int,QString)), q, SLOT(_q_ioFrameError(int,QString)));
+}
+
+void QAmqpClientPrivate::stopIoThread()
+{
+    if (!ioWorker)
+        return;
+
+    Q_Q(QAmqpClient);
+    QObject::disconnect(socket, 0, q, 0);
+    QObject::disconnect(ioWorker, 0, q, 0);
+
+    // the worker and its socket are destroyed on the I/O thread as it finishes
+    ioWorker->deleteLater();
+    ioThread->quit();
+    ioThread->wait();
+    delete ioThread;
+    ioThread = 0;
+    ioWorker = 0;
+    socket = 0;
+    buffer.clear();
+    bufferOffset = 0;
+}
+
+QAbstractSocket::SocketState QAmqpClientPrivate::socketState() const
+{
+    return ioWorker ? ioWorker->state() : socket->state();
+}
+
+QAbstractSocket::SocketError QAmqpClientPrivate::socketError() const
+{
+    return ioWorker ? ioWorker->error() : socket->error();
+}
+
+QString QAmqpClientPrivate::socketErrorString() const
+{
+    return ioWorker ? ioWorker->errorString() : socket->errorString();
+}
+
+void QAmqpClientPrivate::socketWrite(const QByteArray &data)
+{
+    if (ioWorker)
+        ioWorker->write(data);
+    else
+        socket->write(data);
+}
+
+void QAmqpClientPrivate::socketDisconnectFromHost()
+{
+    if (ioWorker)
+        QMetaObject::invokeMethod(ioWorker, "disconnectFromHost", Qt::QueuedConnection);
+    else
+        socket->disconnectFromHost();
+}
+
+void QAmqpClientPrivate::socketAbort()
+{
+    if (ioWorker)
+        QMetaObject::invokeMethod(ioWorker, "abort", Qt::QueuedConnection);
+    else
+        socket->abort();
+}
+
+void QAmqpClientPrivate::startHeartbeat()
+{
+    if (ioWorker) {
+        QMetaObject::invokeMethod(ioWorker, "startHeartbeat", Qt::QueuedConnection,
+                                  Q_ARG(int, heartbeatDelay * 1000));
+    } else if (heartbeatTimer) {
+        heartbeatTimer->start(heartbeatDelay * 1000);
+    }
+}
+
+void QAmqpClientPrivate::stopHeartbeat()
+{
+    if (ioWorker)
+        QMetaObject::invokeMethod(ioWorker, "stopHeartbeat", Qt::QueuedConnection);
+    else if (heartbeatTimer)
+        heartbeatTimer->stop();
+}
+
 void QAmqpClientPrivate::resetChannelState()
 {
+    for (int i = 0; i < channelSlots.size(); ++i) {
+        QAmqpChannelSlot &slot = channelSlots[i];
+        slot.reset();
+        if (slot.releasePending) {
+            slot.releasePending = false;
+            channelAllocator.release(quint16(i));
+        }
+    }
+
     foreach (QString exchangeName, exchanges.channels()) {
       QAmqpExchange *exchange =
         qobject_cast<QAmqpExchange*>(exchanges.get(exchangeName));
@@ -115,7 +258,7 @@ void QAmqpClientPrivate::parseConnectionString(const QString &uri)
 
     if (connectionString.scheme() != AMQP_SCHEME &&
         connectionString.scheme() != AMQP_SSL_SCHEME) {
-        qAmqpDebug() << Q_FUNC_INFO << "invalid scheme: " << connectionString.scheme();
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "invalid scheme: " << connectionString.scheme();
         return;
     }
 
@@ -141,15 +284,19 @@ void QAmqpClientPrivate::_q_connect()
 {
     if (reconnectTimer)
         reconnectTimer->stop();
-    if (socket->state() != QAbstractSocket::UnconnectedState) {
-        qAmqpDebug() << Q_FUNC_INFO << "socket already connected, disconnecting..";
+    if (socketState() != QAbstractSocket::UnconnectedState) {
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "socket already connected, disconnecting..";
         _q_disconnect();
         // We need to explicitly close connection here because either way it will not be closed until we receive closeOk
         closeConnection();
     }
 
-    qAmqpDebug() << "connecting to host: " << host << ", port: " << port;
-    if (useSsl)
+    qAmqpConnectionDebug() << "connecting to host: " << host << ", port: " << port;
+    if (ioWorker) {
+        ioWorker->setFrameMax(frameMax);
+        QMetaObject::invokeMethod(ioWorker, "connectToHost", Qt::QueuedConnection,
+                                  Q_ARG(QString, host), Q_ARG(quint16, port), Q_ARG(bool, useSsl));
+    } else if (useSsl)
         socket->connectToHostEncrypted(host, port);
     else
         socket->connectToHost(host, port);
@@ -159,12 +306,13 @@ void QAmqpClientPrivate::_q_disconnect()
 {
     if (reconnectTimer)
         reconnectTimer->stop();
-    if (socket->state() == QAbstractSocket::UnconnectedState) {
-        qAmqpDebug() << Q_FUNC_INFO << "already disconnected";
+    if (socketState() == QAbstractSocket::UnconnectedState) {
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "already disconnected";
         return;
     }
 
-    buffer.clear();
+    buffer.resize(0);
+    bufferOffset = 0;
     close(200, "client disconnect");
 }
 
@@ -175,18 +323,33 @@ void QAmqpClientPrivate::_q_socketConnected()
         reconnectTimer->stop();
     if(reconnectFixedTimeout == false)
         timeout = 0;
-    char header[8] = {'A', 'M', 'Q', 'P', 0, 0, 9, 1};
-    socket->write(header, 8);
+    const char header[8] = {'A', 'M', 'Q', 'P', 0, 0, 9, 1};
+    socketWrite(QByteArray(header, 8));
 }
 
 void QAmqpClientPrivate::_q_socketDisconnected()
 {
     Q_Q(QAmqpClient);
-    buffer.clear();
+    buffer.resize(0);
+    bufferOffset = 0;
+    writeBuffer.clear();
+    const bool wasWriteBufferFull = writeBufferFull;
+    writeBufferFull = false;
+    shortStrings.clear();
+    if (ioWorker) {
+        // frames read before the disconnect are of no use anymore
+        QByteArray frames;
+        while (ioWorker->takeFrames(&frames)) {}
+    }
     resetChannelState();
     if (connected)
         connected = false;
     Q_EMIT q->disconnected();
+
+    // the pending bytes were dropped, producers waiting for the buffer to
+    // drain may go on once connected again
+    if (wasWriteBufferFull)
+        Q_EMIT q->writeBufferDrained();
 }
 
 void QAmqpClientPrivate::_q_heartbeat()
@@ -217,146 +380,544 @@ void QAmqpClientPrivate::_q_socketError(QAbstractSocket::SocketError error)
     case QAbstractSocket::ProxyConnectionTimeoutError:
 
     default:
-        qAmqpDebug() << "socket error: " << socket->errorString();
+        qAmqpConnectionDebug() << "socket error: " << socketErrorString();
         break;
     }
 
     // per spec, on any error we need to close the socket immediately
     // and send no more data. only try to send the close message if we
     // are actively connected
-    if (socket->state() == QAbstractSocket::ConnectedState ||
-        socket->state() == QAbstractSocket::ConnectingState) {
-        socket->abort();
+    writeBuffer.clear();
+    const QAbstractSocket::SocketState state = socketState();
+    if (state == QAbstractSocket::ConnectedState ||
+        state == QAbstractSocket::ConnectingState) {
+        socketAbort();
     }
 
-    errorString = socket->errorString();
+    errorString = socketErrorString();
 
     if (autoReconnect && reconnectTimer) {
-        qAmqpDebug() << "trying to reconnect after: " << timeout << "ms";
+        qAmqpConnectionDebug() << "trying to reconnect after: " << timeout << "ms";
         reconnectTimer->start(timeout);
     }
 }
 
 void QAmqpClientPrivate::_q_readyRead()
+{
+    if (readPauseCount > 0)
+        return;
+
+    if (ioWorker)
+        processIoFrames();
+    else
+        readSocketFrames();
+
+    // messages completed by this read go to batch handlers in one call
+    flushMessageBatches();
+}
+
+void QAmqpClientPrivate::flushMessageBatches()
+{
+    while (!pendingBatches.isEmpty()) {
+        QAmqpQueuePrivate *queue = pendingBatches.last();
+        pendingBatches.removeLast();
+        queue->flushBatch();
+    }
+}
+
+/*!
+ * Stops dispatching frames until every pauseReading() call is matched by
+ * resumeReading(). Frames already read stay buffered, without an I/O thread
+ * the socket read buffer is bounded too so TCP flow control reaches the
+ * broker. The I/O thread keeps reading, only its frames queue up.
+ */
+void QAmqpClientPrivate::pauseReading()
+{
+    if (readPauseCount++ > 0)
+        return;
+
+    qAmqpConnectionDebug() << "pausing reads";
+    if (!ioWorker && socket)
+        socket->setReadBufferSize(AMQP_FRAME_MAX);
+}
+
+void QAmqpClientPrivate::resumeReading()
 {
     Q_Q(QAmqpClient);
-    
-    while (socket->bytesAvailable() >= QAmqpFrame::HEADER_SIZE) {
-        unsigned char headerData[QAmqpFrame::HEADER_SIZE];
-        socket->peek((char*)headerData, QAmqpFrame::HEADER_SIZE);
-        const quint32 payloadSize = qFromBigEndian<quint32>(headerData + 3);
-        const qint64 readSize = QAmqpFrame::HEADER_SIZE + payloadSize + QAmqpFrame::FRAME_END_SIZE;
-
-        if (socket->bytesAvailable() < readSize)
+    if (readPauseCount == 0 || --readPauseCount > 0)
+        return;
+
+    qAmqpConnectionDebug() << "resuming reads";
+    if (!ioWorker && socket)
+        socket->setReadBufferSize(0);
+
+    // readyRead() was swallowed while paused, catch up on what is buffered
+    QMetaObject::invokeMethod(q, "_q_readyRead", Qt::QueuedConnection);
+}
+
+void QAmqpClientPrivate::readSocketFrames()
+{
+    // pull everything the socket has buffered with a single read, frames are
+    // then sliced straight out of our own buffer
+    const qint64 available = socket->bytesAvailable();
+    if (available > 0) {
+        const int oldSize = buffer.size();
+        buffer.resize(oldSize + int(available));
+        const qint64 bytesRead = socket->read(buffer.data() + oldSize, available);
+        buffer.resize(oldSize + int(qMax(bytesRead, qint64(0))));
+    }
+
+    while (buffer.size() - bufferOffset >= QAmqpFrame::HEADER_SIZE) {
+        const char *frameData = buffer.constData() + bufferOffset;
+        const quint32 payloadSize =
+            qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(frameData + 3));
+
+        // reject oversized frames from the header alone, before buffering them
+        if (Q_UNLIKELY(frameMax > 0 && payloadSize > quint32(frameMax))) {
+            buffer.resize(0);
+            bufferOffset = 0;
+            close(QAMQP::FrameError, "frame size too large");
             return;
+        }
+
+        const int frameSize = QAmqpFrame::HEADER_SIZE + payloadSize + QAmqpFrame::FRAME_END_SIZE;
+        if (buffer.size() - bufferOffset < frameSize)
+            break;
 
-        buffer.resize(readSize);
-        socket->read(buffer.data(), readSize);
-        const char *bufferData = buffer.constData();
-        const quint8 type = *(quint8*)&bufferData[0];
-        const quint8 magic = *(quint8*)&bufferData[QAmqpFrame::HEADER_SIZE + payloadSize];
+        const quint8 magic = quint8(frameData[QAmqpFrame::HEADER_SIZE + payloadSize]);
         if (Q_UNLIKELY(magic != QAmqpFrame::FRAME_END)) {
+            buffer.resize(0);
+            bufferOffset = 0;
             close(QAMQP::UnexpectedFrameError, "wrong end of frame");
             return;
         }
 
-        QDataStream streamB(&buffer, QIODevice::ReadOnly);
-        switch (static_cast<QAmqpFrame::FrameType>(type)) {
-        case QAmqpFrame::Method:
-        {
-            QAmqpMethodFrame frame;
-            streamB >> frame;
+        // handlers may re-enter the event loop and with it this method, pin
+        // the data the frame refers to and consume it before dispatching
+        const QByteArray pinned = buffer;
+        bufferOffset += frameSize;
+        if (!dispatchFrame(frameData) || readPauseCount > 0)
+            break;
+    }
+
+    // keep only the trailing partial frame, if any
+    if (bufferOffset >= buffer.size()) {
+        buffer.resize(0);
+        bufferOffset = 0;
+    } else if (bufferOffset > 0) {
+        buffer.remove(0, bufferOffset);
+        bufferOffset = 0;
+    }
+}
 
-            if (Q_UNLIKELY(frame.size() > frameMax)) {
-                close(QAMQP::FrameError, "frame size too large");
+/*!
+ * Dispatches the frames handed over by the I/O thread. They arrive in chunks
+ * of complete, already validated frames, the current chunk and position are
+ * kept in buffer and bufferOffset so a re-entrant call continues in order.
+ */
+void QAmqpClientPrivate::processIoFrames()
+{
+    while (readPauseCount == 0) {
+        if (bufferOffset >= buffer.size()) {
+            bufferOffset = 0;
+            if (!ioWorker->takeFrames(&buffer)) {
+                buffer.clear();
                 return;
             }
+        }
 
-            if (frame.methodClass() == QAmqpFrame::Connection) {
-                _q_method(frame);
-            } else {
-                foreach (QAmqpMethodFrameHandler *methodHandler, methodHandlersByChannel[frame.channel()])
-                    methodHandler->_q_method(frame);
-            }
+        const char *frameData = buffer.constData() + bufferOffset;
+        const quint32 payloadSize =
+            qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(frameData + 3));
+
+        const QByteArray pinned = buffer;
+        bufferOffset += QAmqpFrame::HEADER_SIZE + payloadSize + QAmqpFrame::FRAME_END_SIZE;
+        if (!dispatchFrame(frameData)) {
+            buffer.clear();
+            bufferOffset = 0;
+            return;
         }
+    }
+}
+
+void QAmqpClientPrivate::_q_ioFrameError(int code, const QString &text)
+{
+    buffer.clear();
+    bufferOffset = 0;
+    close(code, text);
+}
+
+QAmqpChannelSlot &QAmqpClientPrivate::channelSlot(quint16 channel)
+{
+    if (channel >= channelSlots.size())
+        channelSlots.resize(channel + 1);
+    return channelSlots[channel];
+}
+
+void QAmqpClientPrivate::removeMethodHandler(quint16 channel, QAmqpMethodFrameHandler *handler)
+{
+    if (channel >= channelSlots.size())
+        return;
+
+    QAmqpChannelSlot &slot = channelSlots[channel];
+    for (int i = 0; i < slot.pendingReplies.size(); ++i) {
+        if (slot.pendingReplies.at(i) == handler)
+            slot.pendingReplies[i] = 0;
+    }
+
+    QHash<QByteArray, QAmqpMethodFrameHandler*>::Iterator it = slot.consumers.begin();
+    while (it != slot.consumers.end()) {
+        if (it.value() == handler)
+            it = slot.consumers.erase(it);
+        else
+            ++it;
+    }
+
+    QVarLengthArray<QAmqpMethodFrameHandler*, 2> &handlers = slot.methodHandlers;
+    for (int i = 0; i < handlers.size(); ++i) {
+        if (handlers.at(i) != handler)
+            continue;
+
+        for (int j = i + 1; j < handlers.size(); ++j)
+            handlers[j - 1] = handlers.at(j);
+        handlers.removeLast();
+        break;
+    }
+
+    // nothing routed on the number may outlive its last object
+    if (handlers.isEmpty())
+        slot.reset();
+}
+
+/*!
+ * Gives up a reference on a channel number. When the last object on an open
+ * channel is gone, the channel is closed and the number is held back until
+ * the broker confirms with close-ok, or the connection drops, so that a new
+ * channel is never opened on a number the broker still considers open.
+ */
+void QAmqpClientPrivate::releaseChannel(quint16 channel)
+{
+    if (channelAllocator.isShared(channel) || channel >= channelSlots.size()) {
+        channelAllocator.release(channel);
+        return;
+    }
+
+    QAmqpChannelSlot &slot = channelSlots[channel];
+    if (!slot.opened || !connected) {
+        channelAllocator.release(channel);
+        return;
+    }
+
+    slot.releasePending = true;
+    if (slot.closing)
+        return;
+
+    qAmqpChannelDebug("<- channel#close( channel=%d, reply-code=200 )", channel);
+    QByteArray arguments;
+    QAmqpCodecWriter writer(&arguments);
+    writer.writeShort(200);
+    writer.writeShortString(QByteArray("OK"));
+    writer.writeShort(0);
+    writer.writeShort(0);
+
+    QAmqpMethodFrame frame(QAmqpFrame::Channel, QAmqpChannelPrivate::miClose);
+    frame.setChannel(channel);
+    frame.setArguments(arguments);
+    sendFrame(frame);
+    slot.closing = true;
+}
+
+/*!
+ * Handles method frames on a channel waiting to be released. Everything but
+ * close and close-ok is dropped, as the protocol requires of a closing
+ * channel.
+ */
+void QAmqpClientPrivate::finishChannelRelease(quint16 channel, const QAmqpMethodFrame &frame)
+{
+    if (frame.methodClass() != QAmqpFrame::Channel)
+        return;
+
+    if (frame.id() == QAmqpChannelPrivate::miClose) {
+        QAmqpMethodFrame closeOkFrame(QAmqpFrame::Channel, QAmqpChannelPrivate::miCloseOk);
+        closeOkFrame.setChannel(channel);
+        sendFrame(closeOkFrame);
+    } else if (frame.id() != QAmqpChannelPrivate::miCloseOk) {
+        return;
+    }
+
+    qAmqpChannelDebug("-> channel#closeOk( channel=%d ), released", channel);
+    QAmqpChannelSlot &slot = channelSlots[channel];
+    slot.reset();
+    slot.releasePending = false;
+    channelAllocator.release(channel);
+}
+
+/*!
+ * Picks the single handler a frame is meant for: queue class replies and
+ * the basic replies to consume and get go to the object first in line for
+ * a reply, deliveries and cancel-ok to the consumer owning the tag. Returns
+ * false if the frame goes to every handler of the channel instead. target
+ * is set to 0 if the object waiting for the frame is gone.
+ */
+bool QAmqpClientPrivate::routeMethodFrame(QAmqpChannelSlot &slot, const QAmqpMethodFrame &frame,
+                                          QAmqpMethodFrameHandler **target)
+{
+    bool reply = frame.methodClass() == QAmqpFrame::Queue;
+    if (frame.methodClass() == QAmqpFrame::Basic) {
+        switch (frame.id()) {
+        case QAmqpChannelPrivate::bmConsumeOk:
+        case QAmqpChannelPrivate::bmGetOk:
+        case QAmqpChannelPrivate::bmGetEmpty:
+            reply = true;
             break;
-        case QAmqpFrame::Header:
+        case QAmqpChannelPrivate::bmDeliver:
+        case QAmqpChannelPrivate::bmCancelOk:
         {
-            QAmqpContentFrame frame;
-            streamB >> frame;
+            if (slot.consumers.isEmpty())
+                return false;
 
-            if (Q_UNLIKELY(frame.size() > frameMax)) {
-                close(QAMQP::FrameError, "frame size too large");
-                return;
-            } else if (Q_UNLIKELY(frame.channel() <= 0)) {
-                close(QAMQP::ChannelError, "channel number must be greater than zero");
-                return;
-            }
+            QAmqpCodecReader reader(frame.arguments());
+            QHash<QByteArray, QAmqpMethodFrameHandler*>::ConstIterator it =
+                slot.consumers.constFind(reader.readShortStringData());
+            if (it == slot.consumers.constEnd())
+                return false;
 
-            foreach (QAmqpContentFrameHandler *methodHandler, contentHandlerByChannel[frame.channel()])
-                methodHandler->_q_content(frame);
+            *target = it.value();
+            return true;
         }
+        default:
             break;
-        case QAmqpFrame::Body:
-        {
-            QAmqpContentBodyFrame frame;
-            streamB >> frame;
+        }
+    }
 
-            if (Q_UNLIKELY(frame.size() > frameMax)) {
-                close(QAMQP::FrameError, "frame size too large");
-                return;
-            } else if (Q_UNLIKELY(frame.channel() <= 0)) {
-                close(QAMQP::ChannelError, "channel number must be greater than zero");
-                return;
-            }
+    if (!reply || slot.pendingReplies.isEmpty())
+        return false;
+
+    *target = slot.pendingReplies.dequeue();
+    return true;
+}
+
+void QAmqpChannelSlot::reset()
+{
+    pendingReplies.clear();
+    consumers.clear();
+    opened = false;
+    closing = false;
+}
+
+void QAmqpClientPrivate::removeContentHandler(quint16 channel, QAmqpContentFrameHandler *contentHandler,
+                                              QAmqpContentBodyFrameHandler *bodyHandler)
+{
+    if (channel >= channelSlots.size())
+        return;
+
+    QAmqpChannelSlot &slot = channelSlots[channel];
+    if (slot.contentHandler == contentHandler)
+        slot.contentHandler = 0;
+    if (slot.bodyHandler == bodyHandler)
+        slot.bodyHandler = 0;
+}
+
+bool QAmqpClientPrivate::dispatchFrame(const char *data)
+{
+    Q_Q(QAmqpClient);
+    const quint8 type = quint8(data[0]);
+    switch (static_cast<QAmqpFrame::FrameType>(type)) {
+    case QAmqpFrame::Method:
+    {
+        QAmqpMethodFrame frame;
+        if (Q_UNLIKELY(!frame.decode(data))) {
+            close(QAMQP::FrameError, "malformed frame");
+            return false;
+        }
 
-            foreach (QAmqpContentBodyFrameHandler *methodHandler, bodyHandlersByChannel[frame.channel()])
-                methodHandler->_q_body(frame);
+        if (frame.methodClass() == QAmqpFrame::Connection) {
+            _q_method(frame);
+            break;
         }
+
+        const int channel = frame.channel();
+        if (channel < channelSlots.size() && channelSlots.at(channel).releasePending) {
+            finishChannelRelease(quint16(channel), frame);
             break;
-        case QAmqpFrame::Heartbeat:
-        {
-            QAmqpMethodFrame frame;
-            streamB >> frame;
+        }
 
-            if (Q_UNLIKELY(frame.channel() != 0)) {
-                close(QAMQP::FrameError, "heartbeat must have channel id zero");
-                return;
+        if (channel < channelSlots.size()) {
+            QAmqpMethodFrameHandler *target = 0;
+            if (routeMethodFrame(channelSlots[channel], frame, &target)) {
+                if (target)
+                    target->_q_method(frame);
+                break;
             }
+        }
 
-            qAmqpDebug("AMQP: Heartbeat");
-            Q_EMIT q->heartbeat();
+        // a handler may remove itself or add channels while handling the
+        // frame, so the slot is looked up again on every iteration
+        for (int i = 0; channel < channelSlots.size() && i < channelSlots.at(channel).methodHandlers.size(); ++i)
+            channelSlots.at(channel).methodHandlers.at(i)->_q_method(frame);
+    }
+        break;
+    case QAmqpFrame::Header:
+    {
+        QAmqpContentFrame frame;
+        if (Q_UNLIKELY(!frame.decode(data))) {
+            close(QAMQP::FrameError, "malformed frame");
+            return false;
         }
-            break;
-        default:
-            qAmqpDebug() << "AMQP: Unknown frame type: " << type;
-            close(QAMQP::FrameError, "invalid frame type");
-            return;
+
+        if (Q_UNLIKELY(frame.channel() <= 0)) {
+            close(QAMQP::ChannelError, "channel number must be greater than zero");
+            return false;
+        }
+
+        if (frame.channel() < channelSlots.size()) {
+            if (QAmqpContentFrameHandler *handler = channelSlots.at(frame.channel()).contentHandler)
+                handler->_q_content(frame);
         }
     }
+        break;
+    case QAmqpFrame::Body:
+    {
+        QAmqpContentBodyFrame frame;
+        frame.decode(data);
+
+        if (Q_UNLIKELY(frame.channel() <= 0)) {
+            close(QAMQP::ChannelError, "channel number must be greater than zero");
+            return false;
+        }
+
+        if (frame.channel() < channelSlots.size()) {
+            if (QAmqpContentBodyFrameHandler *handler = channelSlots.at(frame.channel()).bodyHandler)
+                handler->_q_body(frame);
+        }
+    }
+        break;
+    case QAmqpFrame::Heartbeat:
+    {
+        QAmqpHeartbeatFrame frame;
+        frame.decode(data);
+
+        if (Q_UNLIKELY(frame.channel() != 0)) {
+            close(QAMQP::FrameError, "heartbeat must have channel id zero");
+            return false;
+        }
+
+        qAmqpFrameDebug("AMQP: Heartbeat");
+        Q_EMIT q->heartbeat();
+    }
+        break;
+    default:
+        qAmqpFrameDebug() << "AMQP: Unknown frame type: " << type;
+        close(QAMQP::FrameError, "invalid frame type");
+        return false;
+    }
+
+    return true;
 }
 
 void QAmqpClientPrivate::sendFrame(const QAmqpFrame &frame)
 {
-    if (socket->state() != QAbstractSocket::ConnectedState) {
-        qAmqpDebug() << Q_FUNC_INFO << "socket not connected: " << socket->state();
+    QByteArray *buffer = beginWrite(0);
+    if (!buffer)
+        return;
+
+    QAmqpCodecWriter writer(buffer);
+    frame.encode(writer);
+    endWrite();
+}
+
+/*!
+ * Gives direct access to the write buffer so callers can encode frames in
+ * place, reserving room for size more bytes. Returns 0 if the socket is not
+ * connected. Every successful call must be followed by endWrite().
+ */
+QByteArray *QAmqpClientPrivate::beginWrite(qint64 size)
+{
+    if (socketState() != QAbstractSocket::ConnectedState) {
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "socket not connected: " << socketState();
+        return 0;
+    }
+
+    if (size > 0)
+        writeBuffer.reserve(writeBuffer.size() + int(size));
+    return &writeBuffer;
+}
+
+void QAmqpClientPrivate::endWrite()
+{
+    if (writeBuffer.size() >= AMQP_WRITE_BUFFER_FLUSH_SIZE) {
+        flushWriteBuffer();
+    } else if (!writeFlushScheduled) {
+        Q_Q(QAmqpClient);
+        writeFlushScheduled = true;
+        QMetaObject::invokeMethod(q, "_q_flushWriteBuffer", Qt::QueuedConnection);
+    }
+
+    if (!writeBufferFull && pendingWriteBytes() >= writeBufferHighWatermark) {
+        Q_Q(QAmqpClient);
+        writeBufferFull = true;
+        Q_EMIT q->writeBufferHighWatermarkReached();
+    }
+}
+
+void QAmqpClientPrivate::flushWriteBuffer()
+{
+    if (writeBuffer.isEmpty())
+        return;
+
+    if (socketState() != QAbstractSocket::ConnectedState) {
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "socket not connected, dropping"
+                               << writeBuffer.size() << "bytes";
+        writeBuffer.clear();
+        return;
+    }
+
+    if (ioWorker) {
+        // the I/O thread takes over the buffer, start a new one
+        ioWorker->write(writeBuffer);
+        writeBuffer = QByteArray();
         return;
     }
 
-    QDataStream stream(socket);
-    stream << frame;
+    socket->write(writeBuffer);
+    writeBuffer.clear();
+}
+
+qint64 QAmqpClientPrivate::pendingWriteBytes() const
+{
+    if (ioWorker)
+        return writeBuffer.size() + ioWorker->bytesToWrite();
+    return writeBuffer.size() + socket->bytesToWrite();
+}
+
+void QAmqpClientPrivate::_q_flushWriteBuffer()
+{
+    writeFlushScheduled = false;
+    flushWriteBuffer();
+}
+
+void QAmqpClientPrivate::_q_bytesWritten(qint64 bytes)
+{
+    Q_UNUSED(bytes)
+    Q_Q(QAmqpClient);
+    if (writeBufferFull && pendingWriteBytes() <= writeBufferLowWatermark) {
+        writeBufferFull = false;
+        Q_EMIT q->writeBufferDrained();
+    }
 }
 
 void QAmqpClientPrivate::closeConnection()
 {
-    qAmqpDebug("AMQP: closing connection");
+    qAmqpConnectionDebug("AMQP: closing connection");
 
     connected = false;
     if (reconnectTimer)
         reconnectTimer->stop();
-    if (heartbeatTimer)
-        heartbeatTimer->stop();
-    socket->disconnectFromHost();
+    stopHeartbeat();
+
+    // make sure a pending close/closeOk makes it out before the socket closes
+    flushWriteBuffer();
+    socketDisconnectFromHost();
 }
 
 bool QAmqpClientPrivate::_q_method(const QAmqpMethodFrame &frame)
@@ -391,7 +952,7 @@ bool QAmqpClientPrivate::_q_method(const QAmqpMethodFrame &frame)
         closeOk(frame);
         break;
     default:
-        qAmqpDebug("Unknown method-id %d", frame.id());
+        qAmqpConnectionDebug("Unknown method-id %d", frame.id());
     }
 
     return true;
@@ -399,25 +960,22 @@ bool QAmqpClientPrivate::_q_method(const QAmqpMethodFrame &frame)
 
 void QAmqpClientPrivate::start(const QAmqpMethodFrame &frame)
 {
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
+    QAmqpCodecReader reader(frame.arguments());
 
-    quint8 version_major = 0;
-    quint8 version_minor = 0;
-    stream >> version_major >> version_minor;
+    quint8 version_major = reader.readOctet();
+    quint8 version_minor = reader.readOctet();
 
-    QAmqpTable table;
-    stream >> table;
+    QAmqpTable table = reader.readTable();
+    serverCapabilities = table.value(QLatin1String("capabilities")).toHash();
 
-    QStringList mechanisms =
-        QAmqpFrame::readAmqpField(stream, QAmqpMetaType::LongString).toString().split(' ');
-    QString locales = QAmqpFrame::readAmqpField(stream, QAmqpMetaType::LongString).toString();
+    QStringList mechanisms = reader.readLongString().split(' ');
+    QString locales = reader.readLongString();
 
-    qAmqpDebug("-> connection#start( version_major=%d, version_minor=%d, mechanisms=(%s), locales=%s )",
-           version_major, version_minor, qPrintable(mechanisms.join(",")), qPrintable(locales));
+    qAmqpConnectionDebug("-> connection#start( version_major=%d, version_minor=%d, mechanisms=(%s), locales=%s )",
+                     version_major, version_minor, qPrintable(mechanisms.join(",")), qPrintable(locales));
 
     if (!mechanisms.contains(authenticator->type())) {
-        socket->disconnectFromHost();
+        socketDisconnectFromHost();
         return;
     }
 
@@ -427,37 +985,37 @@ void QAmqpClientPrivate::start(const QAmqpMethodFrame &frame)
 void QAmqpClientPrivate::secure(const QAmqpMethodFrame &frame)
 {
     Q_UNUSED(frame)
-    qAmqpDebug("-> connection#secure()");
+    qAmqpConnectionDebug("-> connection#secure()");
 }
 
 void QAmqpClientPrivate::tune(const QAmqpMethodFrame &frame)
 {
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
+    QAmqpCodecReader reader(frame.arguments());
 
-    qint16 channel_max = 0,
-           heartbeat_delay = 0;
-    qint32 frame_max = 0;
-
-    stream >> channel_max;
-    stream >> frame_max;
-    stream >> heartbeat_delay;
+    qint16 channel_max = qint16(reader.readShort());
+    qint32 frame_max = qint32(reader.readLong());
+    qint16 heartbeat_delay = qint16(reader.readShort());
 
     if (!frameMax)
         frameMax = frame_max;
-    channelMax = !channelMax ? channel_max : qMax(channel_max, channelMax);
+    // the lower of both limits wins, 0 stands for no limit
+    const quint16 serverChannelMax = quint16(channel_max);
+    const quint16 clientChannelMax = quint16(channelMax);
+    if (!clientChannelMax || (serverChannelMax && serverChannelMax < clientChannelMax))
+        channelMax = qint16(serverChannelMax);
+    channelAllocator.setChannelMax(quint16(channelMax));
     heartbeatDelay = !heartbeatDelay ? heartbeat_delay: heartbeatDelay;
 
-    qAmqpDebug("-> connection#tune( channel_max=%d, frame_max=%d, heartbeat=%d )",
-               channelMax, frameMax, heartbeatDelay);
+    qAmqpConnectionDebug("-> connection#tune( channel_max=%d, frame_max=%d, heartbeat=%d )",
+                         channelMax, frameMax, heartbeatDelay);
 
-    if (heartbeatTimer) {
-        heartbeatTimer->setInterval(heartbeatDelay * 1000);
-        if (heartbeatTimer->interval())
-            heartbeatTimer->start();
-        else
-            heartbeatTimer->stop();
-    }
+    if (ioWorker)
+        ioWorker->setFrameMax(frameMax);
+
+    if (heartbeatDelay)
+        startHeartbeat();
+    else
+        stopHeartbeat();
 
     tuneOk();
     open();
@@ -467,7 +1025,7 @@ void QAmqpClientPrivate::openOk(const QAmqpMethodFrame &frame)
 {
     Q_Q(QAmqpClient);
     Q_UNUSED(frame)
-    qAmqpDebug("-> connection#openOk()");
+    qAmqpConnectionDebug("-> connection#openOk()");
     connected = true;
     Q_EMIT q->connected();
 }
@@ -475,23 +1033,21 @@ void QAmqpClientPrivate::openOk(const QAmqpMethodFrame &frame)
 void QAmqpClientPrivate::closeOk(const QAmqpMethodFrame &frame)
 {
     Q_UNUSED(frame)
-    qAmqpDebug("-> connection#closeOk()");
+    qAmqpConnectionDebug("-> connection#closeOk()");
     closeConnection();
 }
 
 void QAmqpClientPrivate::close(const QAmqpMethodFrame &frame)
 {
     Q_Q(QAmqpClient);
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
-    qint16 code = 0, classId, methodId;
-    stream >> code;
-    QString text = QAmqpFrame::readAmqpField(stream, QAmqpMetaType::ShortString).toString();
-    stream >> classId;
-    stream >> methodId;
+    QAmqpCodecReader reader(frame.arguments());
+    qint16 code = qint16(reader.readShort());
+    QString text = reader.readShortString();
+    qint16 classId = qint16(reader.readShort());
+    qint16 methodId = qint16(reader.readShort());
 
-    qAmqpDebug("-> connection#close( reply-code=%d, reply-text=%s, class-id=%d, method-id:%d )",
-               code, qPrintable(text), classId, methodId);
+    qAmqpConnectionDebug("-> connection#close( reply-code=%d, reply-text=%s, class-id=%d, method-id:%d )",
+                         code, qPrintable(text), classId, methodId);
 
     QAMQP::Error checkError = static_cast<QAMQP::Error>(code);
     if (checkError != QAMQP::NoError) {
@@ -503,7 +1059,7 @@ void QAmqpClientPrivate::close(const QAmqpMethodFrame &frame)
         if (checkError == QAMQP::ConnectionForcedError) {
           closeConnection();
           if (autoReconnect) {
-            qAmqpDebug() << "trying to reconnect after: " << timeout << "ms";
+            qAmqpConnectionDebug() << "trying to reconnect after: " << timeout << "ms";
             QTimer::singleShot(timeout, q, SLOT(_q_connect()));
           }
 
@@ -516,7 +1072,7 @@ void QAmqpClientPrivate::close(const QAmqpMethodFrame &frame)
 
     // complete handshake
     QAmqpMethodFrame closeOkFrame(QAmqpFrame::Connection, QAmqpClientPrivate::miCloseOk);
-    qAmqpDebug("<- connection#closeOk()");
+    qAmqpConnectionDebug("<- connection#closeOk()");
     sendFrame(closeOkFrame);
     closeConnection();
 }
@@ -525,40 +1081,52 @@ void QAmqpClientPrivate::startOk()
 {
     QAmqpMethodFrame frame(QAmqpFrame::Connection, QAmqpClientPrivate::miStartOk);
     QByteArray arguments;
-    QDataStream stream(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter writer(&arguments);
 
     QAmqpTable clientProperties;
     clientProperties["version"] = QString(QAMQP_VERSION);
     clientProperties["platform"] = QString("Qt %1").arg(qVersion());
     clientProperties["product"] = QString("QAMQP");
+    if (!customProperties.contains(QLatin1String("capabilities"))) {
+        // the broker only sends what we tell it we understand
+        QVariantHash capabilities;
+        capabilities["publisher_confirms"] = true;
+        capabilities["basic.nack"] = true;
+        clientProperties["capabilities"] = capabilities;
+    }
     clientProperties.unite(customProperties);
-    stream << clientProperties;
+    writer.writeTable(clientProperties);
 
+    // authenticators are a public API and still write to a QDataStream
+    QByteArray response;
+    QDataStream stream(&response, QIODevice::WriteOnly);
     authenticator->write(stream);
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortString, QLatin1String("en_US"));
+    writer.writeRawData(response);
+
+    writer.writeShortString(QByteArray("en_US"));
     frame.setArguments(arguments);
 
-    qAmqpDebug("<- connection#startOk()");  // @todo: fill this out
+    qAmqpConnectionDebug("<- connection#startOk()");  // @todo: fill this out
     sendFrame(frame);
 }
 
 void QAmqpClientPrivate::secureOk()
 {
-    qAmqpDebug("-> connection#secureOk()");
+    qAmqpConnectionDebug("-> connection#secureOk()");
 }
 
 void QAmqpClientPrivate::tuneOk()
 {
     QAmqpMethodFrame frame(QAmqpFrame::Connection, QAmqpClientPrivate::miTuneOk);
     QByteArray arguments;
-    QDataStream stream(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter writer(&arguments);
 
-    stream << qint16(channelMax);
-    stream << qint32(frameMax);
-    stream << qint16(heartbeatDelay);
+    writer.writeShort(quint16(channelMax));
+    writer.writeLong(quint32(frameMax));
+    writer.writeShort(quint16(heartbeatDelay));
 
-    qAmqpDebug("<- connection#tuneOk( channelMax=%d, frameMax=%d, heartbeatDelay=%d )",
-               channelMax, frameMax, heartbeatDelay);
+    qAmqpConnectionDebug("<- connection#tuneOk( channelMax=%d, frameMax=%d, heartbeatDelay=%d )",
+                         channelMax, frameMax, heartbeatDelay);
 
     frame.setArguments(arguments);
     sendFrame(frame);
@@ -568,15 +1136,15 @@ void QAmqpClientPrivate::open()
 {
     QAmqpMethodFrame frame(QAmqpFrame::Connection, QAmqpClientPrivate::miOpen);
     QByteArray arguments;
-    QDataStream stream(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter writer(&arguments);
 
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortString, virtualHost);
+    writer.writeShortString(virtualHost);
 
-    stream << qint8(0);
-    stream << qint8(0);
+    writer.writeOctet(0);
+    writer.writeOctet(0);
 
-    qAmqpDebug("<- connection#open( virtualHost=%s, reserved-1=%d, reserved-2=%d )",
-               qPrintable(virtualHost), 0, 0);
+    qAmqpConnectionDebug("<- connection#open( virtualHost=%s, reserved-1=%d, reserved-2=%d )",
+                         qPrintable(virtualHost), 0, 0);
 
     frame.setArguments(arguments);
     sendFrame(frame);
@@ -585,14 +1153,14 @@ void QAmqpClientPrivate::open()
 void QAmqpClientPrivate::close(int code, const QString &text, int classId, int methodId)
 {
     QByteArray arguments;
-    QDataStream stream(&arguments, QIODevice::WriteOnly);
-    stream << qint16(code);
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortString, text);
-    stream << qint16(classId);
-    stream << qint16(methodId);
+    QAmqpCodecWriter writer(&arguments);
+    writer.writeShort(quint16(code));
+    writer.writeShortString(text);
+    writer.writeShort(quint16(classId));
+    writer.writeShort(quint16(methodId));
 
-    qAmqpDebug("<- connection#close( reply-code=%d, reply-text=%s, class-id=%d, method-id:%d )",
-               code, qPrintable(text), classId, methodId);
+    qAmqpConnectionDebug("<- connection#close( reply-code=%d, reply-text=%s, class-id=%d, method-id:%d )",
+                         code, qPrintable(text), classId, methodId);
 
     QAmqpMethodFrame frame(QAmqpFrame::Connection, QAmqpClientPrivate::miClose);
     frame.setArguments(arguments);
@@ -618,8 +1186,20 @@ QAmqpClient::QAmqpClient(QAmqpClientPrivate *dd, QObject *parent)
 QAmqpClient::~QAmqpClient()
 {
     Q_D(QAmqpClient);
-    if (d->connected)
+    if (d->connected) {
         d->_q_disconnect();
+
+        // we won't see another event loop turn, write out the close synchronously
+        d->flushWriteBuffer();
+        if (d->writeTimeout >= -1) {
+            if (d->ioWorker) {
+                QMetaObject::invokeMethod(d->ioWorker, "flush", Qt::BlockingQueuedConnection,
+                                          Q_ARG(int, d->writeTimeout));
+            } else {
+                d->socket->waitForBytesWritten(d->writeTimeout);
+            }
+        }
+    }
 }
 
 bool QAmqpClient::isConnected() const
@@ -716,7 +1296,9 @@ QAmqpExchange *QAmqpClient::createExchange(const QString &name, int channelNumbe
     }
 
     exchange = new QAmqpExchange(channelNumber, this);
-    d->methodHandlersByChannel[exchange->channelNumber()].append(exchange->d_func());
+    // without a channel number the exchange stays inert, see error()
+    if (exchange->channelNumber())
+        d->channelSlot(exchange->channelNumber()).methodHandlers.append(exchange->d_func());
     connect(this, SIGNAL(connected()), exchange, SLOT(_q_open()));
     connect(this, SIGNAL(disconnected()), exchange, SLOT(_q_disconnected()));
     exchange->d_func()->open();
@@ -743,9 +1325,15 @@ QAmqpQueue *QAmqpClient::createQueue(const QString &name, int channelNumber)
     }
 
     queue = new QAmqpQueue(channelNumber, this);
-    d->methodHandlersByChannel[queue->channelNumber()].append(queue->d_func());
-    d->contentHandlerByChannel[queue->channelNumber()].append(queue->d_func());
-    d->bodyHandlersByChannel[queue->channelNumber()].append(queue->d_func());
+    // without a channel number the queue stays inert, see error()
+    if (queue->channelNumber()) {
+        QAmqpChannelSlot &slot = d->channelSlot(queue->channelNumber());
+        slot.methodHandlers.append(queue->d_func());
+        if (!slot.contentHandler) {
+            slot.contentHandler = queue->d_func();
+            slot.bodyHandler = queue->d_func();
+        }
+    }
     connect(this, SIGNAL(connected()), queue, SLOT(_q_open()));
     connect(this, SIGNAL(disconnected()), queue, SLOT(_q_disconnected()));
     queue->d_func()->open();
@@ -801,11 +1389,12 @@ void QAmqpClient::setChannelMax(qint16 channelMax)
 {
     Q_D(QAmqpClient);
     if (d->connected) {
-        qAmqpDebug() << Q_FUNC_INFO << "can't modify value while connected";
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "can't modify value while connected";
         return;
     }
 
     d->channelMax = channelMax;
+    d->channelAllocator.setChannelMax(quint16(channelMax));
 }
 
 qint32 QAmqpClient::frameMax() const
@@ -818,7 +1407,7 @@ void QAmqpClient::setFrameMax(qint32 frameMax)
 {
     Q_D(QAmqpClient);
     if (d->connected) {
-        qAmqpDebug() << Q_FUNC_INFO << "can't modify value while connected";
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "can't modify value while connected";
         return;
     }
 
@@ -835,7 +1424,7 @@ void QAmqpClient::setHeartbeatDelay(qint16 delay)
 {
     Q_D(QAmqpClient);
     if (d->connected) {
-        qAmqpDebug() << Q_FUNC_INFO << "can't modify value while connected";
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "can't modify value while connected";
         return;
     }
 
@@ -844,12 +1433,89 @@ void QAmqpClient::setHeartbeatDelay(qint16 delay)
 
 int QAmqpClient::writeTimeout() const
 {
-    return QAmqpFrame::writeTimeout();
+    Q_D(const QAmqpClient);
+    return d->writeTimeout;
 }
 
 void QAmqpClient::setWriteTimeout(int msecs)
 {
-    QAmqpFrame::setWriteTimeout(msecs);
+    Q_D(QAmqpClient);
+    d->writeTimeout = msecs;
+}
+
+qint64 QAmqpClient::writeBufferLowWatermark() const
+{
+    Q_D(const QAmqpClient);
+    return d->writeBufferLowWatermark;
+}
+
+qint64 QAmqpClient::writeBufferHighWatermark() const
+{
+    Q_D(const QAmqpClient);
+    return d->writeBufferHighWatermark;
+}
+
+void QAmqpClient::setWriteBufferWatermarks(qint64 low, qint64 high)
+{
+    Q_D(QAmqpClient);
+    if (low > high) {
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "low watermark must not exceed high watermark";
+        return;
+    }
+
+    d->writeBufferLowWatermark = low;
+    d->writeBufferHighWatermark = high;
+}
+
+qint64 QAmqpClient::bytesToWrite() const
+{
+    Q_D(const QAmqpClient);
+    return d->pendingWriteBytes();
+}
+
+bool QAmqpClient::isWriteBufferFull() const
+{
+    Q_D(const QAmqpClient);
+    return d->writeBufferFull;
+}
+
+bool QAmqpClient::isIoThreadEnabled() const
+{
+    Q_D(const QAmqpClient);
+    return d->ioWorker != 0;
+}
+
+/*!
+ * Runs socket I/O, frame splitting, heartbeats and writing out the write
+ * buffer on a dedicated thread, so a slow handler on this thread does not
+ * hold up heartbeats or reads. The I/O thread is pinned to cpu if it is not
+ * negative and the platform supports it. Exchanges, queues and all signals
+ * stay on the thread the client lives in.
+ *
+ * Can only be changed while disconnected. When using SSL, errors to ignore
+ * must be given with ignoreSslErrors() before connecting.
+ */
+void QAmqpClient::setIoThreadEnabled(bool enabled, int cpu)
+{
+    Q_D(QAmqpClient);
+    if (d->socketState() != QAbstractSocket::UnconnectedState) {
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "can't modify value while connected";
+        return;
+    }
+
+    if (enabled == (d->ioWorker != 0) && (!enabled || cpu == d->ioThreadCpu))
+        return;
+
+    QSslConfiguration config = sslConfiguration();
+    d->stopIoThread();
+    if (enabled) {
+        d->startIoThread(cpu);
+        d->ioWorker->setSslConfiguration(config);
+    } else {
+        if (d->socket == 0)
+            d->initSocket();
+        d->socket->setSslConfiguration(config);
+    }
 }
 
 void QAmqpClient::addCustomProperty(const QString &name, const QString &value)
@@ -867,13 +1533,13 @@ QString QAmqpClient::customProperty(const QString &name) const
 QAbstractSocket::SocketError QAmqpClient::socketError() const
 {
     Q_D(const QAmqpClient);
-    return d->socket->error();
+    return d->socketError();
 }
 
 QAbstractSocket::SocketState QAmqpClient::socketState() const
 {
     Q_D(const QAmqpClient);
-    return d->socket->state();
+    return d->socketState();
 }
 
 QAMQP::Error QAmqpClient::error() const
@@ -891,6 +1557,8 @@ QString QAmqpClient::errorString() const
 QSslConfiguration QAmqpClient::sslConfiguration() const
 {
     Q_D(const QAmqpClient);
+    if (d->ioWorker)
+        return d->ioWorker->sslConfiguration();
     return d->socket->sslConfiguration();
 }
 
@@ -900,7 +1568,10 @@ void QAmqpClient::setSslConfiguration(const QSslConfiguration &config)
     if (!config.isNull()) {
         d->useSsl = true;
         d->port = AMQP_SSL_PORT;
-        d->socket->setSslConfiguration(config);
+        if (d->ioWorker)
+            d->ioWorker->setSslConfiguration(config);
+        else
+            d->socket->setSslConfiguration(config);
     }
 }
 
@@ -912,6 +1583,14 @@ QString QAmqpClient::gitVersion()
 void QAmqpClient::ignoreSslErrors(const QList<QSslError> &errors)
 {
     Q_D(QAmqpClient);
+    if (d->ioWorker) {
+        // the handshake runs on the I/O thread, errors to ignore should be
+        // given before connecting
+        QMetaObject::invokeMethod(d->ioWorker, "ignoreSslErrors", Qt::QueuedConnection,
+                                  Q_ARG(QList<QSslError>, errors));
+        return;
+    }
+
     d->socket->ignoreSslErrors(errors);
 }
 
@@ -83,6 +83,15 @@ public:
     int writeTimeout() const;
     void setWriteTimeout(int msecs);
 
+    qint64 writeBufferLowWatermark() const;
+    qint64 writeBufferHighWatermark() const;
+    void setWriteBufferWatermarks(qint64 low, qint64 high);
+    qint64 bytesToWrite() const;
+    bool isWriteBufferFull() const;
+
+    bool isIoThreadEnabled() const;
+    void setIoThreadEnabled(bool enabled, int cpu = -1);
+
     void addCustomProperty(const QString &name, const QString &value);
     QString customProperty(const QString &name) const;
 
@@ -118,7 +127,9 @@ Q_SIGNALS:
     void socketError(QAbstractSocket::SocketError error);
     void socketStateChanged(QAbstractSocket::SocketState state);
     void sslErrors(const QList<QSslError> &errors);
-    
+    void writeBufferHighWatermarkReached();
+    void writeBufferDrained();
+
 public Q_SLOTS:
     void ignoreSslErrors(const QList<QSslError> &errors);
 
@@ -135,8 +146,11 @@ private:
     Q_PRIVATE_SLOT(d_func(), void _q_readyRead())
     Q_PRIVATE_SLOT(d_func(), void _q_socketError(QAbstractSocket::SocketError error))
     Q_PRIVATE_SLOT(d_func(), void _q_heartbeat())
+    Q_PRIVATE_SLOT(d_func(), void _q_flushWriteBuffer())
+    Q_PRIVATE_SLOT(d_func(), void _q_bytesWritten(qint64 bytes))
     Q_PRIVATE_SLOT(d_func(), void _q_connect())
     Q_PRIVATE_SLOT(d_func(), void _q_disconnect())
+    Q_PRIVATE_SLOT(d_func(), void _q_ioFrameError(int code, const QString &text))
 
     friend class QAmqpChannelPrivate;
     friend class QAmqpQueuePrivate;
@@ -2,26 +2,65 @@
 #define QAMQPCLIENT_P_H
 
 #include <QHash>
+#include <QQueue>
 #include <QSharedPointer>
 #include <QPointer>
 #include <QAbstractSocket>
 #include <QSslError>
+#include <QVarLengthArray>
+#include <QVector>
 
+#include "qamqpchannelallocator_p.h"
 #include "qamqpchannelhash_p.h"
 #include "qamqpglobal.h"
 #include "qamqpauthenticator.h"
 #include "qamqptable.h"
+#include "qamqpcodec_p.h"
 #include "qamqpframe_p.h"
 
 #define METHOD_ID_ENUM(name, id) name = id, name ## Ok
 
 class QTimer;
+class QThread;
 class QSslSocket;
+class QAmqpIoWorker;
 class QAmqpClient;
 class QAmqpQueue;
+class QAmqpQueuePrivate;
 class QAmqpExchange;
 class QAmqpConnection;
 class QAmqpAuthenticator;
+
+/*!
+ * The frame handlers of one channel number. Channel objects sharing a
+ * number all see its method frames, except for replies and deliveries:
+ * replies go to the object first in line for one, deliveries to the
+ * consumer owning their consumer tag. Content frames go to the consumer
+ * that accepted the last delivery.
+ */
+struct QAmqpChannelSlot
+{
+    QAmqpChannelSlot()
+        : contentHandler(0), bodyHandler(0), opened(false), closing(false), releasePending(false) {}
+
+    void reset();
+
+    QVarLengthArray<QAmqpMethodFrameHandler*, 2> methodHandlers;
+    QAmqpContentFrameHandler *contentHandler;
+    QAmqpContentBodyFrameHandler *bodyHandler;
+
+    // objects waiting for a queue or basic reply, in request order. Entries
+    // of objects that are gone are 0, their reply is dropped
+    QQueue<QAmqpMethodFrameHandler*> pendingReplies;
+    QHash<QByteArray, QAmqpMethodFrameHandler*> consumers;
+    bool opened;
+    bool closing;           // channel.close sent, waiting for close-ok
+
+    // the last object on the number is gone, the number is only released
+    // once the broker has closed the channel. Not cleared by reset()
+    bool releasePending;
+};
+
 class QAMQP_EXPORT QAmqpClientPrivate : public QAmqpMethodFrameHandler
 {
 public:
@@ -38,11 +77,28 @@ public:
 
     virtual void init();
     virtual void initSocket();
+    void connectSocket();
+    void startIoThread(int cpu);
+    void stopIoThread();
     void resetChannelState();
     void setUsername(const QString &username);
     void setPassword(const QString &password);
     void parseConnectionString(const QString &uri);
     void sendFrame(const QAmqpFrame &frame);
+    QByteArray *beginWrite(qint64 size);
+    void endWrite();
+    void flushWriteBuffer();
+    qint64 pendingWriteBytes() const;
+
+    // socket access, forwarded to the I/O thread when there is one
+    QAbstractSocket::SocketState socketState() const;
+    QAbstractSocket::SocketError socketError() const;
+    QString socketErrorString() const;
+    void socketWrite(const QByteArray &data);
+    void socketDisconnectFromHost();
+    void socketAbort();
+    void startHeartbeat();
+    void stopHeartbeat();
 
     void closeConnection();
 
@@ -50,10 +106,29 @@ public:
     void _q_socketConnected();
     void _q_socketDisconnected();
     void _q_readyRead();
+    void readSocketFrames();
+    void processIoFrames();
+    void flushMessageBatches();
+    void pauseReading();
+    void resumeReading();
+    bool dispatchFrame(const char *data);
+    bool routeMethodFrame(QAmqpChannelSlot &slot, const QAmqpMethodFrame &frame,
+                          QAmqpMethodFrameHandler **target);
+
+    // channel slots, see QAmqpChannelSlot
+    QAmqpChannelSlot &channelSlot(quint16 channel);
+    void removeMethodHandler(quint16 channel, QAmqpMethodFrameHandler *handler);
+    void releaseChannel(quint16 channel);
+    void finishChannelRelease(quint16 channel, const QAmqpMethodFrame &frame);
+    void removeContentHandler(quint16 channel, QAmqpContentFrameHandler *contentHandler,
+                              QAmqpContentBodyFrameHandler *bodyHandler);
     void _q_socketError(QAbstractSocket::SocketError error);
     void _q_heartbeat();
+    void _q_flushWriteBuffer();
+    void _q_bytesWritten(qint64 bytes);
     virtual void _q_connect();
     void _q_disconnect();
+    void _q_ioFrameError(int code, const QString &text);
 
     virtual bool _q_method(const QAmqpMethodFrame &frame);
 
@@ -81,17 +156,43 @@ public:
     QSharedPointer<QAmqpAuthenticator> authenticator;
 
     // Network
+    // inbound data is read in bulk into buffer, complete frames are decoded in
+    // place starting at bufferOffset and only a trailing partial frame is kept
     QByteArray buffer;
+    int bufferOffset;
     bool autoReconnect;
     bool reconnectFixedTimeout;
     int timeout;
     bool connecting;
     bool useSsl;
+    int writeTimeout;
+
+    // outbound frames are coalesced here and written once per event loop turn
+    QByteArray writeBuffer;
+    bool writeFlushScheduled;
+    bool writeBufferFull;
+    qint64 writeBufferLowWatermark;
+    qint64 writeBufferHighWatermark;
 
     QSslSocket *socket;
-    QHash<quint16, QList<QAmqpMethodFrameHandler*> > methodHandlersByChannel;
-    QHash<quint16, QList<QAmqpContentFrameHandler*> > contentHandlerByChannel;
-    QHash<quint16, QList<QAmqpContentBodyFrameHandler*> > bodyHandlersByChannel;
+
+    // optional I/O thread, owning the socket when it is used
+    QThread *ioThread;
+    QAmqpIoWorker *ioWorker;
+    int ioThreadCpu;
+
+    // frame handlers indexed by channel number, grown as channels are added
+    QVector<QAmqpChannelSlot> channelSlots;
+
+    // queues holding messages for their batch handler, flushed per read
+    QVector<QAmqpQueuePrivate*> pendingBatches;
+
+    // number of queues over their buffer limit asking to stop reading
+    int readPauseCount;
+    QAmqpChannelAllocator channelAllocator;
+
+    // exchange names and routing keys of deliveries, interned per connection
+    QAmqpShortStringCache shortStrings;
 
     // Connection
     bool closed;
@@ -99,6 +200,7 @@ public:
     QPointer<QTimer> heartbeatTimer;
     QPointer<QTimer> reconnectTimer;
     QAmqpTable customProperties;
+    QAmqpTable serverCapabilities;
     qint16 channelMax;
     qint16 heartbeatDelay;
     qint32 frameMax;
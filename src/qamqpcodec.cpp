@@ -0,0 +1,430 @@
+#include <float.h>
+
+#include <QDateTime>
+#include <QDebug>
+
+#include "qamqpcodec_p.h"
+#include "qamqpfieldtable_p.h"
+
+/*
+ * field value types according to: https://www.rabbitmq.com/amqp-0-9-1-errata.html
+t - Boolean
+b - Signed 8-bit
+    Unsigned 8-bit
+s - Signed 16-bit
+    Unsigned 16-bit
+I - Signed 32-bit
+    Unsigned 32-bit
+l - Signed 64-bit
+    Unsigned 64-bit
+f - 32-bit float
+d - 64-bit float
+D - Decimal
+S - Long string
+A - Array
+T - Timestamp (u64)
+F - Nested Table
+V - Void
+x - Byte array
+*/
+
+static QAmqpMetaType::ValueType valueTypeForOctet(qint8 octet)
+{
+    switch (octet) {
+    case 't': return QAmqpMetaType::Boolean;
+    case 'b': return QAmqpMetaType::ShortShortInt;
+    case 's': return QAmqpMetaType::ShortInt;
+    case 'I': return QAmqpMetaType::LongInt;
+    case 'l': return QAmqpMetaType::LongLongInt;
+    case 'f': return QAmqpMetaType::Float;
+    case 'd': return QAmqpMetaType::Double;
+    case 'D': return QAmqpMetaType::Decimal;
+    case 'S': return QAmqpMetaType::LongString;
+    case 'A': return QAmqpMetaType::Array;
+    case 'T': return QAmqpMetaType::Timestamp;
+    case 'F': return QAmqpMetaType::Hash;
+    case 'V': return QAmqpMetaType::Void;
+    case 'x': return QAmqpMetaType::Bytes;
+    default:
+        qAmqpFrameDebug() << Q_FUNC_INFO << "invalid octet received: " << char(octet);
+    }
+
+    return QAmqpMetaType::Invalid;
+}
+
+static qint8 valueTypeToOctet(QAmqpMetaType::ValueType type)
+{
+    switch (type) {
+    case QAmqpMetaType::Boolean: return 't';
+    case QAmqpMetaType::ShortShortInt: return 'b';
+    case QAmqpMetaType::ShortInt: return 's';
+    case QAmqpMetaType::LongInt: return 'I';
+    case QAmqpMetaType::LongLongInt: return 'l';
+    case QAmqpMetaType::Float: return 'f';
+    case QAmqpMetaType::Double: return 'd';
+    case QAmqpMetaType::Decimal: return 'D';
+    case QAmqpMetaType::LongString: return 'S';
+    case QAmqpMetaType::Array: return 'A';
+    case QAmqpMetaType::Timestamp: return 'T';
+    case QAmqpMetaType::Hash: return 'F';
+    case QAmqpMetaType::Void: return 'V';
+    case QAmqpMetaType::Bytes: return 'x';
+    default:
+        qAmqpFrameDebug() << Q_FUNC_INFO << "invalid type received: " << char(type);
+    }
+
+    return 'V';
+}
+
+static const int maxCachedShortStrings = 4096;
+
+QString QAmqpShortStringCache::intern(const QByteArray &data)
+{
+    // data is usually a view of the read buffer, only copied when inserted
+    QHash<QByteArray, QString>::ConstIterator it = strings_.constFind(data);
+    if (it != strings_.constEnd())
+        return it.value();
+
+    const QString value = QString::fromUtf8(data.constData(), data.size());
+    if (strings_.size() < maxCachedShortStrings)
+        strings_.insert(QByteArray(data.constData(), data.size()), value);
+    return value;
+}
+
+void QAmqpShortStringCache::clear()
+{
+    strings_.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+QVariant QAmqpCodecReader::readField(QAmqpMetaType::ValueType type)
+{
+    switch (type) {
+    case QAmqpMetaType::Boolean:
+        return QVariant::fromValue<bool>(readBoolean());
+    case QAmqpMetaType::ShortShortUint:
+        return QVariant::fromValue<int>(readOctet());
+    case QAmqpMetaType::ShortUint:
+        return QVariant::fromValue<uint>(readShort());
+    case QAmqpMetaType::LongUint:
+        return QVariant::fromValue<uint>(readLong());
+    case QAmqpMetaType::LongLongUint:
+        return QVariant::fromValue<qulonglong>(readLongLong());
+    case QAmqpMetaType::ShortString:
+        return readShortString();
+    case QAmqpMetaType::LongString:
+        return readLongString();
+    case QAmqpMetaType::Timestamp:
+        return QDateTime::fromTime_t(uint(readLongLong()));
+    case QAmqpMetaType::Hash:
+        return readTable();
+    case QAmqpMetaType::ShortShortInt:
+        return QVariant::fromValue<int>(qint8(readOctet()));
+    case QAmqpMetaType::ShortInt:
+        return QVariant::fromValue<int>(qint16(readShort()));
+    case QAmqpMetaType::LongInt:
+        return QVariant::fromValue<int>(qint32(readLong()));
+    case QAmqpMetaType::LongLongInt:
+        return QVariant::fromValue<qlonglong>(qint64(readLongLong()));
+    case QAmqpMetaType::Float:
+        return QVariant::fromValue<float>(readFloat());
+    case QAmqpMetaType::Double:
+        return QVariant::fromValue<double>(readDouble());
+    case QAmqpMetaType::Decimal:
+    {
+        QAMQP::Decimal v;
+        v.scale = qint8(readOctet());
+        v.value = readLong();
+        return QVariant::fromValue<QAMQP::Decimal>(v);
+    }
+    case QAmqpMetaType::Array:
+        return readArray();
+    case QAmqpMetaType::Bytes:
+    {
+        // deep copy, the result outlives the data we are reading from
+        const QByteArray bytes = readLongStringData();
+        return QByteArray(bytes.constData(), bytes.size());
+    }
+    case QAmqpMetaType::Void:
+        return QVariant();
+    default:
+        qAmqpFrameDebug() << Q_FUNC_INFO << "unsupported value type: " << type;
+        setError();
+    }
+
+    return QVariant();
+}
+
+QAmqpMetaType::ValueType QAmqpCodecReader::readValueType()
+{
+    return valueTypeForOctet(qint8(readOctet()));
+}
+
+QVariant QAmqpCodecReader::readFieldValue()
+{
+    return readField(readValueType());
+}
+
+void QAmqpCodecReader::skipField(QAmqpMetaType::ValueType type)
+{
+    switch (type) {
+    case QAmqpMetaType::Boolean:
+    case QAmqpMetaType::ShortShortUint:
+    case QAmqpMetaType::ShortShortInt:
+        skip(1);
+        break;
+    case QAmqpMetaType::ShortUint:
+    case QAmqpMetaType::ShortInt:
+        skip(2);
+        break;
+    case QAmqpMetaType::LongUint:
+    case QAmqpMetaType::LongInt:
+    case QAmqpMetaType::Float:
+        skip(4);
+        break;
+    case QAmqpMetaType::Decimal:
+        skip(5);
+        break;
+    case QAmqpMetaType::LongLongUint:
+    case QAmqpMetaType::LongLongInt:
+    case QAmqpMetaType::Double:
+    case QAmqpMetaType::Timestamp:
+        skip(8);
+        break;
+    case QAmqpMetaType::ShortString:
+        skip(readOctet());
+        break;
+    case QAmqpMetaType::LongString:
+    case QAmqpMetaType::Hash:
+    case QAmqpMetaType::Array:
+    case QAmqpMetaType::Bytes:
+        skip(readLong());
+        break;
+    case QAmqpMetaType::Void:
+        break;
+    default:
+        qAmqpFrameDebug() << Q_FUNC_INFO << "unsupported value type: " << type;
+        setError();
+    }
+}
+
+void QAmqpCodecReader::skipFieldValue()
+{
+    skipField(readValueType());
+}
+
+QAmqpTable QAmqpCodecReader::readTable()
+{
+    QAmqpTable table;
+    QAmqpCodecReader entriesReader = subReader(readLong());
+    entriesReader.readTableEntries(&table);
+    if (entriesReader.hasError())
+        error_ = true;
+    return table;
+}
+
+void QAmqpCodecReader::readTableEntries(QAmqpTable *table)
+{
+    while (!atEnd()) {
+        const QString key = readShortString();
+        const QVariant value = readFieldValue();
+        if (hasError())
+            break;
+        table->insert(key, value);
+    }
+}
+
+QVariantList QAmqpCodecReader::readArray()
+{
+    QVariantList result;
+    QAmqpCodecReader arrayReader = subReader(readLong());
+    while (!arrayReader.atEnd()) {
+        const QVariant value = arrayReader.readFieldValue();
+        if (arrayReader.hasError())
+            break;
+        result.append(value);
+    }
+
+    if (arrayReader.hasError())
+        error_ = true;
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void QAmqpCodecWriter::writeField(QAmqpMetaType::ValueType type, const QVariant &value)
+{
+    switch (type) {
+    case QAmqpMetaType::Boolean:
+        writeBoolean(value.toBool());
+        break;
+    case QAmqpMetaType::ShortShortUint:
+        writeOctet(quint8(value.toUInt()));
+        break;
+    case QAmqpMetaType::ShortUint:
+        writeShort(quint16(value.toUInt()));
+        break;
+    case QAmqpMetaType::LongUint:
+        writeLong(quint32(value.toUInt()));
+        break;
+    case QAmqpMetaType::LongLongUint:
+        writeLongLong(quint64(value.toULongLong()));
+        break;
+    case QAmqpMetaType::ShortString:
+        writeShortString(value.toString());
+        break;
+    case QAmqpMetaType::LongString:
+        writeLongString(value.toString());
+        break;
+    case QAmqpMetaType::Timestamp:
+        writeLongLong(quint64(value.toDateTime().toTime_t()));
+        break;
+    case QAmqpMetaType::Hash:
+        writeTable(QAmqpTable(value.toHash()));
+        break;
+    case QAmqpMetaType::ShortShortInt:
+        writeOctet(quint8(qint8(value.toInt())));
+        break;
+    case QAmqpMetaType::ShortInt:
+        writeShort(quint16(qint16(value.toInt())));
+        break;
+    case QAmqpMetaType::LongInt:
+        writeLong(quint32(qint32(value.toInt())));
+        break;
+    case QAmqpMetaType::LongLongInt:
+        writeLongLong(quint64(value.toLongLong()));
+        break;
+    case QAmqpMetaType::Float:
+        writeFloat(value.toFloat());
+        break;
+    case QAmqpMetaType::Double:
+        writeDouble(value.toDouble());
+        break;
+    case QAmqpMetaType::Decimal:
+    {
+        QAMQP::Decimal v(value.value<QAMQP::Decimal>());
+        writeOctet(quint8(v.scale));
+        writeLong(v.value);
+    }
+        break;
+    case QAmqpMetaType::Array:
+        writeArray(value.toList());
+        break;
+    case QAmqpMetaType::Bytes:
+        writeLongString(value.toByteArray());
+        break;
+    case QAmqpMetaType::Void:
+        break;
+    default:
+        qAmqpFrameDebug() << Q_FUNC_INFO << "unhandled type: " << type;
+    }
+}
+
+void QAmqpCodecWriter::writeFieldValue(const QVariant &value)
+{
+    QAmqpMetaType::ValueType type;
+    switch (value.userType()) {
+    case QMetaType::Bool:
+        type = QAmqpMetaType::Boolean;
+        break;
+    case QMetaType::QByteArray:
+        type = QAmqpMetaType::Bytes;
+        break;
+    case QMetaType::Int:
+    {
+        int i = qAbs(value.toInt());
+        if (i <= qint8(SCHAR_MAX)) {
+            type = QAmqpMetaType::ShortShortInt;
+        } else if (i <= qint16(SHRT_MAX)) {
+            type = QAmqpMetaType::ShortInt;
+        } else {
+            type = QAmqpMetaType::LongInt;
+        }
+    }
+        break;
+    case QMetaType::UShort:
+        type = QAmqpMetaType::ShortInt;
+        break;
+    case QMetaType::UInt:
+    {
+        int i = value.toInt();
+        if (i <= qint8(SCHAR_MAX)) {
+            type = QAmqpMetaType::ShortShortInt;
+        } else if (i <= qint16(SHRT_MAX)) {
+            type = QAmqpMetaType::ShortInt;
+        } else {
+            type = QAmqpMetaType::LongInt;
+        }
+    }
+        break;
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+        type = QAmqpMetaType::LongLongInt;
+        break;
+    case QMetaType::QString:
+        type = QAmqpMetaType::LongString;
+        break;
+    case QMetaType::QDateTime:
+        type = QAmqpMetaType::Timestamp;
+        break;
+    case QMetaType::Double:
+        type = value.toDouble() > FLT_MAX ? QAmqpMetaType::Double : QAmqpMetaType::Float;
+        break;
+    case QMetaType::QVariantHash:
+        type = QAmqpMetaType::Hash;
+        break;
+    case QMetaType::QVariantList:
+        type = QAmqpMetaType::Array;
+        break;
+    case QMetaType::Void:
+        type = QAmqpMetaType::Void;
+        break;
+    default:
+        if (value.userType() == qMetaTypeId<QAMQP::Decimal>()) {
+            type = QAmqpMetaType::Decimal;
+            break;
+        } else if (!value.isValid()) {
+            type = QAmqpMetaType::Void;
+            break;
+        }
+
+        qAmqpFrameDebug() << Q_FUNC_INFO << "unhandled type: " << value.userType();
+        return;
+    }
+
+    // write the field value type, a requirement for field tables only
+    writeOctet(quint8(valueTypeToOctet(type)));
+    writeField(type, value);
+}
+
+void QAmqpCodecWriter::writeTable(const QAmqpTable &table)
+{
+    const int sizeOffset = reserveLong();
+    writeTableEntries(table);
+    patchLong(sizeOffset, quint32(buffer_->size() - sizeOffset - 4));
+}
+
+void QAmqpCodecWriter::writeTable(const QAmqpFieldTable &table)
+{
+    writeLongString(table.entries());
+}
+
+void QAmqpCodecWriter::writeTableEntries(const QAmqpTable &table)
+{
+    QAmqpTable::ConstIterator it;
+    QAmqpTable::ConstIterator itEnd = table.constEnd();
+    for (it = table.constBegin(); it != itEnd; ++it) {
+        writeShortString(it.key());
+        writeFieldValue(it.value());
+    }
+}
+
+void QAmqpCodecWriter::writeArray(const QVariantList &array)
+{
+    const int sizeOffset = reserveLong();
+    for (int i = 0; i < array.size(); ++i)
+        writeFieldValue(array.at(i));
+
+    patchLong(sizeOffset, quint32(buffer_->size() - sizeOffset - 4));
+}
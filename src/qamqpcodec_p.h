@@ -0,0 +1,301 @@
+#ifndef QAMQPCODEC_P_H
+#define QAMQPCODEC_P_H
+
+#include <string.h>
+
+#include <QByteArray>
+#include <QDebug>
+#include <QHash>
+#include <QString>
+#include <QVariant>
+#include <QtEndian>
+
+#include "qamqpglobal.h"
+#include "qamqplogging_p.h"
+#include "qamqptable.h"
+
+class QAmqpFieldTable;
+
+/*!
+ * QAmqpShortStringCache interns short strings that are received over and
+ * over, such as the exchange names and routing keys of deliveries. Repeated
+ * values come back as shared copies of the first decoded string, without
+ * another conversion or allocation. The cache is bounded, values seen once
+ * it is full are decoded as usual.
+ */
+class QAmqpShortStringCache
+{
+public:
+    QString intern(const QByteArray &data);
+    void clear();
+
+private:
+    QHash<QByteArray, QString> strings_;
+};
+
+/*!
+ * QAmqpCodecReader decodes AMQP wire data from a raw byte span. All reads are
+ * bounds checked: reading past the end of the span yields zero values, moves
+ * the reader to the end and sets the error flag. The reader never owns the
+ * data it is given, which must outlive it.
+ */
+class QAmqpCodecReader
+{
+public:
+    inline QAmqpCodecReader(const char *data, int size)
+        : pos_(data), end_(data + size), error_(false) {}
+    inline explicit QAmqpCodecReader(const QByteArray &data)
+        : pos_(data.constData()), end_(data.constData() + data.size()), error_(false) {}
+
+    inline bool atEnd() const { return pos_ == end_; }
+    inline bool hasError() const { return error_; }
+    inline int remaining() const { return int(end_ - pos_); }
+    inline const char *position() const { return pos_; }
+
+    inline quint8 readOctet()
+    {
+        if (!require(1))
+            return 0;
+        return quint8(*pos_++);
+    }
+
+    inline bool readBoolean() { return readOctet() != 0; }
+
+    inline quint16 readShort()
+    {
+        if (!require(2))
+            return 0;
+        const quint16 value = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(pos_));
+        pos_ += 2;
+        return value;
+    }
+
+    inline quint32 readLong()
+    {
+        if (!require(4))
+            return 0;
+        const quint32 value = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(pos_));
+        pos_ += 4;
+        return value;
+    }
+
+    inline quint64 readLongLong()
+    {
+        if (!require(8))
+            return 0;
+        const quint64 value = qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(pos_));
+        pos_ += 8;
+        return value;
+    }
+
+    inline float readFloat()
+    {
+        const quint32 bits = readLong();
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    inline double readDouble()
+    {
+        const quint64 bits = readLongLong();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // returns a view of the next size bytes, valid as long as the underlying data
+    inline QByteArray readRawData(qint64 size)
+    {
+        if (!require(size))
+            return QByteArray();
+        const char *data = pos_;
+        pos_ += size;
+        return QByteArray::fromRawData(data, int(size));
+    }
+
+    inline QByteArray readShortStringData() { return readRawData(readOctet()); }
+    inline QByteArray readLongStringData() { return readRawData(readLong()); }
+
+    inline QString readShortString()
+    {
+        const quint8 size = readOctet();
+        if (!require(size))
+            return QString();
+        const char *data = pos_;
+        pos_ += size;
+        return QString::fromUtf8(data, size);
+    }
+
+    inline QString readLongString()
+    {
+        const quint32 size = readLong();
+        if (!require(size))
+            return QString();
+        const char *data = pos_;
+        pos_ += size;
+        return QString::fromUtf8(data, int(size));
+    }
+
+    inline QString readShortString(QAmqpShortStringCache *cache)
+    {
+        if (!cache)
+            return readShortString();
+        return cache->intern(readShortStringData());
+    }
+
+    inline void skip(qint64 size)
+    {
+        if (require(size))
+            pos_ += size;
+    }
+
+    // returns a reader over the next size bytes and skips past them
+    inline QAmqpCodecReader subReader(qint64 size)
+    {
+        if (!require(size))
+            return QAmqpCodecReader(end_, 0);
+        QAmqpCodecReader reader(pos_, int(size));
+        pos_ += size;
+        return reader;
+    }
+
+    QAmqpMetaType::ValueType readValueType();
+    QVariant readField(QAmqpMetaType::ValueType type);
+    QVariant readFieldValue();
+    void skipField(QAmqpMetaType::ValueType type);
+    void skipFieldValue();
+    QAmqpTable readTable();
+    // decodes entries up to the end of the data, without a size prefix
+    void readTableEntries(QAmqpTable *table);
+    QVariantList readArray();
+
+private:
+    inline bool require(qint64 size)
+    {
+        if (Q_LIKELY(size >= 0 && end_ - pos_ >= size))
+            return true;
+        setError();
+        return false;
+    }
+
+    inline void setError()
+    {
+        error_ = true;
+        pos_ = end_;
+    }
+
+    const char *pos_;
+    const char *end_;
+    bool error_;
+};
+
+/*!
+ * QAmqpCodecWriter encodes AMQP wire data by appending it to a QByteArray.
+ */
+class QAmqpCodecWriter
+{
+public:
+    inline explicit QAmqpCodecWriter(QByteArray *buffer) : buffer_(buffer) {}
+
+    inline QByteArray *buffer() const { return buffer_; }
+    inline int size() const { return buffer_->size(); }
+
+    inline void writeOctet(quint8 value) { buffer_->append(char(value)); }
+    inline void writeBoolean(bool value) { writeOctet(value ? 1 : 0); }
+
+    inline void writeShort(quint16 value)
+    {
+        qToBigEndian<quint16>(value, reinterpret_cast<uchar*>(grow(2)));
+    }
+
+    inline void writeLong(quint32 value)
+    {
+        qToBigEndian<quint32>(value, reinterpret_cast<uchar*>(grow(4)));
+    }
+
+    inline void writeLongLong(quint64 value)
+    {
+        qToBigEndian<quint64>(value, reinterpret_cast<uchar*>(grow(8)));
+    }
+
+    inline void writeFloat(float value)
+    {
+        quint32 bits;
+        memcpy(&bits, &value, sizeof(bits));
+        writeLong(bits);
+    }
+
+    inline void writeDouble(double value)
+    {
+        quint64 bits;
+        memcpy(&bits, &value, sizeof(bits));
+        writeLongLong(bits);
+    }
+
+    inline void writeRawData(const char *data, int size)
+    {
+        if (size > 0)
+            memcpy(grow(size), data, size);
+    }
+
+    inline void writeRawData(const QByteArray &data) { writeRawData(data.constData(), data.size()); }
+
+    inline void writeShortString(const QByteArray &data)
+    {
+        int size = data.size();
+        if (Q_UNLIKELY(size > 255)) {
+            qAmqpFrameDebug() << Q_FUNC_INFO << "invalid shortstr length: " << size;
+
+            // truncate without splitting a UTF-8 sequence
+            size = 255;
+            while (size > 0 && (uchar(data.at(size)) & 0xC0) == 0x80)
+                --size;
+        }
+
+        writeOctet(quint8(size));
+        writeRawData(data.constData(), size);
+    }
+
+    inline void writeShortString(const QString &value) { writeShortString(value.toUtf8()); }
+
+    inline void writeLongString(const QByteArray &data)
+    {
+        writeLong(quint32(data.size()));
+        writeRawData(data);
+    }
+
+    inline void writeLongString(const QString &value) { writeLongString(value.toUtf8()); }
+
+    // reserves room for a long value to be filled in later by patchLong
+    inline int reserveLong()
+    {
+        const int offset = buffer_->size();
+        grow(4);
+        return offset;
+    }
+
+    inline void patchLong(int offset, quint32 value)
+    {
+        qToBigEndian<quint32>(value, reinterpret_cast<uchar*>(buffer_->data() + offset));
+    }
+
+    void writeField(QAmqpMetaType::ValueType type, const QVariant &value);
+    void writeFieldValue(const QVariant &value);
+    void writeTable(const QAmqpTable &table);
+    void writeTable(const QAmqpFieldTable &table);
+    void writeTableEntries(const QAmqpTable &table);
+    void writeArray(const QVariantList &array);
+
+private:
+    inline char *grow(int size)
+    {
+        const int oldSize = buffer_->size();
+        buffer_->resize(oldSize + size);
+        return buffer_->data() + oldSize;
+    }
+
+    QByteArray *buffer_;
+};
+
+#endif // QAMQPCODEC_P_H
@@ -0,0 +1,127 @@
+#include "qamqpconfirmtracker_p.h"
+
+QAmqpConfirmTracker::QAmqpConfirmTracker()
+    : head_(0),
+      size_(0),
+      pending_(0),
+      base_(1)
+{
+}
+
+void QAmqpConfirmTracker::reset()
+{
+    head_ = 0;
+    size_ = 0;
+    pending_ = 0;
+    base_ = 1;
+}
+
+qlonglong QAmqpConfirmTracker::nextTag() const
+{
+    return base_ + size_;
+}
+
+qlonglong QAmqpConfirmTracker::settledThrough() const
+{
+    return base_ - 1;
+}
+
+int QAmqpConfirmTracker::pendingCount() const
+{
+    return pending_;
+}
+
+bool QAmqpConfirmTracker::isEmpty() const
+{
+    return pending_ == 0;
+}
+
+qint64 &QAmqpConfirmTracker::at(int offset)
+{
+    // the capacity is always a power of two
+    return ring_[(head_ + offset) & (ring_.size() - 1)];
+}
+
+void QAmqpConfirmTracker::grow(int capacity)
+{
+    int newCapacity = qMax(ring_.size(), 64);
+    while (newCapacity < capacity)
+        newCapacity *= 2;
+    if (newCapacity == ring_.size())
+        return;
+
+    QVector<qint64> ring(newCapacity);
+    for (int i = 0; i < size_; ++i)
+        ring[i] = at(i);
+    ring_ = ring;
+    head_ = 0;
+}
+
+void QAmqpConfirmTracker::advance()
+{
+    while (size_ > 0 && at(0) < 0) {
+        head_ = (head_ + 1) & (ring_.size() - 1);
+        ++base_;
+        --size_;
+    }
+}
+
+qlonglong QAmqpConfirmTracker::track(int count, qint64 time)
+{
+    if (size_ + count > ring_.size())
+        grow(size_ + count);
+
+    for (int i = 0; i < count; ++i)
+        at(size_ + i) = time;
+
+    const qlonglong first = nextTag();
+    size_ += count;
+    pending_ += count;
+    return first;
+}
+
+void QAmqpConfirmTracker::settle(qlonglong tag, bool multiple, QVector<qlonglong> *settled)
+{
+    if (tag == 0 && multiple)
+        tag = nextTag() - 1;
+    if (tag < base_ || tag >= nextTag())
+        return;
+
+    const int offset = int(tag - base_);
+    for (int i = multiple ? 0 : offset; i <= offset; ++i) {
+        qint64 &time = at(i);
+        if (time < 0)
+            continue;
+
+        time = -1;
+        --pending_;
+        settled->append(base_ + i);
+    }
+
+    advance();
+}
+
+void QAmqpConfirmTracker::expire(qint64 time, QVector<qlonglong> *expired)
+{
+    for (int i = 0; i < size_; ++i) {
+        qint64 &published = at(i);
+        if (published < 0)
+            continue;
+        if (published > time)
+            break;
+
+        published = -1;
+        --pending_;
+        expired->append(base_ + i);
+    }
+
+    advance();
+}
+
+qint64 QAmqpConfirmTracker::oldestTime() const
+{
+    // advance() keeps the front unsettled
+    if (size_ == 0)
+        return -1;
+    return ring_.at(head_);
+}
@@ -0,0 +1,56 @@
+#ifndef QAMQPCONFIRMTRACKER_P_H
+#define QAMQPCONFIRMTRACKER_P_H
+
+#include <QVector>
+
+/*!
+ * QAmqpConfirmTracker keeps the delivery tags of messages published in
+ * confirm mode. Tags are handed out in sequence and kept in a ring indexed
+ * by their distance from the oldest unsettled tag, so settling a single tag
+ * is O(1) and settling a multiple range is O(1) amortized per message.
+ *
+ * Each tag remembers when it was published, which lets expire() settle
+ * everything older than a deadline by looking at the front of the ring only.
+ */
+class QAmqpConfirmTracker
+{
+public:
+    QAmqpConfirmTracker();
+
+    // forgets every tag, the next one handed out is 1 again
+    void reset();
+
+    qlonglong nextTag() const;
+
+    // every tag up to and including this one is settled
+    qlonglong settledThrough() const;
+    int pendingCount() const;
+    bool isEmpty() const;
+
+    // starts tracking count messages published at time, returns the first tag
+    qlonglong track(int count, qint64 time);
+
+    // settles tag, or every tag up to and including it when multiple is set,
+    // a tag of 0 with multiple settles everything. The settled tags are
+    // appended to settled in ascending order.
+    void settle(qlonglong tag, bool multiple, QVector<qlonglong> *settled);
+
+    // settles every tag published at or before time
+    void expire(qint64 time, QVector<qlonglong> *expired);
+
+    // publish time of the oldest unsettled tag, -1 if there is none
+    qint64 oldestTime() const;
+
+private:
+    qint64 &at(int offset);
+    void grow(int capacity);
+    void advance();
+
+    QVector<qint64> ring_;  // publish time per tag, -1 once settled
+    int head_;              // ring index of base_
+    int size_;              // tags from base_ up to nextTag()
+    int pending_;
+    qlonglong base_;
+};
+
+#endif // QAMQPCONFIRMTRACKER_P_H
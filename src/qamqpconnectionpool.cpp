@@ -0,0 +1,310 @@
+#include <QThread>
+#include <QDebug>
+
+#include "qamqpclient.h"
+#include "qamqpexchange.h"
+#include "qamqpqueue.h"
+#include "qamqpiothread_p.h"
+#include "qamqplogging_p.h"
+#include "qamqpconnectionpool_p.h"
+#include "qamqpconnectionpool.h"
+
+QAmqpPoolMember::QAmqpPoolMember()
+    : client(new QAmqpClient(this)),
+      channelCount(0)
+{
+}
+
+QAmqpExchange *QAmqpPoolMember::createExchange(const QString &name)
+{
+    QAmqpExchange *exchange = client->createExchange(name);
+    track(exchange);
+    return exchange;
+}
+
+QAmqpQueue *QAmqpPoolMember::createQueue(const QString &name)
+{
+    QAmqpQueue *queue = client->createQueue(name);
+    track(queue);
+    return queue;
+}
+
+void QAmqpPoolMember::track(QAmqpChannel *channel)
+{
+    // the client hands out existing channels for known names
+    if (channels.contains(channel))
+        return;
+
+    channels.insert(channel);
+    channelCount.ref();
+    connect(channel, SIGNAL(destroyed(QObject*)), this, SLOT(channelDestroyed(QObject*)));
+}
+
+void QAmqpPoolMember::channelDestroyed(QObject *channel)
+{
+    if (channels.remove(channel))
+        channelCount.deref();
+}
+
+void QAmqpPoolMember::connectToHost(const QString &uri, bool autoReconnect, int reconnectTimeout)
+{
+    client->setAutoReconnect(autoReconnect, reconnectTimeout);
+    client->connectToHost(uri);
+}
+
+void QAmqpPoolMember::disconnectFromHost()
+{
+    client->setAutoReconnect(false);
+    if (client->isConnected())
+        client->disconnectFromHost();
+}
+
+void QAmqpPoolMember::shutdown()
+{
+    // channels and the socket have to go away on the thread they live in
+    delete client;
+    client = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+QAmqpConnectionPoolPrivate::QAmqpConnectionPoolPrivate(QAmqpConnectionPool *q)
+    : placementPolicy(QAmqpConnectionPool::LeastLoaded),
+      autoReconnect(false),
+      reconnectTimeout(0),
+      connectedCount(0),
+      q_ptr(q)
+{
+}
+
+int QAmqpConnectionPoolPrivate::leastLoadedMember() const
+{
+    int index = 0;
+    int load = qAmqpLoadAcquire(members.at(0)->channelCount);
+    for (int i = 1; i < members.size(); ++i) {
+        const int memberLoad = qAmqpLoadAcquire(members.at(i)->channelCount);
+        if (memberLoad < load) {
+            index = i;
+            load = memberLoad;
+        }
+    }
+
+    return index;
+}
+
+int QAmqpConnectionPoolPrivate::placeChannel(const QString &name, QHash<QString, int> *placements)
+{
+    if (name.isEmpty())
+        return leastLoadedMember();
+
+    if (placementPolicy == QAmqpConnectionPool::HashOfName)
+        return int(qHash(name) % uint(members.size()));
+
+    QMutexLocker locker(&placementMutex);
+    QHash<QString, int>::ConstIterator it = placements->constFind(name);
+    if (it != placements->constEnd())
+        return it.value();
+
+    const int index = leastLoadedMember();
+    placements->insert(name, index);
+    return index;
+}
+
+void QAmqpConnectionPoolPrivate::_q_memberConnected()
+{
+    Q_Q(QAmqpConnectionPool);
+    if (++connectedCount == members.size())
+        Q_EMIT q->connected();
+}
+
+void QAmqpConnectionPoolPrivate::_q_memberDisconnected()
+{
+    Q_Q(QAmqpConnectionPool);
+    if (connectedCount > 0 && --connectedCount == 0)
+        Q_EMIT q->disconnected();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*!
+ * Creates a pool of size clients, each running on a thread of its own with
+ * its own broker connection. Channels created through the pool are spread
+ * over the clients according to the placement policy.
+ *
+ * Clients, and the exchanges and queues created on them, live on their
+ * member's thread. Use queued signal and slot connections or
+ * QAmqpPublisher to talk to them from other threads.
+ */
+QAmqpConnectionPool::QAmqpConnectionPool(int size, QObject *parent)
+    : QObject(parent),
+      d_ptr(new QAmqpConnectionPoolPrivate(this))
+{
+    Q_D(QAmqpConnectionPool);
+    qRegisterMetaType<QAMQP::Error>("QAMQP::Error");
+    if (size < 1) {
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "invalid pool size: " << size;
+        size = 1;
+    }
+
+    d->threads.reserve(size);
+    d->members.reserve(size);
+    for (int i = 0; i < size; ++i) {
+        QAmqpPoolMember *member = new QAmqpPoolMember;
+        connect(member->client, SIGNAL(connected()), this, SLOT(_q_memberConnected()));
+        connect(member->client, SIGNAL(disconnected()), this, SLOT(_q_memberDisconnected()));
+        connect(member->client, SIGNAL(error(QAMQP::Error)), this, SIGNAL(error(QAMQP::Error)));
+
+        QThread *thread = new QThread(this);
+        thread->setObjectName(QString::fromLatin1("QAmqpConnectionPool #%1").arg(i));
+        member->moveToThread(thread);
+        thread->start();
+
+        d->threads.append(thread);
+        d->members.append(member);
+    }
+}
+
+QAmqpConnectionPool::~QAmqpConnectionPool()
+{
+    Q_D(QAmqpConnectionPool);
+    for (int i = 0; i < d->members.size(); ++i) {
+        QMetaObject::invokeMethod(d->members.at(i), "shutdown", Qt::BlockingQueuedConnection);
+        d->threads.at(i)->quit();
+        d->threads.at(i)->wait();
+        delete d->members.at(i);
+    }
+}
+
+QAmqpConnectionPool::PlacementPolicy QAmqpConnectionPool::placementPolicy() const
+{
+    Q_D(const QAmqpConnectionPool);
+    return d->placementPolicy;
+}
+
+void QAmqpConnectionPool::setPlacementPolicy(PlacementPolicy policy)
+{
+    Q_D(QAmqpConnectionPool);
+    d->placementPolicy = policy;
+}
+
+int QAmqpConnectionPool::size() const
+{
+    Q_D(const QAmqpConnectionPool);
+    return d->members.size();
+}
+
+/*!
+ * Returns the client of member index. The client lives on the member's
+ * thread.
+ */
+QAmqpClient *QAmqpConnectionPool::client(int index) const
+{
+    Q_D(const QAmqpConnectionPool);
+    if (index < 0 || index >= d->members.size())
+        return 0;
+    return d->members.at(index)->client;
+}
+
+/*!
+ * Returns the number of channels the pool has placed on member index that
+ * still exist.
+ */
+int QAmqpConnectionPool::channelCount(int index) const
+{
+    Q_D(const QAmqpConnectionPool);
+    if (index < 0 || index >= d->members.size())
+        return 0;
+    return qAmqpLoadAcquire(d->members.at(index)->channelCount);
+}
+
+bool QAmqpConnectionPool::autoReconnect() const
+{
+    Q_D(const QAmqpConnectionPool);
+    return d->autoReconnect;
+}
+
+/*!
+ * Sets whether members reconnect on their own when their connection drops.
+ * Each member reopens its own channels after reconnecting, the other
+ * members are not affected. Takes effect with the next connectToHost().
+ */
+void QAmqpConnectionPool::setAutoReconnect(bool value, int timeout)
+{
+    Q_D(QAmqpConnectionPool);
+    d->autoReconnect = value;
+    d->reconnectTimeout = timeout;
+}
+
+bool QAmqpConnectionPool::isConnected() const
+{
+    Q_D(const QAmqpConnectionPool);
+    return d->connectedCount == d->members.size();
+}
+
+QAmqpExchange *QAmqpConnectionPool::createExchange()
+{
+    return createExchange(QString());
+}
+
+/*!
+ * Creates an exchange on the member chosen by the placement policy, or
+ * returns the existing one when name was created through the pool before.
+ * Unnamed exchanges always go to the least loaded member.
+ */
+QAmqpExchange *QAmqpConnectionPool::createExchange(const QString &name)
+{
+    Q_D(QAmqpConnectionPool);
+    const int index = d->placeChannel(name, &d->exchangePlacements);
+    QAmqpExchange *exchange = 0;
+    QMetaObject::invokeMethod(d->members.at(index), "createExchange", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QAmqpExchange*, exchange), Q_ARG(QString, name));
+    return exchange;
+}
+
+QAmqpQueue *QAmqpConnectionPool::createQueue()
+{
+    return createQueue(QString());
+}
+
+/*!
+ * Creates a queue on the member chosen by the placement policy, or returns
+ * the existing one when name was created through the pool before. Unnamed
+ * queues always go to the least loaded member.
+ */
+QAmqpQueue *QAmqpConnectionPool::createQueue(const QString &name)
+{
+    Q_D(QAmqpConnectionPool);
+    const int index = d->placeChannel(name, &d->queuePlacements);
+    QAmqpQueue *queue = 0;
+    QMetaObject::invokeMethod(d->members.at(index), "createQueue", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QAmqpQueue*, queue), Q_ARG(QString, name));
+    return queue;
+}
+
+/*!
+ * Connects every member to the broker given by uri, see
+ * QAmqpClient::connectToHost(). connected() is emitted once all members
+ * are connected.
+ */
+void QAmqpConnectionPool::connectToHost(const QString &uri)
+{
+    Q_D(QAmqpConnectionPool);
+    foreach (QAmqpPoolMember *member, d->members) {
+        QMetaObject::invokeMethod(member, "connectToHost", Qt::QueuedConnection,
+                                  Q_ARG(QString, uri), Q_ARG(bool, d->autoReconnect),
+                                  Q_ARG(int, d->reconnectTimeout));
+    }
+}
+
+/*!
+ * Disconnects every member. disconnected() is emitted once all members are
+ * disconnected.
+ */
+void QAmqpConnectionPool::disconnectFromHost()
+{
+    Q_D(QAmqpConnectionPool);
+    foreach (QAmqpPoolMember *member, d->members)
+        QMetaObject::invokeMethod(member, "disconnectFromHost", Qt::QueuedConnection);
+}
+
+#include "moc_qamqpconnectionpool.cpp"
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2012-2014 Alexey Shcherbakov
+ * Copyright (C) 2014-2015 Matt Broadstone
+ * Contact: https://github.com/mbroadst/qamqp
+ *
+ * This file is part of the QAMQP Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QAMQPCONNECTIONPOOL_H
+#define QAMQPCONNECTIONPOOL_H
+
+#include <QObject>
+
+#include "qamqpglobal.h"
+
+class QAmqpClient;
+class QAmqpExchange;
+class QAmqpQueue;
+class QAmqpConnectionPoolPrivate;
+class QAMQP_EXPORT QAmqpConnectionPool : public QObject
+{
+    Q_OBJECT
+    Q_ENUMS(PlacementPolicy)
+
+public:
+    explicit QAmqpConnectionPool(int size, QObject *parent = 0);
+    ~QAmqpConnectionPool();
+
+    enum PlacementPolicy {
+        LeastLoaded,
+        HashOfName
+    };
+    PlacementPolicy placementPolicy() const;
+    void setPlacementPolicy(PlacementPolicy policy);
+
+    int size() const;
+    QAmqpClient *client(int index) const;
+    int channelCount(int index) const;
+
+    bool autoReconnect() const;
+    void setAutoReconnect(bool value, int timeout = 0);
+
+    bool isConnected() const;
+
+    // channels
+    QAmqpExchange *createExchange();
+    QAmqpExchange *createExchange(const QString &name);
+
+    QAmqpQueue *createQueue();
+    QAmqpQueue *createQueue(const QString &name);
+
+    // methods
+    void connectToHost(const QString &uri = QString());
+    void disconnectFromHost();
+
+Q_SIGNALS:
+    void connected();
+    void disconnected();
+    void error(QAMQP::Error error);
+
+private:
+    Q_DISABLE_COPY(QAmqpConnectionPool)
+    Q_DECLARE_PRIVATE(QAmqpConnectionPool)
+    QScopedPointer<QAmqpConnectionPoolPrivate> d_ptr;
+
+    Q_PRIVATE_SLOT(d_func(), void _q_memberConnected())
+    Q_PRIVATE_SLOT(d_func(), void _q_memberDisconnected())
+};
+
+#endif // QAMQPCONNECTIONPOOL_H
@@ -0,0 +1,73 @@
+#ifndef QAMQPCONNECTIONPOOL_P_H
+#define QAMQPCONNECTIONPOOL_P_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QVector>
+
+#include "qamqpconnectionpool.h"
+
+class QThread;
+class QAmqpChannel;
+
+/*!
+ * QAmqpPoolMember owns one client of a connection pool and lives on that
+ * client's thread together with the client and all of its channels. The
+ * pool only calls into it with queued or blocking queued invocations.
+ */
+class QAmqpPoolMember : public QObject
+{
+    Q_OBJECT
+public:
+    QAmqpPoolMember();
+
+    QAmqpClient *client;
+    QAtomicInt channelCount;
+
+public Q_SLOTS:
+    QAmqpExchange *createExchange(const QString &name);
+    QAmqpQueue *createQueue(const QString &name);
+    void connectToHost(const QString &uri, bool autoReconnect, int reconnectTimeout);
+    void disconnectFromHost();
+    void shutdown();
+
+private Q_SLOTS:
+    void channelDestroyed(QObject *channel);
+
+private:
+    void track(QAmqpChannel *channel);
+    QSet<QObject*> channels;
+};
+
+class QAmqpConnectionPoolPrivate
+{
+public:
+    QAmqpConnectionPoolPrivate(QAmqpConnectionPool *q);
+
+    int placeChannel(const QString &name, QHash<QString, int> *placements);
+    int leastLoadedMember() const;
+
+    void _q_memberConnected();
+    void _q_memberDisconnected();
+
+    QVector<QThread*> threads;
+    QVector<QAmqpPoolMember*> members;
+    QAmqpConnectionPool::PlacementPolicy placementPolicy;
+    bool autoReconnect;
+    int reconnectTimeout;
+    int connectedCount;
+
+    // where named channels went under the least loaded policy, so asking
+    // for the same name again returns the same channel
+    QMutex placementMutex;
+    QHash<QString, int> exchangePlacements;
+    QHash<QString, int> queuePlacements;
+
+    Q_DECLARE_PUBLIC(QAmqpConnectionPool)
+    QAmqpConnectionPool * const q_ptr;
+};
+
+#endif // QAMQPCONNECTIONPOOL_P_H
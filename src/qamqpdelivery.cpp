@@ -0,0 +1,184 @@
+#include <QThreadPool>
+#include <QDebug>
+
+#include "qamqpdelivery.h"
+#include "qamqpdelivery_p.h"
+#include "qamqplogging_p.h"
+
+QAmqpSettlementQueue::QAmqpSettlementQueue(QAmqpQueue *queue)
+    : notified(0),
+      generation(0),
+      owner(queue)
+{
+}
+
+void QAmqpSettlementQueue::post(const Settlement &settlement)
+{
+    queue.enqueue(settlement);
+    if (!notified.testAndSetOrdered(0, 1))
+        return;
+
+    QMutexLocker locker(&mutex);
+    if (owner)
+        QMetaObject::invokeMethod(owner, "_q_flushSettlements", Qt::QueuedConnection);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+QAmqpDeliveryPrivate::QAmqpDeliveryPrivate()
+    : generation(0),
+      settled(0)
+{
+}
+
+bool QAmqpDeliveryPrivate::settle(QAmqpSettlementQueue::Action action)
+{
+    if (!settlements || !settled.testAndSetOrdered(0, 1))
+        return false;
+
+    settlements->post(QAmqpSettlementQueue::Settlement(message.deliveryTag(), action, generation));
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+QAmqpDeliveryDispatcher::QAmqpDeliveryDispatcher(QAmqpDeliveryHandler *handler, QThreadPool *pool,
+                                                 QAmqpExecutor *executor,
+                                                 QAmqpQueue::DispatchOrder order)
+    : handler(handler),
+      pool(pool),
+      executor(executor),
+      order(order)
+{
+}
+
+void QAmqpDeliveryDispatcher::dispatch(const QSharedPointer<QAmqpDeliveryDispatcher> &self,
+                                       const QAmqpDelivery &delivery)
+{
+    if (order == QAmqpQueue::OrderedByRoutingKey) {
+        QMutexLocker locker(&mutex);
+        const QString routingKey = delivery.message().routingKey();
+        QHash<QString, QQueue<QAmqpDelivery> >::iterator it = strands.find(routingKey);
+        if (it != strands.end()) {
+            it.value().enqueue(delivery);
+            return;
+        }
+
+        strands.insert(routingKey, QQueue<QAmqpDelivery>());
+    }
+
+    QAmqpDeliveryTask *task = new QAmqpDeliveryTask(self, delivery);
+    if (executor)
+        executor->execute(task);
+    else
+        pool->start(task);
+}
+
+void QAmqpDeliveryDispatcher::run(const QAmqpDelivery &delivery)
+{
+    handler->handleDelivery(delivery);
+    if (order != QAmqpQueue::OrderedByRoutingKey)
+        return;
+
+    // keep draining this routing key's strand until it runs dry
+    const QString routingKey = delivery.message().routingKey();
+    forever {
+        QAmqpDelivery next;
+        {
+            QMutexLocker locker(&mutex);
+            QHash<QString, QQueue<QAmqpDelivery> >::iterator it = strands.find(routingKey);
+            if (it.value().isEmpty()) {
+                strands.erase(it);
+                return;
+            }
+            next = it.value().dequeue();
+        }
+
+        handler->handleDelivery(next);
+    }
+}
+
+QAmqpDeliveryTask::QAmqpDeliveryTask(const QSharedPointer<QAmqpDeliveryDispatcher> &dispatcher,
+                                     const QAmqpDelivery &delivery)
+    : dispatcher(dispatcher),
+      delivery(delivery)
+{
+}
+
+void QAmqpDeliveryTask::run()
+{
+    dispatcher->run(delivery);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+QAmqpDelivery::QAmqpDelivery()
+{
+}
+
+QAmqpDelivery::QAmqpDelivery(QAmqpDeliveryPrivate *dd)
+    : d(dd)
+{
+}
+
+QAmqpDelivery::QAmqpDelivery(const QAmqpDelivery &other)
+    : d(other.d)
+{
+}
+
+QAmqpDelivery &QAmqpDelivery::operator=(const QAmqpDelivery &other)
+{
+    d = other.d;
+    return *this;
+}
+
+QAmqpDelivery::~QAmqpDelivery()
+{
+}
+
+bool QAmqpDelivery::isValid() const
+{
+    return d.data() != 0;
+}
+
+QAmqpMessage QAmqpDelivery::message() const
+{
+    if (!d)
+        return QAmqpMessage();
+    return d->message;
+}
+
+/*!
+ * Returns true once the delivery has been acknowledged or rejected, through
+ * any copy of this handle.
+ */
+bool QAmqpDelivery::isSettled() const
+{
+    if (!d)
+        return false;
+    return qAmqpLoadAcquire(d->settled) != 0;
+}
+
+/*!
+ * Acknowledges the delivery. May be called from any thread, the ack is sent
+ * from the queue's thread together with others settled around the same
+ * time. Returns false if the delivery was already settled. Must not be
+ * used for messages consumed with QAmqpQueue::coNoAck.
+ */
+bool QAmqpDelivery::ack() const
+{
+    if (!d)
+        return false;
+    return d->settle(QAmqpSettlementQueue::Ack);
+}
+
+/*!
+ * Rejects the delivery, requeueing it on the broker if requeue is set. May
+ * be called from any thread, see ack().
+ */
+bool QAmqpDelivery::reject(bool requeue) const
+{
+    if (!d)
+        return false;
+    return d->settle(requeue ? QAmqpSettlementQueue::Requeue : QAmqpSettlementQueue::Reject);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2012-2014 Alexey Shcherbakov
+ * Copyright (C) 2014-2015 Matt Broadstone
+ * Contact: https://github.com/mbroadst/qamqp
+ *
+ * This file is part of the QAMQP Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QAMQPDELIVERY_H
+#define QAMQPDELIVERY_H
+
+#include <QExplicitlySharedDataPointer>
+#include <QVector>
+
+#include "qamqpglobal.h"
+#include "qamqpmessage.h"
+
+class QRunnable;
+
+class QAmqpDeliveryPrivate;
+class QAMQP_EXPORT QAmqpDelivery
+{
+public:
+    QAmqpDelivery();
+    QAmqpDelivery(const QAmqpDelivery &other);
+    QAmqpDelivery &operator=(const QAmqpDelivery &other);
+    ~QAmqpDelivery();
+
+#if QT_VERSION >= 0x050000
+    inline void swap(QAmqpDelivery &other) { qSwap(d, other.d); }
+#endif
+
+    bool isValid() const;
+    QAmqpMessage message() const;
+
+    bool isSettled() const;
+    bool ack() const;
+    bool reject(bool requeue = true) const;
+
+private:
+    explicit QAmqpDelivery(QAmqpDeliveryPrivate *dd);
+    QExplicitlySharedDataPointer<QAmqpDeliveryPrivate> d;
+    friend class QAmqpQueuePrivate;
+
+#if QT_VERSION < 0x050000
+public:
+    typedef QExplicitlySharedDataPointer<QAmqpDeliveryPrivate> DataPtr;
+    inline DataPtr &data_ptr() { return d; }
+#endif
+};
+
+Q_DECLARE_SHARED(QAmqpDelivery)
+
+/*!
+ * QAmqpDeliveryHandler processes messages dispatched by a queue, see
+ * QAmqpQueue::setDeliveryHandler(). handleDelivery() is called on worker
+ * threads, possibly concurrently.
+ */
+class QAMQP_EXPORT QAmqpDeliveryHandler
+{
+public:
+    virtual ~QAmqpDeliveryHandler() {}
+    virtual void handleDelivery(const QAmqpDelivery &delivery) = 0;
+};
+
+/*!
+ * QAmqpMessageBatchHandler receives the messages a queue completed while
+ * handling one socket read, see QAmqpQueue::setBatchHandler(). It is called
+ * directly on the queue's thread, without going through signals.
+ */
+class QAMQP_EXPORT QAmqpMessageBatchHandler
+{
+public:
+    virtual ~QAmqpMessageBatchHandler() {}
+    virtual void handleMessages(const QVector<QAmqpMessage> &messages) = 0;
+};
+
+template <typename Functor>
+class QAmqpFunctorBatchHandler : public QAmqpMessageBatchHandler
+{
+public:
+    explicit QAmqpFunctorBatchHandler(Functor functor) : functor(functor) {}
+    virtual void handleMessages(const QVector<QAmqpMessage> &messages) { functor(messages); }
+
+private:
+    Functor functor;
+};
+
+/*!
+ * QAmqpExecutor runs dispatched deliveries when a QThreadPool does not
+ * fit. execute() is called on the queue's thread and must eventually run
+ * the runnable on some thread, deleting it afterwards if autoDelete() is
+ * set.
+ */
+class QAMQP_EXPORT QAmqpExecutor
+{
+public:
+    virtual ~QAmqpExecutor() {}
+    virtual void execute(QRunnable *runnable) = 0;
+};
+
+#endif // QAMQPDELIVERY_H
@@ -0,0 +1,109 @@
+#ifndef QAMQPDELIVERY_P_H
+#define QAMQPDELIVERY_P_H
+
+#include <QHash>
+#include <QMutex>
+#include <QQueue>
+#include <QRunnable>
+#include <QSharedData>
+#include <QSharedPointer>
+
+#include "qamqpdelivery.h"
+#include "qamqpiothread_p.h"
+#include "qamqpqueue.h"
+
+class QThreadPool;
+
+/*!
+ * QAmqpSettlementQueue carries acks and rejects from worker threads to the
+ * queue's thread, where they are written out in one batch per drain. The
+ * generation changes whenever the channel goes away, settlements for
+ * deliveries of an earlier generation are dropped since their delivery
+ * tags are no longer valid.
+ */
+class QAmqpSettlementQueue
+{
+public:
+    enum Action {
+        Ack,
+        Reject,
+        Requeue
+    };
+
+    struct Settlement
+    {
+        Settlement() : deliveryTag(0), action(Ack), generation(0) {}
+        Settlement(qlonglong deliveryTag, Action action, int generation)
+            : deliveryTag(deliveryTag), action(action), generation(generation) {}
+
+        qlonglong deliveryTag;
+        Action action;
+        int generation;
+    };
+
+    explicit QAmqpSettlementQueue(QAmqpQueue *queue);
+
+    // any thread
+    void post(const Settlement &settlement);
+
+    QAmqpMpscQueue<Settlement> queue;
+    QAtomicInt notified;
+    QAtomicInt generation;
+    QMutex mutex;
+    QAmqpQueue *owner;              // reset when the queue is destroyed
+};
+
+class QAmqpDeliveryPrivate : public QSharedData
+{
+public:
+    QAmqpDeliveryPrivate();
+
+    bool settle(QAmqpSettlementQueue::Action action);
+
+    QAmqpMessage message;
+    QSharedPointer<QAmqpSettlementQueue> settlements;
+    int generation;
+    QAtomicInt settled;
+};
+
+/*!
+ * QAmqpDeliveryDispatcher hands completed messages to the executor. In
+ * ordered mode deliveries sharing a routing key are handled one at a time
+ * in arrival order: the first one starts a task, the following ones are
+ * queued and picked up by that task when it is done.
+ */
+class QAmqpDeliveryDispatcher
+{
+public:
+    QAmqpDeliveryDispatcher(QAmqpDeliveryHandler *handler, QThreadPool *pool,
+                            QAmqpExecutor *executor, QAmqpQueue::DispatchOrder order);
+
+    // queue thread
+    void dispatch(const QSharedPointer<QAmqpDeliveryDispatcher> &self, const QAmqpDelivery &delivery);
+
+    // worker thread
+    void run(const QAmqpDelivery &delivery);
+
+    QAmqpDeliveryHandler *handler;
+    QThreadPool *pool;
+    QAmqpExecutor *executor;
+    QAmqpQueue::DispatchOrder order;
+
+    // routing keys with a running task and what is waiting behind it
+    QMutex mutex;
+    QHash<QString, QQueue<QAmqpDelivery> > strands;
+};
+
+class QAmqpDeliveryTask : public QRunnable
+{
+public:
+    QAmqpDeliveryTask(const QSharedPointer<QAmqpDeliveryDispatcher> &dispatcher,
+                      const QAmqpDelivery &delivery);
+    virtual void run();
+
+private:
+    QSharedPointer<QAmqpDeliveryDispatcher> dispatcher;
+    QAmqpDelivery delivery;
+};
+
+#endif // QAMQPDELIVERY_P_H
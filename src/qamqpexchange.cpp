@@ -1,5 +1,5 @@
 #include <QEventLoop>
-#include <QDataStream>
+#include <QFutureWatcher>
 #include <QTimer>
 #include <QDebug>
 
@@ -8,6 +8,9 @@
 #include "qamqpqueue.h"
 #include "qamqpglobal.h"
 #include "qamqpclient.h"
+#include "qamqpcodec_p.h"
+#include "qamqplogging_p.h"
+#include "qamqppublishtemplate_p.h"
 
 QString QAmqpExchangePrivate::typeToString(QAmqpExchange::ExchangeType type)
 {
@@ -25,7 +28,9 @@ QAmqpExchangePrivate::QAmqpExchangePrivate(QAmqpExchange *q)
     : QAmqpChannelPrivate(q),
       delayedDeclare(false),
       declared(false),
-      nextDeliveryTag(0)
+      confirmMode(false),
+      confirmTimeout(0),
+      confirmWatermark(0)
 {
 }
 
@@ -34,7 +39,129 @@ void QAmqpExchangePrivate::resetInternalState()
     QAmqpChannelPrivate::resetInternalState();
     delayedDeclare = false;
     declared = false;
-    nextDeliveryTag = 0;
+    abandonConfirms();
+    confirmMode = false;
+}
+
+int QAmqpExchangePrivate::maxBodyFrameSize() const
+{
+    // frame-max covers the frame header and frame-end octet as well
+    const qint32 frameMax = client ? client->frameMax() : 0;
+    const qint32 overhead = QAmqpFrame::HEADER_SIZE + QAmqpFrame::FRAME_END_SIZE;
+    if (frameMax <= overhead)
+        return AMQP_FRAME_MAX - overhead;
+    return frameMax - overhead;
+}
+
+/*!
+ * Fills in the content header properties of a published message, properties
+ * override the content type, encoding and headers defaults.
+ */
+void QAmqpExchangePrivate::setContentProperties(QAmqpContentFrame &content, const QString &mimeType,
+                                                const QAmqpTable &headers,
+                                                const QAmqpMessage::PropertyHash &properties)
+{
+    content.setProperty(QAmqpMessage::ContentType, mimeType);
+    content.setProperty(QAmqpMessage::ContentEncoding, QLatin1String("utf-8"));
+    content.setProperty(QAmqpMessage::Headers, headers);
+
+    QAmqpMessage::PropertyHash::ConstIterator it;
+    QAmqpMessage::PropertyHash::ConstIterator itEnd = properties.constEnd();
+    for (it = properties.constBegin(); it != itEnd; ++it)
+        content.setProperty(it.key(), it.value());
+}
+
+/*!
+ * Returns the exact number of bytes encodePublish() will write for a message
+ * of messageSize bytes.
+ */
+qint64 QAmqpExchangePrivate::publishSize(const QByteArray &exchangeName, const QByteArray &routingKey,
+                                         const QAmqpContentFrame &header, int messageSize) const
+{
+    const qint64 overhead = QAmqpFrame::HEADER_SIZE + QAmqpFrame::FRAME_END_SIZE;
+    const int maxBodySize = maxBodyFrameSize();
+    const qint64 bodyFrames = (messageSize + maxBodySize - 1) / maxBodySize;
+
+    // basic.publish: class, method, reserved-1, exchange, routing-key, flags
+    const qint64 methodSize = 2 + 2 + 2 + 1 + exchangeName.size() + 1 + routingKey.size() + 1;
+    return overhead + methodSize
+         + overhead + header.size()
+         + bodyFrames * overhead + messageSize;
+}
+
+/*!
+ * Encodes basic.publish, the content header and all body frames for a message
+ * back to back. Body frames reference the message data directly, no
+ * intermediate copies are made.
+ */
+void QAmqpExchangePrivate::encodePublish(QAmqpCodecWriter &writer, const QByteArray &exchangeName,
+                                         const QByteArray &routingKey, int publishOptions,
+                                         const QAmqpContentFrame &header, const QByteArray &message) const
+{
+    const qint32 methodSize = 2 + 2 + 2 + 1 + exchangeName.size() + 1 + routingKey.size() + 1;
+    QAmqpFrame::writeFrameHeader(writer, QAmqpFrame::Method, channelNumber, methodSize);
+    writer.writeShort(QAmqpFrame::Basic);
+    writer.writeShort(bmPublish);
+    writer.writeShort(0);   //reserved 1
+    writer.writeShortString(exchangeName);
+    writer.writeShortString(routingKey);
+    writer.writeOctet(quint8(publishOptions));
+    QAmqpFrame::writeFrameEnd(writer);
+
+    header.encode(writer);
+    encodeBodyFrames(writer, message);
+}
+
+/*!
+ * Encodes a publish from a template, only the exchange name, the body size
+ * and the per message properties are encoded, the rest is copied as is.
+ */
+void QAmqpExchangePrivate::encodeTemplatePublish(QAmqpCodecWriter &writer,
+                                                 const QAmqpPublishTemplatePrivate *publishTemplate,
+                                                 const QByteArray &message,
+                                                 const QAmqpMessage::PropertyHash &properties) const
+{
+    const QByteArray &exchangeName = encodedName();
+    const qint32 methodSize = 2 + 2 + 2 + 1 + exchangeName.size() + publishTemplate->methodArguments.size();
+    QAmqpFrame::writeFrameHeader(writer, QAmqpFrame::Method, channelNumber, methodSize);
+    writer.writeShort(QAmqpFrame::Basic);
+    writer.writeShort(bmPublish);
+    writer.writeShort(0);   //reserved 1
+    writer.writeShortString(exchangeName);
+    writer.writeRawData(publishTemplate->methodArguments);
+    QAmqpFrame::writeFrameEnd(writer);
+
+    // per message properties change the header size, patch it in afterwards
+    writer.writeOctet(quint8(QAmqpFrame::Header));
+    writer.writeShort(channelNumber);
+    const int sizeOffset = writer.reserveLong();
+    QAmqpContentFrame::writeMergedHeader(writer, publishTemplate->header, message.size(), properties);
+    writer.patchLong(sizeOffset, quint32(writer.size() - sizeOffset - 4));
+    QAmqpFrame::writeFrameEnd(writer);
+
+    encodeBodyFrames(writer, message);
+}
+
+void QAmqpExchangePrivate::encodeBodyFrames(QAmqpCodecWriter &writer, const QByteArray &message) const
+{
+    const int maxBodySize = maxBodyFrameSize();
+    const int fullSize = message.size();
+    for (int sent = 0; sent < fullSize; sent += maxBodySize) {
+        const int chunkSize = qMin(maxBodySize, fullSize - sent);
+        QAmqpFrame::writeFrameHeader(writer, QAmqpFrame::Body, channelNumber, chunkSize);
+        writer.writeRawData(message.constData() + sent, chunkSize);
+        QAmqpFrame::writeFrameEnd(writer);
+    }
+}
+
+const QByteArray &QAmqpExchangePrivate::encodedName() const
+{
+    if (encodedNameData.isNull() || encodedNameSource != name) {
+        encodedNameSource = name;
+        encodedNameData = name.toUtf8();
+    }
+
+    return encodedNameData;
 }
 
 void QAmqpExchangePrivate::declare()
@@ -45,7 +172,7 @@ void QAmqpExchangePrivate::declare()
     }
 
     if (name.isEmpty()) {
-        qAmqpDebug() << Q_FUNC_INFO << "attempting to declare an unnamed exchange, aborting...";
+        qAmqpChannelDebug() << Q_FUNC_INFO << "attempting to declare an unnamed exchange, aborting...";
         return;
     }
 
@@ -53,19 +180,19 @@ void QAmqpExchangePrivate::declare()
     frame.setChannel(channelNumber);
 
     QByteArray args;
-    QDataStream stream(&args, QIODevice::WriteOnly);
+    QAmqpCodecWriter writer(&args);
 
-    stream << qint16(0);    //reserved 1
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortString, name);
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortString, type);
+    writer.writeShort(0);    //reserved 1
+    writer.writeShortString(name);
+    writer.writeShortString(type);
 
-    stream << qint8(options);
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::Hash, arguments);
+    writer.writeOctet(quint8(options));
+    writer.writeTable(arguments);
 
-    qAmqpDebug("<- exchange#declare( name=%s, type=%s, passive=%d, durable=%d, no-wait=%d )",
-               qPrintable(name), qPrintable(type),
-               options.testFlag(QAmqpExchange::Passive), options.testFlag(QAmqpExchange::Durable),
-               options.testFlag(QAmqpExchange::NoWait));
+    qAmqpChannelDebug("<- exchange#declare( name=%s, type=%s, passive=%d, durable=%d, no-wait=%d )",
+                      qPrintable(name), qPrintable(type),
+                      options.testFlag(QAmqpExchange::Passive), options.testFlag(QAmqpExchange::Durable),
+                      options.testFlag(QAmqpExchange::NoWait));
 
     frame.setArguments(args);
     sendFrame(frame);
@@ -119,7 +246,7 @@ void QAmqpExchangePrivate::declareOk(const QAmqpMethodFrame &frame)
 {
     Q_UNUSED(frame)
     Q_Q(QAmqpExchange);
-    qAmqpDebug("-> exchange[ %s ]#declareOk()", qPrintable(name));
+    qAmqpChannelDebug("-> exchange[ %s ]#declareOk()", qPrintable(name));
     declared = true;
     Q_EMIT q->declared();
 }
@@ -128,7 +255,7 @@ void QAmqpExchangePrivate::deleteOk(const QAmqpMethodFrame &frame)
 {
     Q_UNUSED(frame)
     Q_Q(QAmqpExchange);
-    qAmqpDebug("-> exchange#deleteOk[ %s ]()", qPrintable(name));
+    qAmqpChannelDebug("-> exchange#deleteOk[ %s ]()", qPrintable(name));
     declared = false;
     Q_EMIT q->removed();
 }
@@ -136,23 +263,22 @@ void QAmqpExchangePrivate::deleteOk(const QAmqpMethodFrame &frame)
 void QAmqpExchangePrivate::_q_disconnected()
 {
     QAmqpChannelPrivate::_q_disconnected();
-    qAmqpDebug() << "exchange disconnected: " << name;
+    qAmqpChannelDebug() << "exchange disconnected: " << name;
     delayedDeclare = false;
     declared = false;
-    unconfirmedDeliveryTags.clear();
+    abandonConfirms();
+    settlePostedConfirms(0, true, false);
 }
 
 void QAmqpExchangePrivate::basicReturn(const QAmqpMethodFrame &frame)
 {
     Q_Q(QAmqpExchange);
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
+    QAmqpCodecReader reader(frame.arguments());
 
-    quint16 replyCode;
-    stream >> replyCode;
-    QString replyText = QAmqpFrame::readAmqpField(stream, QAmqpMetaType::ShortString).toString();
-    QString exchangeName = QAmqpFrame::readAmqpField(stream, QAmqpMetaType::ShortString).toString();
-    QString routingKey = QAmqpFrame::readAmqpField(stream, QAmqpMetaType::ShortString).toString();
+    quint16 replyCode = reader.readShort();
+    QString replyText = reader.readShortString();
+    QString exchangeName = reader.readShortString();
+    QString routingKey = reader.readShortString();
 
     QAMQP::Error checkError = static_cast<QAMQP::Error>(replyCode);
     if (checkError != QAMQP::NoError) {
@@ -161,41 +287,273 @@ void QAmqpExchangePrivate::basicReturn(const QAmqpMethodFrame &frame)
         Q_EMIT q->error(error);
     }
 
-    qAmqpDebug("-> basic#return( reply-code=%d, reply-text=%s, exchange=%s, routing-key=%s )",
-               replyCode, qPrintable(replyText), qPrintable(exchangeName), qPrintable(routingKey));
+    qAmqpBasicDebug("-> basic#return( reply-code=%d, reply-text=%s, exchange=%s, routing-key=%s )",
+                    replyCode, qPrintable(replyText), qPrintable(exchangeName), qPrintable(routingKey));
 }
 
 void QAmqpExchangePrivate::handleAckOrNack(const QAmqpMethodFrame &frame)
 {
     Q_Q(QAmqpExchange);
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
-
-    qlonglong deliveryTag =
-        QAmqpFrame::readAmqpField(stream, QAmqpMetaType::LongLongUint).toLongLong();
-    bool multiple = QAmqpFrame::readAmqpField(stream, QAmqpMetaType::Boolean).toBool();
-    if (frame.id() == QAmqpExchangePrivate::bmAck) {
-        if (deliveryTag == 0) {
-            unconfirmedDeliveryTags.clear();
+    QAmqpCodecReader reader(frame.arguments());
+
+    qlonglong deliveryTag = qlonglong(reader.readLongLong());
+    bool multiple = reader.readBoolean();
+    const bool confirmed = (frame.id() == QAmqpExchangePrivate::bmAck);
+    if (!confirmed)
+        qAmqpBasicDebug() << "nacked(" << deliveryTag << "), multiple=" << multiple;
+
+    settlePostedConfirms(deliveryTag, multiple, confirmed);
+
+    // tags that timed out or were already settled are not reported again
+    QVector<qlonglong> settled;
+    confirms.settle(deliveryTag, multiple, &settled);
+    if (settled.isEmpty())
+        return;
+
+    reportConfirms(settled, confirmed);
+    resolveConfirmWaiters();
+    if (confirms.isEmpty())
+        Q_EMIT q->allMessagesDelivered();
+}
+
+/*!
+ * Starts tracking count messages about to be published, returns the delivery
+ * tag of the first one or 0 if confirms are not enabled.
+ */
+qlonglong QAmqpExchangePrivate::trackPublish(int count)
+{
+    if (!confirmMode)
+        return 0;
+
+    const qlonglong first = confirms.track(count, confirmClock.elapsed());
+    if (confirmTimeout > 0 && (!confirmTimer || !confirmTimer->isActive()))
+        scheduleConfirmTimeout();
+    return first;
+}
+
+void QAmqpExchangePrivate::reportConfirms(const QVector<qlonglong> &deliveryTags, bool confirmed)
+{
+    Q_Q(QAmqpExchange);
+    if (confirmed) {
+        for (int i = 0; i < deliveryTags.size(); ++i)
+            Q_EMIT q->messageConfirmed(deliveryTags.at(i));
+        Q_EMIT q->messagesConfirmed(deliveryTags);
+    } else {
+        failConfirmWaiters(deliveryTags.first());
+        for (int i = 0; i < deliveryTags.size(); ++i)
+            Q_EMIT q->messageRejected(deliveryTags.at(i));
+        Q_EMIT q->messagesRejected(deliveryTags);
+    }
+}
+
+/*!
+ * Marks the waiters covering deliveryTag as failed, they are still resolved
+ * in tag order once everything before them is settled.
+ */
+void QAmqpExchangePrivate::failConfirmWaiters(qlonglong deliveryTag)
+{
+    QMultiMap<qlonglong, ConfirmWaiter>::iterator it = confirmWaiters.lowerBound(deliveryTag);
+    for (; it != confirmWaiters.end(); ++it)
+        it->failed = true;
+}
+
+void QAmqpExchangePrivate::resolveConfirmWaiters()
+{
+    Q_Q(QAmqpExchange);
+    const qlonglong watermark = confirms.settledThrough();
+    if (watermark == confirmWatermark)
+        return;
+
+    confirmWatermark = watermark;
+    QMultiMap<qlonglong, ConfirmWaiter>::iterator it = confirmWaiters.begin();
+    while (it != confirmWaiters.end() && it.key() <= watermark) {
+        const bool result = !it->failed;
+        it->promise.reportResult(result);
+        it->promise.reportFinished();
+        it = confirmWaiters.erase(it);
+    }
+
+    Q_EMIT q->confirmWatermarkChanged(watermark);
+}
+
+/*!
+ * The channel is gone and with it any chance of a confirm, everything still
+ * outstanding is reported as rejected.
+ */
+void QAmqpExchangePrivate::abandonConfirms()
+{
+    QVector<qlonglong> abandoned;
+    confirms.settle(0, true, &abandoned);
+    if (confirmTimer)
+        confirmTimer->stop();
+
+    if (!abandoned.isEmpty())
+        reportConfirms(abandoned, false);
+    resolveConfirmWaiters();
+
+    // tags start over with the next channel
+    confirms.reset();
+    confirmWatermark = 0;
+}
+
+void QAmqpExchangePrivate::scheduleConfirmTimeout()
+{
+    Q_Q(QAmqpExchange);
+    const qint64 oldest = confirms.oldestTime();
+    if (confirmTimeout <= 0 || oldest < 0) {
+        if (confirmTimer)
+            confirmTimer->stop();
+        return;
+    }
+
+    if (!confirmTimer) {
+        confirmTimer = new QTimer(q);
+        confirmTimer->setSingleShot(true);
+        QObject::connect(confirmTimer, SIGNAL(timeout()), q, SLOT(_q_confirmTimeout()));
+    }
+
+    const qint64 remaining = oldest + confirmTimeout - confirmClock.elapsed();
+    confirmTimer->start(int(qMax(remaining, qint64(0))));
+}
+
+void QAmqpExchangePrivate::_q_confirmTimeout()
+{
+    Q_Q(QAmqpExchange);
+    QVector<qlonglong> expired;
+    confirms.expire(confirmClock.elapsed() - confirmTimeout, &expired);
+    if (!expired.isEmpty()) {
+        qAmqpBasicDebug() << "exchange" << name << ":" << expired.size() << "messages not confirmed in time";
+        for (int i = 0; i < expired.size(); ++i)
+            settlePostedConfirms(expired.at(i), false, false);
+        failConfirmWaiters(expired.first());
+        Q_EMIT q->confirmsTimedOut(expired);
+        resolveConfirmWaiters();
+    }
+
+    scheduleConfirmTimeout();
+}
+
+void QAmqpExchangePrivate::_q_drainPublishQueue()
+{
+    // re-arm first, anything posted from here on schedules another drain
+    publishQueue->notified.fetchAndStoreOrdered(0);
+
+    QVector<QAmqpPostedPublish> batch;
+    QAmqpPostedPublish posted;
+    while (publishQueue->queue.dequeue(&posted))
+        batch.append(posted);
+
+    if (!batch.isEmpty())
+        publishPosted(batch);
+}
+
+void QAmqpExchangePrivate::publishPosted(const QVector<QAmqpPostedPublish> &batch)
+{
+    const int count = batch.size();
+    qAmqpBasicDebug("<- basic#publish( exchange=%s, posted=%d )", qPrintable(name), count);
+
+    const QByteArray &exchangeName = encodedName();
+    QVector<QByteArray> routingKeys(count);
+    QVector<QAmqpContentFrame> headers(count, QAmqpContentFrame(QAmqpFrame::Basic));
+    qint64 batchSize = 0;
+    for (int i = 0; i < count; ++i) {
+        const QAmqpPostedPublish &posted = batch.at(i);
+        if (posted.publishTemplate.isValid()) {
+            batchSize += templatePublishSize(posted.publishTemplate.d.constData(), posted.message.size());
+            continue;
+        }
+
+        QAmqpContentFrame &content = headers[i];
+        content.setChannel(channelNumber);
+
+        QAmqpMessage::PropertyHash::ConstIterator it;
+        QAmqpMessage::PropertyHash::ConstIterator itEnd = posted.properties.constEnd();
+        for (it = posted.properties.constBegin(); it != itEnd; ++it)
+            content.setProperty(it.key(), it.value());
+        content.setBodySize(posted.message.size());
+
+        routingKeys[i] = posted.routingKey.toUtf8();
+        batchSize += publishSize(exchangeName, routingKeys.at(i), content, posted.message.size());
+    }
+
+    QByteArray *buffer = beginWrite(batchSize);
+    if (!buffer) {
+        // nothing went out, let the publishers know right away
+        for (int i = 0; i < count; ++i) {
+            const QAmqpPostedPublish &posted = batch.at(i);
+            posted.link->post(QVector<qlonglong>() << posted.publishId, false);
+        }
+        return;
+    }
+
+    QAmqpCodecWriter writer(buffer);
+    for (int i = 0; i < count; ++i) {
+        const QAmqpPostedPublish &posted = batch.at(i);
+        if (posted.publishTemplate.isValid()) {
+            encodeTemplatePublish(writer, posted.publishTemplate.d.constData(),
+                                  posted.message, posted.properties);
         } else {
-            int idx = unconfirmedDeliveryTags.indexOf(deliveryTag);
-            if (idx == -1) {
-                return;
-            }
-
-            if (multiple) {
-                unconfirmedDeliveryTags.remove(0, idx + 1);
-            } else {
-                unconfirmedDeliveryTags.remove(idx);
-            }
+            encodePublish(writer, exchangeName, routingKeys.at(i), posted.publishOptions,
+                          headers.at(i), posted.message);
         }
 
-        if (unconfirmedDeliveryTags.isEmpty())
-            Q_EMIT q->allMessagesDelivered();
+    }
+    endWrite();
 
-    } else {
-        qAmqpDebug() << "nacked(" << deliveryTag << "), multiple=" << multiple;
+    const qlonglong firstTag = trackPublish(count);
+    if (firstTag > 0) {
+        for (int i = 0; i < count; ++i) {
+            const QAmqpPostedPublish &posted = batch.at(i);
+            postedConfirms.insert(firstTag + i, PostedConfirm(posted.link, posted.publishId));
+        }
+    }
+}
+
+/*!
+ * Reports the posted messages covered by an ack or nack to their publishers,
+ * a delivery tag of 0 with multiple set covers all of them. Consecutive
+ * messages from the same publisher are reported with a single post.
+ */
+void QAmqpExchangePrivate::settlePostedConfirms(qlonglong deliveryTag, bool multiple, bool confirmed)
+{
+    if (postedConfirms.isEmpty())
+        return;
+
+    QMap<qlonglong, PostedConfirm>::iterator it;
+    if (multiple)
+        it = postedConfirms.begin();
+    else
+        it = postedConfirms.find(deliveryTag);
+
+    QSharedPointer<QAmqpPublisherLink> link;
+    QVector<qlonglong> publishIds;
+    while (it != postedConfirms.end() && (deliveryTag == 0 || it.key() <= deliveryTag)) {
+        if (it->link != link) {
+            if (link)
+                link->post(publishIds, confirmed);
+            link = it->link;
+            publishIds.clear();
+        }
+
+        publishIds.append(it->publishId);
+        it = postedConfirms.erase(it);
+        if (!multiple)
+            break;
     }
+
+    if (link)
+        link->post(publishIds, confirmed);
+}
+
+qint64 QAmqpExchangePrivate::templatePublishSize(const QAmqpPublishTemplatePrivate *publishTemplate,
+                                                 int messageSize) const
+{
+    // per message properties are not accounted for, the size is only a hint
+    const qint64 overhead = QAmqpFrame::HEADER_SIZE + QAmqpFrame::FRAME_END_SIZE;
+    const int maxBodySize = maxBodyFrameSize();
+    return overhead + 7 + encodedName().size() + publishTemplate->methodArguments.size()
+         + overhead + publishTemplate->header.size()
+         + (messageSize + maxBodySize - 1) / maxBodySize * overhead + messageSize;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -205,10 +563,29 @@ QAmqpExchange::QAmqpExchange(int channelNumber, QAmqpClient *parent)
 {
     Q_D(QAmqpExchange);
     d->init(channelNumber, parent);
+    d->publishQueue = QSharedPointer<QAmqpPublishQueue>(new QAmqpPublishQueue(this));
+    qRegisterMetaType<QVector<qlonglong> >("QVector<qlonglong>");
 }
 
 QAmqpExchange::~QAmqpExchange()
 {
+    Q_D(QAmqpExchange);
+    {
+        QMutexLocker locker(&d->publishQueue->mutex);
+        d->publishQueue->exchange = 0;
+    }
+
+    QAmqpPostedPublish posted;
+    while (d->publishQueue->queue.dequeue(&posted))
+        posted.link->post(QVector<qlonglong>() << posted.publishId, false);
+    d->settlePostedConfirms(0, true, false);
+
+    // nothing is going to settle them anymore
+    QMultiMap<qlonglong, QAmqpExchangePrivate::ConfirmWaiter>::iterator it;
+    for (it = d->confirmWaiters.begin(); it != d->confirmWaiters.end(); ++it) {
+        it->promise.reportResult(false);
+        it->promise.reportFinished();
+    }
 }
 
 void QAmqpExchange::channelOpened()
@@ -261,82 +638,144 @@ void QAmqpExchange::remove(int options)
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream stream(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter writer(&arguments);
 
-    stream << qint16(0);    //reserved 1
-    QAmqpFrame::writeAmqpField(stream, QAmqpMetaType::ShortString, d->name);
-    stream << qint8(options);
+    writer.writeShort(0);    //reserved 1
+    writer.writeShortString(d->name);
+    writer.writeOctet(quint8(options));
 
-    qAmqpDebug("<- exchange#delete( exchange=%s, if-unused=%d, no-wait=%d )",
-               qPrintable(d->name), options & QAmqpExchange::roIfUnused, options & QAmqpExchange::roNoWait);
+    qAmqpChannelDebug("<- exchange#delete( exchange=%s, if-unused=%d, no-wait=%d )",
+                      qPrintable(d->name), options & QAmqpExchange::roIfUnused, options & QAmqpExchange::roNoWait);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
 }
 
-void QAmqpExchange::publish(const QString &message, const QString &routingKey,
-                            const QAmqpMessage::PropertyHash &properties, int publishOptions)
+qlonglong QAmqpExchange::publish(const QString &message, const QString &routingKey,
+                                 const QAmqpMessage::PropertyHash &properties, int publishOptions)
 {
-    publish(message.toUtf8(), routingKey, QLatin1String("text.plain"),
-            QAmqpTable(), properties, publishOptions);
+    return publish(message.toUtf8(), routingKey, QLatin1String("text.plain"),
+                   QAmqpTable(), properties, publishOptions);
 }
 
-void QAmqpExchange::publish(const QByteArray &message, const QString &routingKey,
-                            const QString &mimeType, const QAmqpMessage::PropertyHash &properties,
-                            int publishOptions)
+qlonglong QAmqpExchange::publish(const QByteArray &message, const QString &routingKey,
+                                 const QString &mimeType, const QAmqpMessage::PropertyHash &properties,
+                                 int publishOptions)
 {
-    publish(message, routingKey, mimeType, QAmqpTable(), properties, publishOptions);
+    return publish(message, routingKey, mimeType, QAmqpTable(), properties, publishOptions);
 }
 
-void QAmqpExchange::publish(const QByteArray &message, const QString &routingKey,
-                            const QString &mimeType, const QAmqpTable &headers,
-                            const QAmqpMessage::PropertyHash &properties, int publishOptions)
+/*!
+ * Publishes message and returns its delivery tag when confirms are enabled,
+ * the tag is what messageConfirmed(), messageRejected() and
+ * confirmsTimedOut() report. Returns 0 if confirms are not enabled or the
+ * message could not be sent.
+ */
+qlonglong QAmqpExchange::publish(const QByteArray &message, const QString &routingKey,
+                                 const QString &mimeType, const QAmqpTable &headers,
+                                 const QAmqpMessage::PropertyHash &properties, int publishOptions)
 {
     Q_D(QAmqpExchange);
-    if (d->nextDeliveryTag > 0) {
-        d->unconfirmedDeliveryTags.append(d->nextDeliveryTag);
-        d->nextDeliveryTag++;
-    }
+    qAmqpBasicDebug("<- basic#publish( exchange=%s, routing-key=%s, mandatory=%d, immediate=%d )",
+                    qPrintable(d->name), qPrintable(routingKey),
+                    publishOptions & QAmqpExchange::poMandatory, publishOptions & QAmqpExchange::poImmediate);
 
-    QAmqpMethodFrame frame(QAmqpFrame::Basic, QAmqpExchangePrivate::bmPublish);
-    frame.setChannel(d->channelNumber);
+    QAmqpContentFrame content(QAmqpFrame::Basic);
+    content.setChannel(d->channelNumber);
+    QAmqpExchangePrivate::setContentProperties(content, mimeType, headers, properties);
+    content.setBodySize(message.size());
 
-    QByteArray arguments;
-    QDataStream out(&arguments, QIODevice::WriteOnly);
+    const QByteArray &exchangeName = d->encodedName();
+    const QByteArray routingKeyData = routingKey.toUtf8();
+    QByteArray *buffer =
+        d->beginWrite(d->publishSize(exchangeName, routingKeyData, content, message.size()));
+    if (!buffer)
+        return 0;
+
+    QAmqpCodecWriter writer(buffer);
+    d->encodePublish(writer, exchangeName, routingKeyData, publishOptions, content, message);
+    d->endWrite();
+    return d->trackPublish(1);
+}
 
-    out << qint16(0);   //reserved 1
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, d->name);
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, routingKey);
-    out << qint8(publishOptions);
+/*!
+ * Publishes message using a template created with QAmqpPublishTemplate.
+ * properties may add to or override the template's properties for this
+ * message only, typically MessageId or Timestamp.
+ */
+qlonglong QAmqpExchange::publish(const QAmqpPublishTemplate &publishTemplate, const QByteArray &message,
+                                 const QAmqpMessage::PropertyHash &properties)
+{
+    Q_D(QAmqpExchange);
+    if (!publishTemplate.isValid()) {
+        qAmqpBasicDebug() << Q_FUNC_INFO << "invalid publish template";
+        return 0;
+    }
 
-    qAmqpDebug("<- basic#publish( exchange=%s, routing-key=%s, mandatory=%d, immediate=%d )",
-               qPrintable(d->name), qPrintable(routingKey),
-               publishOptions & QAmqpExchange::poMandatory, publishOptions & QAmqpExchange::poImmediate);
+    const QAmqpPublishTemplatePrivate *templateData = publishTemplate.d.constData();
+    qAmqpBasicDebug("<- basic#publish( exchange=%s, routing-key=%s, mandatory=%d, immediate=%d )",
+                    qPrintable(d->name), qPrintable(templateData->routingKey),
+                    templateData->publishOptions & QAmqpExchange::poMandatory,
+                    templateData->publishOptions & QAmqpExchange::poImmediate);
 
-    frame.setArguments(arguments);
-    d->sendFrame(frame);
+    QByteArray *buffer = d->beginWrite(d->templatePublishSize(templateData, message.size()));
+    if (!buffer)
+        return 0;
 
-    QAmqpContentFrame content(QAmqpFrame::Basic);
-    content.setChannel(d->channelNumber);
-    content.setProperty(QAmqpMessage::ContentType, mimeType);
-    content.setProperty(QAmqpMessage::ContentEncoding, "utf-8");
-    content.setProperty(QAmqpMessage::Headers, headers);
+    QAmqpCodecWriter writer(buffer);
+    d->encodeTemplatePublish(writer, templateData, message, properties);
+    d->endWrite();
+    return d->trackPublish(1);
+}
 
-    QAmqpMessage::PropertyHash::ConstIterator it;
-    QAmqpMessage::PropertyHash::ConstIterator itEnd = properties.constEnd();
-    for (it = properties.constBegin(); it != itEnd; ++it)
-        content.setProperty(it.key(), it.value());
-    content.setBodySize(message.size());
-    d->sendFrame(content);
-
-    int fullSize = message.size();
-    for (int sent = 0; sent < fullSize; sent += (d->client->frameMax() - 7)) {
-        QAmqpContentBodyFrame body;
-        QByteArray partition = message.mid(sent, (d->client->frameMax() - 7));
-        body.setChannel(d->channelNumber);
-        body.setBody(partition);
-        d->sendFrame(body);
+/*!
+ * Publishes all entries back to back. The whole batch is encoded into the
+ * write buffer in one go and goes out with a single socket write, and when
+ * confirms are enabled the delivery tags for the batch are reserved at once.
+ * Entries get the same property defaults as publish(), with
+ * application/octet-stream as the content type unless they set one.
+ * Returns the delivery tag of the first entry, the others follow in order,
+ * or 0 if confirms are not enabled or the batch could not be sent.
+ */
+qlonglong QAmqpExchange::publishBatch(const QList<PublishEntry> &entries, int publishOptions)
+{
+    Q_D(QAmqpExchange);
+    if (entries.isEmpty())
+        return 0;
+
+    const int count = entries.size();
+
+    qAmqpBasicDebug("<- basic#publish( exchange=%s, batch=%d, mandatory=%d, immediate=%d )",
+                    qPrintable(d->name), count,
+                    publishOptions & QAmqpExchange::poMandatory, publishOptions & QAmqpExchange::poImmediate);
+
+    const QByteArray &exchangeName = d->encodedName();
+    const QString mimeType = QLatin1String("application/octet-stream");
+    QVector<QByteArray> routingKeys(count);
+    QVector<QAmqpContentFrame> headers(count, QAmqpContentFrame(QAmqpFrame::Basic));
+    qint64 batchSize = 0;
+    for (int i = 0; i < count; ++i) {
+        const PublishEntry &entry = entries.at(i);
+        QAmqpContentFrame &content = headers[i];
+        content.setChannel(d->channelNumber);
+        QAmqpExchangePrivate::setContentProperties(content, mimeType, QAmqpTable(), entry.properties);
+        content.setBodySize(entry.payload.size());
+
+        routingKeys[i] = entry.routingKey.toUtf8();
+        batchSize += d->publishSize(exchangeName, routingKeys.at(i), content, entry.payload.size());
+    }
+
+    QByteArray *buffer = d->beginWrite(batchSize);
+    if (!buffer)
+        return 0;
+
+    QAmqpCodecWriter writer(buffer);
+    for (int i = 0; i < count; ++i) {
+        d->encodePublish(writer, exchangeName, routingKeys.at(i), publishOptions,
+                         headers.at(i), entries.at(i).payload);
     }
+    d->endWrite();
+    return d->trackPublish(count);
 }
 
 void QAmqpExchange::enableConfirms(bool noWait)
@@ -346,24 +785,109 @@ void QAmqpExchange::enableConfirms(bool noWait)
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream stream(&arguments, QIODevice::WriteOnly);
-    stream << qint8(noWait ? 1 : 0);
+    QAmqpCodecWriter writer(&arguments);
+    writer.writeBoolean(noWait);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
 
-    // for tracking acks and nacks
-    if (d->nextDeliveryTag == 0) d->nextDeliveryTag = 1;
+    // for tracking acks and nacks, the broker numbers messages from 1 on
+    if (!d->confirmMode) {
+        d->confirmMode = true;
+        d->confirms.reset();
+        d->confirmClock.start();
+    }
 }
 
+/*!
+ * Blocks in a nested event loop for up to msecs until every message published
+ * so far is confirmed. Prefer confirmsSettled(), which does not re-enter the
+ * event loop and lets several batches be in flight at once.
+ */
 bool QAmqpExchange::waitForConfirms(int msecs)
 {
     Q_D(QAmqpExchange);
+    QFuture<bool> settled = confirmsSettled();
+    if (!settled.isFinished()) {
+        QEventLoop loop;
+        QFutureWatcher<bool> watcher;
+        connect(&watcher, SIGNAL(finished()), &loop, SLOT(quit()));
+        watcher.setFuture(settled);
+        QTimer::singleShot(msecs, &loop, SLOT(quit()));
+        loop.exec();
+    }
 
-    QEventLoop loop;
-    connect(this, SIGNAL(allMessagesDelivered()), &loop, SLOT(quit()));
-    QTimer::singleShot(msecs, &loop, SLOT(quit()));
-    loop.exec();
+    return d->confirms.isEmpty();
+}
 
-    return (d->unconfirmedDeliveryTags.isEmpty());
+/*!
+ * Returns a future that finishes once every message published up to and
+ * including upToTag has been confirmed or rejected by the broker, with a
+ * result of true unless any of them still outstanding at the time of the
+ * call was rejected, timed out or lost with the channel. An upToTag of 0
+ * waits for everything published so far.
+ *
+ * Keeping one future per published batch lets the next batch go out while
+ * earlier ones are still being confirmed.
+ */
+QFuture<bool> QAmqpExchange::confirmsSettled(qlonglong upToTag)
+{
+    Q_D(QAmqpExchange);
+    QFutureInterface<bool> promise;
+    promise.reportStarted();
+
+    const qlonglong lastTag = d->confirms.nextTag() - 1;
+    if (upToTag <= 0 || upToTag > lastTag)
+        upToTag = lastTag;
+
+    if (!d->confirmMode) {
+        qAmqpBasicDebug() << Q_FUNC_INFO << "confirms are not enabled";
+        promise.reportResult(false);
+        promise.reportFinished();
+    } else if (upToTag <= d->confirms.settledThrough()) {
+        promise.reportResult(true);
+        promise.reportFinished();
+    } else {
+        QAmqpExchangePrivate::ConfirmWaiter waiter;
+        waiter.promise = promise;
+        d->confirmWaiters.insert(upToTag, waiter);
+    }
+
+    return promise.future();
+}
+
+/*!
+ * Returns the delivery tag up to which every published message has been
+ * confirmed or rejected, confirmWatermarkChanged() is emitted as it moves.
+ */
+qlonglong QAmqpExchange::confirmWatermark() const
+{
+    Q_D(const QAmqpExchange);
+    return d->confirmWatermark;
+}
+
+int QAmqpExchange::unconfirmedCount() const
+{
+    Q_D(const QAmqpExchange);
+    return d->confirms.pendingCount();
+}
+
+int QAmqpExchange::confirmTimeout() const
+{
+    Q_D(const QAmqpExchange);
+    return d->confirmTimeout;
 }
+
+/*!
+ * Messages not confirmed or rejected by the broker within msecs of being
+ * published are reported through confirmsTimedOut() and no longer tracked,
+ * a late confirm for them is ignored. 0 disables the timeout.
+ */
+void QAmqpExchange::setConfirmTimeout(int msecs)
+{
+    Q_D(QAmqpExchange);
+    d->confirmTimeout = qMax(msecs, 0);
+    d->scheduleConfirmTimeout();
+}
+
+#include "moc_qamqpexchange.cpp"
@@ -18,9 +18,12 @@
 #ifndef QAMQPEXCHANGE_H
 #define QAMQPEXCHANGE_H
 
+#include <QFuture>
+
 #include "qamqptable.h"
 #include "qamqpchannel.h"
 #include "qamqpmessage.h"
+#include "qamqppublishtemplate.h"
 
 class QAmqpClient;
 class QAmqpQueue;
@@ -51,6 +54,18 @@ public:
     };
     Q_DECLARE_FLAGS(PublishOptions, PublishOption)
 
+    struct PublishEntry
+    {
+        PublishEntry() {}
+        PublishEntry(const QByteArray &payload, const QString &routingKey,
+                     const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash())
+            : payload(payload), routingKey(routingKey), properties(properties) {}
+
+        QByteArray payload;
+        QString routingKey;
+        QAmqpMessage::PropertyHash properties;
+    };
+
     enum RemoveOption {
         roForce = 0x0,
         roIfUnused = 0x01,
@@ -73,6 +88,15 @@ public:
 
     void enableConfirms(bool noWait = false);
     bool waitForConfirms(int msecs = 30000);
+    QFuture<bool> confirmsSettled(qlonglong upToTag = 0);
+    qlonglong confirmWatermark() const;
+    int unconfirmedCount() const;
+    int confirmTimeout() const;
+    void setConfirmTimeout(int msecs);
+
+    qlonglong publishBatch(const QList<PublishEntry> &entries, int publishOptions = poNoOptions);
+    qlonglong publish(const QAmqpPublishTemplate &publishTemplate, const QByteArray &message,
+                      const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash());
 
 Q_SIGNALS:
     void declared();
@@ -80,6 +104,12 @@ Q_SIGNALS:
 
     void confirmsEnabled();
     void allMessagesDelivered();
+    void messageConfirmed(qlonglong deliveryTag);
+    void messageRejected(qlonglong deliveryTag);
+    void messagesConfirmed(const QVector<qlonglong> &deliveryTags);
+    void messagesRejected(const QVector<qlonglong> &deliveryTags);
+    void confirmsTimedOut(const QVector<qlonglong> &deliveryTags);
+    void confirmWatermarkChanged(qlonglong deliveryTag);
 
 public Q_SLOTS:
     // AMQP Exchange
@@ -92,16 +122,16 @@ public Q_SLOTS:
     void remove(int options = roIfUnused|roNoWait);
 
     // AMQP Basic
-    void publish(const QString &message, const QString &routingKey,
-                 const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash(),
-                 int publishOptions = poNoOptions);
-    void publish(const QByteArray &message, const QString &routingKey, const QString &mimeType,
-                 const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash(),
-                 int publishOptions = poNoOptions);
-    void publish(const QByteArray &message, const QString &routingKey,
-                 const QString &mimeType, const QAmqpTable &headers,
-                 const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash(),
-                 int publishOptions = poNoOptions);
+    qlonglong publish(const QString &message, const QString &routingKey,
+                      const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash(),
+                      int publishOptions = poNoOptions);
+    qlonglong publish(const QByteArray &message, const QString &routingKey, const QString &mimeType,
+                      const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash(),
+                      int publishOptions = poNoOptions);
+    qlonglong publish(const QByteArray &message, const QString &routingKey,
+                      const QString &mimeType, const QAmqpTable &headers,
+                      const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash(),
+                      int publishOptions = poNoOptions);
 
 protected:
     virtual void channelOpened();
@@ -114,7 +144,10 @@ private:
     Q_DECLARE_PRIVATE(QAmqpExchange)
     friend class QAmqpClient;
     friend class QAmqpClientPrivate;
+    friend class QAmqpPublisher;
 
+    Q_PRIVATE_SLOT(d_func(), void _q_drainPublishQueue())
+    Q_PRIVATE_SLOT(d_func(), void _q_confirmTimeout())
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(QAmqpExchange::ExchangeOptions)
@@ -1,9 +1,19 @@
 #ifndef QAMQPEXCHANGE_P_H
 #define QAMQPEXCHANGE_P_H
 
+#include <QElapsedTimer>
+#include <QFutureInterface>
+#include <QMap>
+#include <QPointer>
+
 #include "qamqptable.h"
 #include "qamqpexchange.h"
 #include "qamqpchannel_p.h"
+#include "qamqpconfirmtracker_p.h"
+#include "qamqppublisher_p.h"
+
+class QTimer;
+class QAmqpPublishTemplatePrivate;
 
 class QAmqpExchangePrivate: public QAmqpChannelPrivate
 {
@@ -24,6 +34,37 @@ public:
 
     void declare();
 
+    // publish fast path, frames are encoded straight into the write buffer
+    int maxBodyFrameSize() const;
+    static void setContentProperties(QAmqpContentFrame &content, const QString &mimeType,
+                                     const QAmqpTable &headers,
+                                     const QAmqpMessage::PropertyHash &properties);
+    qint64 publishSize(const QByteArray &exchangeName, const QByteArray &routingKey,
+                       const QAmqpContentFrame &header, int messageSize) const;
+    void encodePublish(QAmqpCodecWriter &writer, const QByteArray &exchangeName,
+                       const QByteArray &routingKey, int publishOptions,
+                       const QAmqpContentFrame &header, const QByteArray &message) const;
+    void encodeTemplatePublish(QAmqpCodecWriter &writer, const QAmqpPublishTemplatePrivate *publishTemplate,
+                               const QByteArray &message,
+                               const QAmqpMessage::PropertyHash &properties) const;
+    qint64 templatePublishSize(const QAmqpPublishTemplatePrivate *publishTemplate, int messageSize) const;
+    void encodeBodyFrames(QAmqpCodecWriter &writer, const QByteArray &message) const;
+    const QByteArray &encodedName() const;
+
+    // messages posted by QAmqpPublisher from other threads
+    void _q_drainPublishQueue();
+    void publishPosted(const QVector<QAmqpPostedPublish> &batch);
+    void settlePostedConfirms(qlonglong deliveryTag, bool multiple, bool confirmed);
+
+    // publisher confirms
+    qlonglong trackPublish(int count);
+    void reportConfirms(const QVector<qlonglong> &deliveryTags, bool confirmed);
+    void abandonConfirms();
+    void scheduleConfirmTimeout();
+    void _q_confirmTimeout();
+    void failConfirmWaiters(qlonglong deliveryTag);
+    void resolveConfirmWaiters();
+
     // method handler related
     virtual void _q_disconnected();
     virtual bool _q_method(const QAmqpMethodFrame &frame);
@@ -36,8 +77,40 @@ public:
     QAmqpExchange::ExchangeOptions options;
     bool delayedDeclare;
     bool declared;
-    qlonglong nextDeliveryTag;
-    QVector<qlonglong> unconfirmedDeliveryTags;
+    bool confirmMode;
+    QAmqpConfirmTracker confirms;
+    QElapsedTimer confirmClock;
+    int confirmTimeout;
+    QPointer<QTimer> confirmTimer;
+
+    // futures handed out by confirmsSettled(), keyed by the tag they wait for
+    struct ConfirmWaiter
+    {
+        ConfirmWaiter() : failed(false) {}
+
+        QFutureInterface<bool> promise;
+        bool failed;
+    };
+    QMultiMap<qlonglong, ConfirmWaiter> confirmWaiters;
+    qlonglong confirmWatermark;
+
+    QSharedPointer<QAmqpPublishQueue> publishQueue;
+
+    // delivery tag to publisher and publish id, for posted messages only
+    struct PostedConfirm
+    {
+        PostedConfirm() : publishId(0) {}
+        PostedConfirm(const QSharedPointer<QAmqpPublisherLink> &link, qlonglong publishId)
+            : link(link), publishId(publishId) {}
+
+        QSharedPointer<QAmqpPublisherLink> link;
+        qlonglong publishId;
+    };
+    QMap<qlonglong, PostedConfirm> postedConfirms;
+
+    // the exchange name as last encoded, refreshed when the name changes
+    mutable QString encodedNameSource;
+    mutable QByteArray encodedNameData;
 
     Q_DECLARE_PUBLIC(QAmqpExchange)
 };
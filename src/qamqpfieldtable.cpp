@@ -0,0 +1,122 @@
+#include <QHash>
+#include <QThreadStorage>
+
+#include "qamqpcodec_p.h"
+#include "qamqpfieldtable_p.h"
+
+/*
+ * Field table keys come from a small, mostly fixed vocabulary, so they are
+ * interned per thread. The cache is bounded, keys seen after it is full are
+ * allocated as usual.
+ */
+static const int maxInternedKeys = 1024;
+
+struct QAmqpInternedKeys
+{
+    QHash<QByteArray, QString> keys;
+};
+
+static QThreadStorage<QAmqpInternedKeys*> internedKeys;
+
+static QString internKey(const char *data, int size)
+{
+    if (!internedKeys.hasLocalData())
+        internedKeys.setLocalData(new QAmqpInternedKeys);
+
+    QHash<QByteArray, QString> &keys = internedKeys.localData()->keys;
+    const QByteArray raw = QByteArray::fromRawData(data, size);
+    QHash<QByteArray, QString>::ConstIterator it = keys.constFind(raw);
+    if (it != keys.constEnd())
+        return it.value();
+
+    const QString key = QString::fromUtf8(data, size);
+    if (keys.size() < maxInternedKeys)
+        keys.insert(QByteArray(data, size), key);
+    return key;
+}
+
+QAmqpFieldTable::QAmqpFieldTable()
+    : valid_(true)
+{
+}
+
+QAmqpFieldTable::QAmqpFieldTable(const QByteArray &entries)
+    : entries_(entries),
+      valid_(true)
+{
+    index();
+}
+
+void QAmqpFieldTable::index()
+{
+    QAmqpCodecReader reader(entries_);
+    while (!reader.atEnd()) {
+        const QByteArray key = reader.readShortStringData();
+        const QAmqpMetaType::ValueType type = reader.readValueType();
+        const char *value = reader.position();
+        reader.skipField(type);
+        if (reader.hasError()) {
+            qAmqpFrameDebug() << Q_FUNC_INFO << "malformed field table";
+            valid_ = false;
+            break;
+        }
+
+        Field field;
+        field.key = internKey(key.constData(), key.size());
+        field.type = type;
+        field.offset = int(value - entries_.constData());
+        field.size = int(reader.position() - value);
+        fields_.append(field);
+    }
+}
+
+bool QAmqpFieldTable::isValid() const
+{
+    return valid_;
+}
+
+bool QAmqpFieldTable::isEmpty() const
+{
+    return fields_.isEmpty();
+}
+
+int QAmqpFieldTable::size() const
+{
+    return fields_.size();
+}
+
+const QAmqpFieldTable::Field &QAmqpFieldTable::at(int index) const
+{
+    return fields_.at(index);
+}
+
+int QAmqpFieldTable::indexOf(const QString &key) const
+{
+    // the last occurrence of a key wins, as it does when converting to a hash
+    for (int i = fields_.size() - 1; i >= 0; --i) {
+        if (fields_.at(i).key == key)
+            return i;
+    }
+
+    return -1;
+}
+
+QVariant QAmqpFieldTable::value(int index) const
+{
+    const Field &field = fields_.at(index);
+    QAmqpCodecReader reader(entries_.constData() + field.offset, field.size);
+    return reader.readField(field.type);
+}
+
+QVariant QAmqpFieldTable::value(const QString &key, const QVariant &defaultValue) const
+{
+    const int index = indexOf(key);
+    if (index < 0)
+        return defaultValue;
+    return value(index);
+}
+
+const QByteArray &QAmqpFieldTable::entries() const
+{
+    return entries_;
+}
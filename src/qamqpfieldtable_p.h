@@ -0,0 +1,58 @@
+#ifndef QAMQPFIELDTABLE_P_H
+#define QAMQPFIELDTABLE_P_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVariant>
+#include <QVector>
+
+#include "qamqpglobal.h"
+#include "qamqptable.h"
+
+/*!
+ * QAmqpFieldTable is a compact representation of an AMQP field table. The
+ * encoded entries are held in a single backing buffer and indexed by a flat,
+ * insertion-ordered vector of typed fields, values are only decoded when
+ * they are asked for. Keys are interned, so tables sharing the same keys do
+ * not allocate a string per key.
+ */
+class QAmqpFieldTable
+{
+public:
+    struct Field
+    {
+        QString key;
+        QAmqpMetaType::ValueType type;
+        int offset;     // of the value in the backing buffer
+        int size;
+    };
+
+    QAmqpFieldTable();
+
+    // indexes the encoded entries of a table, without its length prefix. The
+    // entries are implicitly shared, not copied, so a raw data view passed
+    // here must outlive the table.
+    explicit QAmqpFieldTable(const QByteArray &entries);
+
+    bool isValid() const;
+    bool isEmpty() const;
+    int size() const;
+    const Field &at(int index) const;
+    int indexOf(const QString &key) const;
+    QVariant value(int index) const;
+    QVariant value(const QString &key, const QVariant &defaultValue = QVariant()) const;
+
+    // the encoded entries, without the length prefix
+    const QByteArray &entries() const;
+
+private:
+    void index();
+
+    QByteArray entries_;
+    QVector<Field> fields_;
+    bool valid_;
+};
+
+Q_DECLARE_TYPEINFO(QAmqpFieldTable::Field, Q_MOVABLE_TYPE);
+
+#endif // QAMQPFIELDTABLE_P_H
@@ -1,14 +1,14 @@
 #include <QDateTime>
 #include <QList>
+#include <QtEndian>
 #include <QDebug>
 
 #include "qamqptable.h"
 #include "qamqpglobal.h"
+#include "qamqpcodec_p.h"
+#include "qamqplogging_p.h"
 #include "qamqpframe_p.h"
 
-QReadWriteLock QAmqpFrame::lock_;
-int QAmqpFrame::writeTimeout_ = 1000;
-
 QAmqpFrame::QAmqpFrame(FrameType type)
     : size_(0),
       type_(type),
@@ -30,18 +30,6 @@ void QAmqpFrame::setChannel(quint16 channel)
     channel_ = channel;
 }
 
-int QAmqpFrame::writeTimeout()
-{
-    QReadLocker locker(&lock_);
-    return writeTimeout_;
-}
-
-void QAmqpFrame::setWriteTimeout(int msecs)
-{
-    QWriteLocker locker(&lock_);
-    writeTimeout_ = msecs;
-}
-
 quint16 QAmqpFrame::channel() const
 {
     return channel_;
@@ -52,44 +40,32 @@ qint32 QAmqpFrame::size() const
     return 0;
 }
 
-/*
-void QAmqpFrame::readEnd(QDataStream &stream)
+void QAmqpFrame::encode(QAmqpCodecWriter &writer) const
 {
-    unsigned char end_  = 0;
-    stream.readRawData(reinterpret_cast<char*>(&end_), sizeof(end_));
-    if (end_ != FRAME_END)
-        qAmqpDebug("Wrong end of frame");
+    writeFrameHeader(writer, FrameType(type_), channel_, size());
+    writePayload(writer);
+    writeFrameEnd(writer);
 }
-*/
 
-QDataStream &operator<<(QDataStream &stream, const QAmqpFrame &frame)
+void QAmqpFrame::writeFrameHeader(QAmqpCodecWriter &writer, FrameType type,
+                                  quint16 channel, qint32 size)
 {
-    // write header
-    stream << frame.type_;
-    stream << frame.channel_;
-    stream << frame.size();
-
-    frame.writePayload(stream);
-
-    // write end
-    stream << qint8(QAmqpFrame::FRAME_END);
-    
-    int writeTimeout = QAmqpFrame::writeTimeout();
-    if(writeTimeout >= -1)
-    {
-        stream.device()->waitForBytesWritten(writeTimeout);
-    }
+    writer.writeOctet(quint8(type));
+    writer.writeShort(channel);
+    writer.writeLong(quint32(size));
+}
 
-    return stream;
+void QAmqpFrame::writeFrameEnd(QAmqpCodecWriter &writer)
+{
+    writer.writeOctet(FRAME_END);
 }
 
-QDataStream &operator>>(QDataStream &stream, QAmqpFrame &frame)
+bool QAmqpFrame::decode(const char *data)
 {
-    stream >> frame.type_;
-    stream >> frame.channel_;
-    stream >> frame.size_;
-    frame.readPayload(stream);
-    return stream;
+    type_ = qint8(data[0]);
+    channel_ = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(data + 1));
+    size_ = qFromBigEndian<qint32>(reinterpret_cast<const uchar*>(data + 3));
+    return readPayload(data + HEADER_SIZE, size_);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -128,164 +104,77 @@ void QAmqpMethodFrame::setArguments(const QByteArray &data)
     arguments_ = data;
 }
 
-QByteArray QAmqpMethodFrame::arguments() const
+const QByteArray &QAmqpMethodFrame::arguments() const
 {
     return arguments_;
 }
 
-void QAmqpMethodFrame::readPayload(QDataStream &stream)
+bool QAmqpMethodFrame::readPayload(const char *data, qint32 size)
 {
-    stream >> methodClass_;
-    stream >> id_;
+    const qint32 headerSize = sizeof(id_) + sizeof(methodClass_);
+    if (Q_UNLIKELY(size < headerSize)) {
+        qAmqpFrameDebug() << Q_FUNC_INFO << "method frame too short: " << size;
+        return false;
+    }
 
-    arguments_.resize(size_ - (sizeof(id_) + sizeof(methodClass_)));
-    stream.readRawData(arguments_.data(), arguments_.size());
-}
+    methodClass_ = qFromBigEndian<qint16>(reinterpret_cast<const uchar*>(data));
+    id_ = qFromBigEndian<qint16>(reinterpret_cast<const uchar*>(data + 2));
 
-void QAmqpMethodFrame::writePayload(QDataStream &stream) const
-{
-    stream << quint16(methodClass_);
-    stream << quint16(id_);
-    stream.writeRawData(arguments_.data(), arguments_.size());
+    // arguments reference the read buffer, they are only valid during dispatch
+    arguments_ = QByteArray::fromRawData(data + headerSize, size - headerSize);
+    return true;
 }
 
-//////////////////////////////////////////////////////////////////////////
-
-QVariant QAmqpFrame::readAmqpField(QDataStream &s, QAmqpMetaType::ValueType type)
+void QAmqpMethodFrame::writePayload(QAmqpCodecWriter &writer) const
 {
-    switch (type) {
-    case QAmqpMetaType::Boolean:
-    {
-        quint8 octet = 0;
-        s >> octet;
-        return QVariant::fromValue<bool>(octet > 0);
-    }
-    case QAmqpMetaType::ShortShortUint:
-    {
-        quint8 octet = 0;
-        s >> octet;
-        return QVariant::fromValue<int>(octet);
-    }
-    case QAmqpMetaType::ShortUint:
-    {
-        quint16 tmp_value = 0;
-        s >> tmp_value;
-        return QVariant::fromValue<uint>(tmp_value);
-    }
-    case QAmqpMetaType::LongUint:
-    {
-        quint32 tmp_value = 0;
-        s >> tmp_value;
-        return QVariant::fromValue<uint>(tmp_value);
-    }
-    case QAmqpMetaType::LongLongUint:
-    {
-        qulonglong v = 0 ;
-        s >> v;
-        return v;
-    }
-    case QAmqpMetaType::ShortString:
-    {
-        qint8 size = 0;
-        QByteArray buffer;
-
-        s >> size;
-        buffer.resize(size);
-        s.readRawData(buffer.data(), buffer.size());
-        return QString::fromLatin1(buffer.data(), size);
-    }
-    case QAmqpMetaType::LongString:
-    {
-        quint32 size = 0;
-        QByteArray buffer;
-
-        s >> size;
-        buffer.resize(size);
-        s.readRawData(buffer.data(), buffer.size());
-        return QString::fromUtf8(buffer.data(), buffer.size());
-    }
-    case QAmqpMetaType::Timestamp:
-    {
-        qulonglong tmp_value;
-        s >> tmp_value;
-        return QDateTime::fromTime_t(tmp_value);
-    }
-    case QAmqpMetaType::Hash:
-    {
-        QAmqpTable table;
-        s >> table;
-        return table;
-    }
-    case QAmqpMetaType::Void:
-        return QVariant();
-    default:
-        qAmqpDebug() << Q_FUNC_INFO << "unsupported value type: " << type;
-    }
-
-    return QVariant();
-}
-
-void QAmqpFrame::writeAmqpField(QDataStream &s, QAmqpMetaType::ValueType type, const QVariant &value)
-{
-    switch (type) {
-    case QAmqpMetaType::Boolean:
-        s << (value.toBool() ? qint8(1) : qint8(0));
-        break;
-    case QAmqpMetaType::ShortShortUint:
-        s << qint8(value.toUInt());
-        break;
-    case QAmqpMetaType::ShortUint:
-        s << quint16(value.toUInt());
-        break;
-    case QAmqpMetaType::LongUint:
-        s << quint32(value.toUInt());
-        break;
-    case QAmqpMetaType::LongLongUint:
-        s << qulonglong(value.toULongLong());
-        break;
-    case QAmqpMetaType::ShortString:
-    {
-        QString str = value.toString();
-        if (str.length() >= 256) {
-            qAmqpDebug() << Q_FUNC_INFO << "invalid shortstr length: " << str.length();
-        }
-
-        s << quint8(str.length());
-        s.writeRawData(str.toUtf8().data(), str.length());
-    }
-        break;
-    case QAmqpMetaType::LongString:
-    {
-        QString str = value.toString();
-        s << quint32(str.length());
-        s.writeRawData(str.toLatin1().data(), str.length());
-    }
-        break;
-    case QAmqpMetaType::Timestamp:
-        s << qulonglong(value.toDateTime().toTime_t());
-        break;
-    case QAmqpMetaType::Hash:
-    {
-        QAmqpTable table(value.toHash());
-        s << table;
-    }
-        break;
-    default:
-        qAmqpDebug() << Q_FUNC_INFO << "unsupported value type: " << type;
-    }
+    writer.writeShort(quint16(methodClass_));
+    writer.writeShort(quint16(id_));
+    writer.writeRawData(arguments_);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
+// basic properties in the order they appear in an encoded content header
+struct ContentProperty
+{
+    QAmqpMessage::Property property;
+    QAmqpMetaType::ValueType type;
+};
+
+static const ContentProperty contentProperties[] = {
+    { QAmqpMessage::ContentType, QAmqpMetaType::ShortString },
+    { QAmqpMessage::ContentEncoding, QAmqpMetaType::ShortString },
+    { QAmqpMessage::Headers, QAmqpMetaType::Hash },
+    { QAmqpMessage::DeliveryMode, QAmqpMetaType::ShortShortUint },
+    { QAmqpMessage::Priority, QAmqpMetaType::ShortShortUint },
+    { QAmqpMessage::CorrelationId, QAmqpMetaType::ShortString },
+    { QAmqpMessage::ReplyTo, QAmqpMetaType::ShortString },
+    { QAmqpMessage::Expiration, QAmqpMetaType::ShortString },
+    { QAmqpMessage::MessageId, QAmqpMetaType::ShortString },
+    { QAmqpMessage::Timestamp, QAmqpMetaType::Timestamp },
+    { QAmqpMessage::Type, QAmqpMetaType::ShortString },
+    { QAmqpMessage::UserId, QAmqpMetaType::ShortString },
+    { QAmqpMessage::AppId, QAmqpMetaType::ShortString },
+    { QAmqpMessage::ClusterID, QAmqpMetaType::ShortString }
+};
+static const int contentPropertyCount = sizeof(contentProperties) / sizeof(contentProperties[0]);
+
 QAmqpContentFrame::QAmqpContentFrame()
-    : QAmqpFrame(QAmqpFrame::Header)
+    : QAmqpFrame(QAmqpFrame::Header),
+      methodClass_(0),
+      id_(0),
+      encoded_(false),
+      bodySize_(0)
 {
 }
 
 QAmqpContentFrame::QAmqpContentFrame(QAmqpFrame::MethodClass methodClass)
-    : QAmqpFrame(QAmqpFrame::Header)
+    : QAmqpFrame(QAmqpFrame::Header),
+      methodClass_(methodClass),
+      id_(0),
+      encoded_(false),
+      bodySize_(0)
 {
-    methodClass_ = methodClass;
 }
 
 QAmqpFrame::MethodClass QAmqpContentFrame::methodClass() const
@@ -295,60 +184,31 @@ QAmqpFrame::MethodClass QAmqpContentFrame::methodClass() const
 
 qint32 QAmqpContentFrame::size() const
 {
-    QDataStream out(&buffer_, QIODevice::WriteOnly);
+    if (!encoded_)
+        encodeHeader();
+    return buffer_.size();
+}
+
+void QAmqpContentFrame::encodeHeader() const
+{
     buffer_.clear();
-    out << qint16(methodClass_);
-    out << qint16(0); //weight
-    out << qlonglong(bodySize_);
+    QAmqpCodecWriter out(&buffer_);
+    out.writeShort(quint16(methodClass_));
+    out.writeShort(0); //weight
+    out.writeLongLong(quint64(bodySize_));
 
     qint16 prop_ = 0;
     foreach (int p, properties_.keys())
         prop_ |= p;
-    out << prop_;
-
-    if (prop_ & QAmqpMessage::ContentType)
-        writeAmqpField(out, QAmqpMetaType::ShortString, properties_[QAmqpMessage::ContentType]);
-
-    if (prop_ & QAmqpMessage::ContentEncoding)
-        writeAmqpField(out, QAmqpMetaType::ShortString, properties_[QAmqpMessage::ContentEncoding]);
-
-    if (prop_ & QAmqpMessage::Headers)
-        writeAmqpField(out, QAmqpMetaType::Hash, properties_[QAmqpMessage::Headers]);
-
-    if (prop_ & QAmqpMessage::DeliveryMode)
-        writeAmqpField(out, QAmqpMetaType::ShortShortUint, properties_[QAmqpMessage::DeliveryMode]);
-
-    if (prop_ & QAmqpMessage::Priority)
-        writeAmqpField(out, QAmqpMetaType::ShortShortUint, properties_[QAmqpMessage::Priority]);
-
-    if (prop_ & QAmqpMessage::CorrelationId)
-        writeAmqpField(out, QAmqpMetaType::ShortString, properties_[QAmqpMessage::CorrelationId]);
-
-    if (prop_ & QAmqpMessage::ReplyTo)
-        writeAmqpField(out, QAmqpMetaType::ShortString, properties_[QAmqpMessage::ReplyTo]);
+    out.writeShort(quint16(prop_));
 
-    if (prop_ & QAmqpMessage::Expiration)
-        writeAmqpField(out, QAmqpMetaType::ShortString, properties_[QAmqpMessage::Expiration]);
-
-    if (prop_ & QAmqpMessage::MessageId)
-        writeAmqpField(out, QAmqpMetaType::ShortString, properties_[QAmqpMessage::MessageId]);
-
-    if (prop_ & QAmqpMessage::Timestamp)
-        writeAmqpField(out, QAmqpMetaType::Timestamp, properties_[QAmqpMessage::Timestamp]);
-
-    if (prop_ & QAmqpMessage::Type)
-        writeAmqpField(out, QAmqpMetaType::ShortString, properties_[QAmqpMessage::Type]);
-
-    if (prop_ & QAmqpMessage::UserId)
-        writeAmqpField(out, QAmqpMetaType::ShortString, properties_[QAmqpMessage::UserId]);
-
-    if (prop_ & QAmqpMessage::AppId)
-        writeAmqpField(out, QAmqpMetaType::ShortString, properties_[QAmqpMessage::AppId]);
-
-    if (prop_ & QAmqpMessage::ClusterID)
-        writeAmqpField(out, QAmqpMetaType::ShortString, properties_[QAmqpMessage::ClusterID]);
+    for (int i = 0; i < contentPropertyCount; ++i) {
+        const ContentProperty &property = contentProperties[i];
+        if (prop_ & property.property)
+            out.writeField(property.type, properties_[property.property]);
+    }
 
-    return buffer_.size();
+    encoded_ = true;
 }
 
 qlonglong QAmqpContentFrame::bodySize() const
@@ -359,71 +219,135 @@ qlonglong QAmqpContentFrame::bodySize() const
 void QAmqpContentFrame::setBodySize(qlonglong size)
 {
     bodySize_ = size;
+    encoded_ = false;
 }
 
 void QAmqpContentFrame::setProperty(QAmqpMessage::Property prop, const QVariant &value)
 {
     properties_[prop] = value;
+    encoded_ = false;
 }
 
 QVariant QAmqpContentFrame::property(QAmqpMessage::Property prop) const
 {
+    // inbound frames only hold the encoded header
+    if (properties_.isEmpty() && encoded_)
+        return decodeProperty(buffer_, prop);
     return properties_.value(prop);
 }
 
-void QAmqpContentFrame::writePayload(QDataStream &out) const
+void QAmqpContentFrame::writePayload(QAmqpCodecWriter &writer) const
 {
-    out.writeRawData(buffer_.data(), buffer_.size());
+    if (!encoded_)
+        encodeHeader();
+    writer.writeRawData(buffer_);
 }
 
-void QAmqpContentFrame::readPayload(QDataStream &in)
+bool QAmqpContentFrame::readPayload(const char *data, qint32 size)
 {
-    in >> methodClass_;
-    in.skipRawData(2); //weight
-    in >> bodySize_;
-    qint16 flags_ = 0;
-    in >> flags_;
-    if (flags_ & QAmqpMessage::ContentType)
-        properties_[QAmqpMessage::ContentType] = readAmqpField(in, QAmqpMetaType::ShortString);
+    // class-id, weight, body-size and property flags
+    if (Q_UNLIKELY(size < 14)) {
+        qAmqpFrameDebug() << Q_FUNC_INFO << "content header too short: " << size;
+        return false;
+    }
 
-    if (flags_ & QAmqpMessage::ContentEncoding)
-        properties_[QAmqpMessage::ContentEncoding] = readAmqpField(in, QAmqpMetaType::ShortString);
+    // keep the wire bytes, size() must not re-encode what was just decoded
+    buffer_ = QByteArray(data, size);
+    encoded_ = true;
 
-    if (flags_ & QAmqpMessage::Headers)
-        properties_[QAmqpMessage::Headers] = readAmqpField(in, QAmqpMetaType::Hash);
+    // properties are not decoded here, see decodeProperty()
+    properties_.clear();
 
-    if (flags_ & QAmqpMessage::DeliveryMode)
-        properties_[QAmqpMessage::DeliveryMode] = readAmqpField(in, QAmqpMetaType::ShortShortUint);
+    QAmqpCodecReader in(data, size);
+    methodClass_ = qint16(in.readShort());
+    in.skip(2); //weight
+    bodySize_ = qlonglong(in.readLongLong());
+    return true;
+}
 
-    if (flags_ & QAmqpMessage::Priority)
-        properties_[QAmqpMessage::Priority] = readAmqpField(in, QAmqpMetaType::ShortShortUint);
+QByteArray QAmqpContentFrame::encodedHeader() const
+{
+    if (!encoded_)
+        encodeHeader();
+    return buffer_;
+}
 
-    if (flags_ & QAmqpMessage::CorrelationId)
-        properties_[QAmqpMessage::CorrelationId] = readAmqpField(in, QAmqpMetaType::ShortString);
+void QAmqpContentFrame::writeMergedHeader(QAmqpCodecWriter &writer, const QByteArray &header,
+                                          qlonglong bodySize, const QAmqpMessage::PropertyHash &properties)
+{
+    QAmqpCodecReader reader(header);
+    writer.writeRawData(header.constData(), 4);     // class-id, weight
+    reader.skip(12);
+    writer.writeLongLong(quint64(bodySize));
 
-    if (flags_ & QAmqpMessage::ReplyTo)
-        properties_[QAmqpMessage::ReplyTo] = readAmqpField(in, QAmqpMetaType::ShortString);
+    const quint16 flags = reader.readShort();
+    quint16 mergedFlags = flags;
+    QAmqpMessage::PropertyHash::ConstIterator it;
+    QAmqpMessage::PropertyHash::ConstIterator itEnd = properties.constEnd();
+    for (it = properties.constBegin(); it != itEnd; ++it)
+        mergedFlags |= it.key();
+    writer.writeShort(mergedFlags);
 
-    if (flags_ & QAmqpMessage::Expiration)
-        properties_[QAmqpMessage::Expiration] = readAmqpField(in, QAmqpMetaType::ShortString);
+    for (int i = 0; i < contentPropertyCount; ++i) {
+        const ContentProperty &entry = contentProperties[i];
+        const char *encoded = reader.position();
+        if (flags & entry.property)
+            reader.skipField(entry.type);
+
+        it = properties.constFind(entry.property);
+        if (it != itEnd)
+            writer.writeField(entry.type, it.value());
+        else
+            writer.writeRawData(encoded, int(reader.position() - encoded));
+    }
+}
 
-    if (flags_ & QAmqpMessage::MessageId)
-        properties_[QAmqpMessage::MessageId] = readAmqpField(in, QAmqpMetaType::ShortString);
+bool QAmqpContentFrame::seekProperty(QAmqpCodecReader &reader, QAmqpMessage::Property property)
+{
+    reader.skip(12);    // class-id, weight, body-size
+    const quint16 flags = reader.readShort();
+    if (!(flags & property))
+        return false;
 
-    if (flags_ & QAmqpMessage::Timestamp)
-        properties_[QAmqpMessage::Timestamp] = readAmqpField(in, QAmqpMetaType::Timestamp);
+    for (int i = 0; i < contentPropertyCount && !reader.hasError(); ++i) {
+        const ContentProperty &entry = contentProperties[i];
+        if (entry.property == property)
+            return true;
 
-    if (flags_ & QAmqpMessage::Type)
-        properties_[QAmqpMessage::Type] = readAmqpField(in, QAmqpMetaType::ShortString);
+        if (flags & entry.property)
+            reader.skipField(entry.type);
+    }
 
-    if (flags_ & QAmqpMessage::UserId)
-        properties_[QAmqpMessage::UserId] = readAmqpField(in, QAmqpMetaType::ShortString);
+    return false;
+}
 
-    if (flags_ & QAmqpMessage::AppId)
-        properties_[QAmqpMessage::AppId] = readAmqpField(in, QAmqpMetaType::ShortString);
+QVariant QAmqpContentFrame::decodeProperty(const QByteArray &header, QAmqpMessage::Property property)
+{
+    QAmqpCodecReader reader(header);
+    if (!seekProperty(reader, property))
+        return QVariant();
+
+    for (int i = 0; i < contentPropertyCount; ++i) {
+        if (contentProperties[i].property == property)
+            return reader.readField(contentProperties[i].type);
+    }
+
+    return QVariant();
+}
+
+QAmqpMessage::PropertyHash QAmqpContentFrame::decodeProperties(const QByteArray &header)
+{
+    QAmqpMessage::PropertyHash properties;
+    QAmqpCodecReader reader(header);
+    reader.skip(12);    // class-id, weight, body-size
+    const quint16 flags = reader.readShort();
+    for (int i = 0; i < contentPropertyCount && !reader.hasError(); ++i) {
+        const ContentProperty &entry = contentProperties[i];
+        if (flags & entry.property)
+            properties[entry.property] = reader.readField(entry.type);
+    }
 
-    if (flags_ & QAmqpMessage::ClusterID)
-        properties_[QAmqpMessage::ClusterID] = readAmqpField(in, QAmqpMetaType::ShortString);
+    return properties;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -438,20 +362,21 @@ void QAmqpContentBodyFrame::setBody(const QByteArray &data)
     body_ = data;
 }
 
-QByteArray QAmqpContentBodyFrame::body() const
+const QByteArray &QAmqpContentBodyFrame::body() const
 {
     return body_;
 }
 
-void QAmqpContentBodyFrame::writePayload(QDataStream &out) const
+void QAmqpContentBodyFrame::writePayload(QAmqpCodecWriter &writer) const
 {
-    out.writeRawData(body_.data(), body_.size());
+    writer.writeRawData(body_);
 }
 
-void QAmqpContentBodyFrame::readPayload(QDataStream &in)
+bool QAmqpContentBodyFrame::readPayload(const char *data, qint32 size)
 {
-    body_.resize(size_);
-    in.readRawData(body_.data(), body_.size());
+    // the body references the read buffer, it is only valid during dispatch
+    body_ = QByteArray::fromRawData(data, size);
+    return true;
 }
 
 qint32 QAmqpContentBodyFrame::size() const
@@ -466,12 +391,14 @@ QAmqpHeartbeatFrame::QAmqpHeartbeatFrame()
 {
 }
 
-void QAmqpHeartbeatFrame::readPayload(QDataStream &stream)
+bool QAmqpHeartbeatFrame::readPayload(const char *data, qint32 size)
 {
-    Q_UNUSED(stream)
+    Q_UNUSED(data)
+    Q_UNUSED(size)
+    return true;
 }
 
-void QAmqpHeartbeatFrame::writePayload(QDataStream &stream) const
+void QAmqpHeartbeatFrame::writePayload(QAmqpCodecWriter &writer) const
 {
-    Q_UNUSED(stream)
+    Q_UNUSED(writer)
 }
@@ -1,15 +1,14 @@
 #ifndef QAMQPFRAME_P_H
 #define QAMQPFRAME_P_H
 
-#include <QDataStream>
-#include <QReadWriteLock>
 #include <QHash>
 #include <QVariant>
 
 #include "qamqpglobal.h"
 #include "qamqpmessage.h"
 
-class QAmqpFramePrivate;
+class QAmqpCodecReader;
+class QAmqpCodecWriter;
 class QAmqpFrame
 {
 public:
@@ -43,35 +42,34 @@ public:
     quint16 channel() const;
     void setChannel(quint16 channel);
 
-    static int writeTimeout();
-    static void setWriteTimeout(int msecs);
-
     virtual qint32 size() const;
 
-    static QVariant readAmqpField(QDataStream &s, QAmqpMetaType::ValueType type);
-    static void writeAmqpField(QDataStream &s, QAmqpMetaType::ValueType type, const QVariant &value);
+    // decodes a complete frame (header, payload and frame-end octet). Payload
+    // data may be referenced rather than copied, so data must stay valid for
+    // as long as the frame is in use. Returns false if the payload is
+    // malformed, the frame must not be dispatched then.
+    bool decode(const char *data);
+
+    // encodes the complete frame, appending it to the writer's buffer
+    void encode(QAmqpCodecWriter &writer) const;
+
+    // for callers serializing frames in place without a frame object
+    static void writeFrameHeader(QAmqpCodecWriter &writer, FrameType type,
+                                 quint16 channel, qint32 size);
+    static void writeFrameEnd(QAmqpCodecWriter &writer);
 
 protected:
     explicit QAmqpFrame(FrameType type);
-    virtual void writePayload(QDataStream &stream) const = 0;
-    virtual void readPayload(QDataStream &stream) = 0;
+    virtual void writePayload(QAmqpCodecWriter &writer) const = 0;
+    virtual bool readPayload(const char *data, qint32 size) = 0;
 
     qint32 size_;
 
 private:
     qint8 type_;
     quint16 channel_;
-
-    static QReadWriteLock lock_;
-    static int writeTimeout_;
-
-    friend QDataStream &operator<<(QDataStream &stream, const QAmqpFrame &frame);
-    friend QDataStream &operator>>(QDataStream &stream, QAmqpFrame &frame);
 };
 
-QDataStream &operator<<(QDataStream &, const QAmqpFrame &frame);
-QDataStream &operator>>(QDataStream &, QAmqpFrame &frame);
-
 class QAMQP_EXPORT QAmqpMethodFrame : public QAmqpFrame
 {
 public:
@@ -83,12 +81,12 @@ public:
 
     virtual qint32 size() const;
 
-    QByteArray arguments() const;
+    const QByteArray &arguments() const;
     void setArguments(const QByteArray &data);
 
 private:
-    void writePayload(QDataStream &stream) const;
-    void readPayload(QDataStream &stream);
+    void writePayload(QAmqpCodecWriter &writer) const;
+    bool readPayload(const char *data, qint32 size);
 
     short methodClass_;
     qint16 id_;
@@ -111,14 +109,32 @@ public:
     qlonglong bodySize() const;
     void setBodySize(qlonglong size);
 
+    // the encoded payload of the header, from class-id through the properties
+    QByteArray encodedHeader() const;
+
+    // writes an encoded header payload with the body size replaced and the
+    // given properties merged in, without re-encoding the rest of it
+    static void writeMergedHeader(QAmqpCodecWriter &writer, const QByteArray &header,
+                                  qlonglong bodySize, const QAmqpMessage::PropertyHash &properties);
+
+    // lazy access to the properties of an encoded content header
+    static bool seekProperty(QAmqpCodecReader &reader, QAmqpMessage::Property property);
+    static QVariant decodeProperty(const QByteArray &header, QAmqpMessage::Property property);
+    static QAmqpMessage::PropertyHash decodeProperties(const QByteArray &header);
+
 private:
-    void writePayload(QDataStream &stream) const;
-    void readPayload(QDataStream &stream);
+    void writePayload(QAmqpCodecWriter &writer) const;
+    bool readPayload(const char *data, qint32 size);
+    void encodeHeader() const;
     friend class QAmqpQueuePrivate;
 
     short methodClass_;
     qint16 id_;
+
+    // the encoded header, built at most once per change for outbound frames
+    // and holding the wire bytes for inbound frames
     mutable QByteArray buffer_;
+    mutable bool encoded_;
     QAmqpMessage::PropertyHash properties_;
     qlonglong bodySize_;
 };
@@ -129,13 +145,13 @@ public:
     QAmqpContentBodyFrame();
 
     void setBody(const QByteArray &data);
-    QByteArray body() const;
+    const QByteArray &body() const;
 
     virtual qint32 size() const;
 
 private:
-    void writePayload(QDataStream &stream) const;
-    void readPayload(QDataStream &stream);
+    void writePayload(QAmqpCodecWriter &writer) const;
+    bool readPayload(const char *data, qint32 size);
 
     QByteArray body_;
 };
@@ -146,8 +162,8 @@ public:
     QAmqpHeartbeatFrame();
 
 private:
-    void writePayload(QDataStream &stream) const;
-    void readPayload(QDataStream &stream);
+    void writePayload(QAmqpCodecWriter &writer) const;
+    bool readPayload(const char *data, qint32 size);
 };
 
 class QAmqpMethodFrameHandler
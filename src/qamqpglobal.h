@@ -32,6 +32,10 @@
 #define AMQP_FRAME_MAX 131072
 #define AMQP_FRAME_MIN_SIZE 4096
 
+#define AMQP_WRITE_BUFFER_FLUSH_SIZE 65536
+#define AMQP_WRITE_BUFFER_LOW_WATERMARK (1024 * 1024)
+#define AMQP_WRITE_BUFFER_HIGH_WATERMARK (4 * 1024 * 1024)
+
 #define AMQP_BASIC_CONTENT_TYPE_FLAG (1 << 15)
 #define AMQP_BASIC_CONTENT_ENCODING_FLAG (1 << 14)
 #define AMQP_BASIC_HEADERS_FLAG (1 << 13)
@@ -61,7 +65,14 @@
 #   define QAMQP_EXPORT
 #endif
 
-#define qAmqpDebug if (qgetenv("QAMQP_DEBUG").isEmpty()); else qDebug
+// QAMQP_DEBUG is only looked up once, the library logs through categories
+inline bool qAmqpDebugEnabled()
+{
+    static const bool enabled = !qgetenv("QAMQP_DEBUG").isEmpty();
+    return enabled;
+}
+
+#define qAmqpDebug if (!qAmqpDebugEnabled()); else qDebug
 
 namespace QAmqpMetaType {
 
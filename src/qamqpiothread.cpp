@@ -0,0 +1,292 @@
+#include <QMutexLocker>
+#include <QSslSocket>
+#include <QTimer>
+#include <QtEndian>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "qamqpcodec_p.h"
+#include "qamqpframe_p.h"
+#include "qamqpiothread_p.h"
+#include "qamqplogging_p.h"
+
+QAmqpIoWorker::QAmqpIoWorker()
+    : socket_(0),
+      heartbeatTimer_(0),
+      framesNotified_(0),
+      flushScheduled_(0),
+      state_(QAbstractSocket::UnconnectedState),
+      error_(QAbstractSocket::UnknownSocketError),
+      frameMax_(AMQP_FRAME_MAX),
+      pendingBytes_(0)
+{
+}
+
+QAmqpIoWorker::~QAmqpIoWorker()
+{
+}
+
+/*!
+ * Creates the socket and the heartbeat timer, this runs on the I/O thread
+ * so both belong to it.
+ */
+void QAmqpIoWorker::init(int cpu)
+{
+    if (cpu >= 0)
+        setAffinity(cpu);
+
+    socket_ = new QSslSocket(this);
+    socket_->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    socket_->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    connect(socket_, SIGNAL(readyRead()), this, SLOT(_q_readyRead()));
+    connect(socket_, SIGNAL(bytesWritten(qint64)), this, SLOT(_q_bytesWritten(qint64)));
+    connect(socket_, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
+            this, SLOT(_q_stateChanged(QAbstractSocket::SocketState)));
+    connect(socket_, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(_q_error(QAbstractSocket::SocketError)));
+
+    heartbeatTimer_ = new QTimer(this);
+    connect(heartbeatTimer_, SIGNAL(timeout()), this, SLOT(_q_heartbeat()));
+
+    QMutexLocker locker(&mutex_);
+    sslConfiguration_ = socket_->sslConfiguration();
+}
+
+void QAmqpIoWorker::setAffinity(int cpu)
+{
+#ifdef Q_OS_LINUX
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "unable to pin the I/O thread to cpu" << cpu;
+#else
+    qAmqpConnectionDebug() << Q_FUNC_INFO << "I/O thread affinity is not supported on this platform";
+    Q_UNUSED(cpu)
+#endif
+}
+
+QSslSocket *QAmqpIoWorker::socket() const
+{
+    return socket_;
+}
+
+void QAmqpIoWorker::write(const QByteArray &data)
+{
+    pendingBytes_.fetchAndAddOrdered(data.size());
+    outbound_.enqueue(data);
+    if (flushScheduled_.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "_q_flush", Qt::QueuedConnection);
+}
+
+bool QAmqpIoWorker::takeFrames(QByteArray *frames)
+{
+    if (inbound_.dequeue(frames))
+        return true;
+
+    // re-arm the notification, then look again for frames queued meanwhile
+    framesNotified_.fetchAndStoreOrdered(0);
+    return inbound_.dequeue(frames);
+}
+
+QAbstractSocket::SocketState QAmqpIoWorker::state() const
+{
+    return QAbstractSocket::SocketState(qAmqpLoadAcquire(state_));
+}
+
+QAbstractSocket::SocketError QAmqpIoWorker::error() const
+{
+    return QAbstractSocket::SocketError(qAmqpLoadAcquire(error_));
+}
+
+QString QAmqpIoWorker::errorString() const
+{
+    QMutexLocker locker(&mutex_);
+    return errorString_;
+}
+
+qint64 QAmqpIoWorker::bytesToWrite() const
+{
+    return qAmqpLoadAcquire(pendingBytes_);
+}
+
+void QAmqpIoWorker::setFrameMax(qint32 frameMax)
+{
+    frameMax_.fetchAndStoreRelease(frameMax);
+}
+
+QSslConfiguration QAmqpIoWorker::sslConfiguration() const
+{
+    QMutexLocker locker(&mutex_);
+    return sslConfiguration_;
+}
+
+void QAmqpIoWorker::setSslConfiguration(const QSslConfiguration &config)
+{
+    // applied by connectToHost() on the I/O thread
+    QMutexLocker locker(&mutex_);
+    sslConfiguration_ = config;
+}
+
+void QAmqpIoWorker::connectToHost(const QString &host, quint16 port, bool useSsl)
+{
+    readBuffer_.clear();
+    error_.fetchAndStoreRelease(QAbstractSocket::UnknownSocketError);
+    if (useSsl) {
+        socket_->setSslConfiguration(sslConfiguration());
+        socket_->connectToHostEncrypted(host, port);
+    } else {
+        socket_->connectToHost(host, port);
+    }
+}
+
+void QAmqpIoWorker::disconnectFromHost()
+{
+    _q_flush();
+    socket_->disconnectFromHost();
+}
+
+void QAmqpIoWorker::abort()
+{
+    // anything not yet written is dropped with the connection
+    QByteArray data;
+    while (outbound_.dequeue(&data))
+        pendingBytes_.fetchAndAddOrdered(-data.size());
+    socket_->abort();
+}
+
+void QAmqpIoWorker::ignoreSslErrors(const QList<QSslError> &errors)
+{
+    socket_->ignoreSslErrors(errors);
+}
+
+void QAmqpIoWorker::startHeartbeat(int msecs)
+{
+    heartbeatTimer_->start(msecs);
+}
+
+void QAmqpIoWorker::stopHeartbeat()
+{
+    heartbeatTimer_->stop();
+}
+
+/*!
+ * Writes out everything queued so far and waits up to msecs for it to be
+ * written, for owners that will not see another event loop turn.
+ */
+void QAmqpIoWorker::flush(int msecs)
+{
+    _q_flush();
+    if (socket_->state() == QAbstractSocket::ConnectedState)
+        socket_->waitForBytesWritten(msecs);
+}
+
+void QAmqpIoWorker::_q_flush()
+{
+    flushScheduled_.fetchAndStoreOrdered(0);
+    QByteArray data;
+    while (outbound_.dequeue(&data))
+        writeOut(data);
+}
+
+void QAmqpIoWorker::writeOut(const QByteArray &data)
+{
+    if (socket_->state() != QAbstractSocket::ConnectedState) {
+        qAmqpConnectionDebug() << Q_FUNC_INFO << "socket not connected, dropping"
+                               << data.size() << "bytes";
+        pendingBytes_.fetchAndAddOrdered(-data.size());
+        return;
+    }
+
+    socket_->write(data);
+}
+
+void QAmqpIoWorker::_q_heartbeat()
+{
+    // a heartbeat only goes between complete frames, queued data is always
+    // made of complete frames so it can be sent right away
+    static const char frame[] = { QAmqpFrame::Heartbeat, 0, 0, 0, 0, 0, 0, char(QAmqpFrame::FRAME_END) };
+    pendingBytes_.fetchAndAddOrdered(sizeof(frame));
+    writeOut(QByteArray::fromRawData(frame, sizeof(frame)));
+}
+
+void QAmqpIoWorker::_q_bytesWritten(qint64 bytes)
+{
+    pendingBytes_.fetchAndAddOrdered(-int(bytes));
+}
+
+void QAmqpIoWorker::_q_stateChanged(QAbstractSocket::SocketState state)
+{
+    state_.fetchAndStoreRelease(state);
+    if (state == QAbstractSocket::UnconnectedState) {
+        heartbeatTimer_->stop();
+        readBuffer_.clear();
+        pendingBytes_.fetchAndStoreRelease(0);
+    }
+}
+
+void QAmqpIoWorker::_q_error(QAbstractSocket::SocketError error)
+{
+    QMutexLocker locker(&mutex_);
+    errorString_ = socket_->errorString();
+    error_.fetchAndStoreRelease(error);
+}
+
+/*!
+ * Reads everything available and hands all complete frames over to the
+ * owner thread as one chunk, keeping a trailing partial frame. Frames are
+ * only checked for their size and end octet here, they are decoded and
+ * dispatched on the owner thread.
+ */
+void QAmqpIoWorker::_q_readyRead()
+{
+    const qint64 available = socket_->bytesAvailable();
+    if (available > 0) {
+        const int oldSize = readBuffer_.size();
+        readBuffer_.resize(oldSize + int(available));
+        const qint64 bytesRead = socket_->read(readBuffer_.data() + oldSize, available);
+        readBuffer_.resize(oldSize + int(qMax(bytesRead, qint64(0))));
+    }
+
+    const qint32 frameMax = qAmqpLoadAcquire(frameMax_);
+    int offset = 0;
+    while (readBuffer_.size() - offset >= QAmqpFrame::HEADER_SIZE) {
+        const char *frameData = readBuffer_.constData() + offset;
+        const quint32 payloadSize =
+            qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(frameData + 3));
+        if (Q_UNLIKELY(frameMax > 0 && payloadSize > quint32(frameMax))) {
+            readBuffer_.clear();
+            Q_EMIT frameError(QAMQP::FrameError, QLatin1String("frame size too large"));
+            return;
+        }
+
+        const int frameSize = QAmqpFrame::HEADER_SIZE + payloadSize + QAmqpFrame::FRAME_END_SIZE;
+        if (readBuffer_.size() - offset < frameSize)
+            break;
+
+        if (Q_UNLIKELY(quint8(frameData[QAmqpFrame::HEADER_SIZE + payloadSize]) != QAmqpFrame::FRAME_END)) {
+            readBuffer_.clear();
+            Q_EMIT frameError(QAMQP::UnexpectedFrameError, QLatin1String("wrong end of frame"));
+            return;
+        }
+
+        offset += frameSize;
+    }
+
+    if (offset == 0)
+        return;
+
+    if (offset == readBuffer_.size()) {
+        inbound_.enqueue(readBuffer_);
+        readBuffer_ = QByteArray();
+    } else {
+        inbound_.enqueue(readBuffer_.left(offset));
+        readBuffer_.remove(0, offset);
+    }
+
+    if (framesNotified_.testAndSetOrdered(0, 1))
+        Q_EMIT framesAvailable();
+}
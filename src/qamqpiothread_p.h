@@ -0,0 +1,229 @@
+#ifndef QAMQPIOTHREAD_P_H
+#define QAMQPIOTHREAD_P_H
+
+#include <QAbstractSocket>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QByteArray>
+#include <QMutex>
+#include <QObject>
+#include <QPointer>
+#include <QSslConfiguration>
+#include <QSslError>
+
+#include "qamqpglobal.h"
+
+class QSslSocket;
+class QTimer;
+
+inline int qAmqpLoadAcquire(const QAtomicInt &value)
+{
+#if QT_VERSION >= 0x050000
+    return value.loadAcquire();
+#else
+    return value;
+#endif
+}
+
+/*!
+ * QAmqpSpscQueue is an unbounded lock-free queue for exactly one producer
+ * thread and one consumer thread.
+ */
+template <typename T>
+class QAmqpSpscQueue
+{
+public:
+    QAmqpSpscQueue()
+        : head_(new Node),
+          tail_(head_)
+    {
+    }
+
+    ~QAmqpSpscQueue()
+    {
+        while (head_) {
+            Node *next = head_->next.fetchAndAddAcquire(0);
+            delete head_;
+            head_ = next;
+        }
+    }
+
+    // producer side
+    void enqueue(const T &value)
+    {
+        Node *node = new Node(value);
+        tail_->next.fetchAndStoreRelease(node);
+        tail_ = node;
+    }
+
+    // consumer side
+    bool dequeue(T *value)
+    {
+        Node *next = head_->next.fetchAndAddAcquire(0);
+        if (!next)
+            return false;
+
+        *value = next->value;
+        next->value = T();
+        delete head_;
+        head_ = next;
+        return true;
+    }
+
+private:
+    struct Node
+    {
+        Node() : next(0) {}
+        explicit Node(const T &v) : value(v), next(0) {}
+
+        T value;
+        QAtomicPointer<Node> next;
+    };
+
+    Node *head_;    // consumer only, the last dequeued node
+    Node *tail_;    // producer only
+    Q_DISABLE_COPY(QAmqpSpscQueue)
+};
+
+/*!
+ * QAmqpMpscQueue is an unbounded lock-free queue for any number of producer
+ * threads and one consumer thread. Values enqueued by one producer are
+ * dequeued in the order they were enqueued.
+ *
+ * A producer is briefly between swapping the head and linking its node,
+ * dequeue() returns false while that is the case even though later nodes
+ * may already be queued. Producers must therefore notify the consumer
+ * after enqueue() returns, not before.
+ */
+template <typename T>
+class QAmqpMpscQueue
+{
+public:
+    QAmqpMpscQueue()
+        : head_(0),
+          tail_(new Node)
+    {
+        head_.fetchAndStoreRelaxed(tail_);
+    }
+
+    ~QAmqpMpscQueue()
+    {
+        while (tail_) {
+            Node *next = tail_->next.fetchAndAddAcquire(0);
+            delete tail_;
+            tail_ = next;
+        }
+    }
+
+    // any thread
+    void enqueue(const T &value)
+    {
+        Node *node = new Node(value);
+        Node *previous = head_.fetchAndStoreOrdered(node);
+        previous->next.fetchAndStoreRelease(node);
+    }
+
+    // consumer side
+    bool dequeue(T *value)
+    {
+        Node *next = tail_->next.fetchAndAddAcquire(0);
+        if (!next)
+            return false;
+
+        *value = next->value;
+        next->value = T();
+        delete tail_;
+        tail_ = next;
+        return true;
+    }
+
+private:
+    struct Node
+    {
+        Node() : next(0) {}
+        explicit Node(const T &v) : value(v), next(0) {}
+
+        T value;
+        QAtomicPointer<Node> next;
+    };
+
+    QAtomicPointer<Node> head_;     // producers, the last enqueued node
+    Node *tail_;                    // consumer only, the last dequeued node
+    Q_DISABLE_COPY(QAmqpMpscQueue)
+};
+
+/*!
+ * QAmqpIoWorker owns the socket of a client running in I/O thread mode and
+ * lives on the I/O thread. It splits inbound data into complete frames,
+ * writes outbound data and sends heartbeats, so none of that waits for the
+ * owner thread. Complete frames are handed to the owner thread in chunks
+ * through an SPSC queue, encoded outbound frames come back the same way.
+ *
+ * Methods marked as owner thread API may be called from the owner thread,
+ * slots are invoked on the I/O thread with queued calls.
+ */
+class QAmqpIoWorker : public QObject
+{
+    Q_OBJECT
+public:
+    QAmqpIoWorker();
+    ~QAmqpIoWorker();
+
+    // owner thread API
+    void write(const QByteArray &data);
+    bool takeFrames(QByteArray *frames);
+    QAbstractSocket::SocketState state() const;
+    QAbstractSocket::SocketError error() const;
+    QString errorString() const;
+    qint64 bytesToWrite() const;
+    void setFrameMax(qint32 frameMax);
+    QSslConfiguration sslConfiguration() const;
+    void setSslConfiguration(const QSslConfiguration &config);
+    QSslSocket *socket() const;
+
+public Q_SLOTS:
+    void init(int cpu);
+    void connectToHost(const QString &host, quint16 port, bool useSsl);
+    void disconnectFromHost();
+    void abort();
+    void ignoreSslErrors(const QList<QSslError> &errors);
+    void startHeartbeat(int msecs);
+    void stopHeartbeat();
+    void flush(int msecs);
+
+Q_SIGNALS:
+    void framesAvailable();
+    void frameError(int code, const QString &text);
+
+private Q_SLOTS:
+    void _q_readyRead();
+    void _q_flush();
+    void _q_bytesWritten(qint64 bytes);
+    void _q_stateChanged(QAbstractSocket::SocketState state);
+    void _q_error(QAbstractSocket::SocketError error);
+    void _q_heartbeat();
+
+private:
+    void writeOut(const QByteArray &data);
+    void setAffinity(int cpu);
+
+    QSslSocket *socket_;
+    QTimer *heartbeatTimer_;
+    QByteArray readBuffer_;
+
+    QAmqpSpscQueue<QByteArray> inbound_;
+    QAmqpSpscQueue<QByteArray> outbound_;
+    QAtomicInt framesNotified_;
+    QAtomicInt flushScheduled_;
+
+    // mirrored socket state, readable from the owner thread
+    QAtomicInt state_;
+    QAtomicInt error_;
+    QAtomicInt frameMax_;
+    QAtomicInt pendingBytes_;
+    mutable QMutex mutex_;
+    QString errorString_;
+    QSslConfiguration sslConfiguration_;
+};
+
+#endif // QAMQPIOTHREAD_P_H
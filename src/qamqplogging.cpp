@@ -0,0 +1,28 @@
+#include "qamqplogging_p.h"
+
+#if !defined(QAMQP_NO_DEBUG) && QT_VERSION >= 0x050400
+
+class QAmqpLoggingCategory : public QLoggingCategory
+{
+public:
+    explicit QAmqpLoggingCategory(const char *category)
+        : QLoggingCategory(category, QtWarningMsg)
+    {
+        if (!qgetenv("QAMQP_DEBUG").isEmpty())
+            setEnabled(QtDebugMsg, true);
+    }
+};
+
+#define QAMQP_LOGGING_CATEGORY(name, category) \
+    const QLoggingCategory &name() \
+    { \
+        static const QAmqpLoggingCategory loggingCategory(category); \
+        return loggingCategory; \
+    }
+
+QAMQP_LOGGING_CATEGORY(qamqpFrame, "qamqp.frame")
+QAMQP_LOGGING_CATEGORY(qamqpConnection, "qamqp.connection")
+QAMQP_LOGGING_CATEGORY(qamqpChannel, "qamqp.channel")
+QAMQP_LOGGING_CATEGORY(qamqpBasic, "qamqp.basic")
+
+#endif
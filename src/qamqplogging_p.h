@@ -0,0 +1,38 @@
+#ifndef QAMQPLOGGING_P_H
+#define QAMQPLOGGING_P_H
+
+#include <QDebug>
+
+#include "qamqpglobal.h"
+
+/*
+ * Debug output is split into the qamqp.frame, qamqp.connection,
+ * qamqp.channel and qamqp.basic logging categories. They are disabled by
+ * default and are enabled either through the usual logging rules or all at
+ * once by setting QAMQP_DEBUG. The environment is only read when a category
+ * is first used. Defining QAMQP_NO_DEBUG compiles the calls out entirely.
+ */
+#if defined(QAMQP_NO_DEBUG)
+#   define QAMQP_CATEGORY_DEBUG(category) if (true); else qDebug
+#elif QT_VERSION >= 0x050400
+#   include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(qamqpFrame)
+Q_DECLARE_LOGGING_CATEGORY(qamqpConnection)
+Q_DECLARE_LOGGING_CATEGORY(qamqpChannel)
+Q_DECLARE_LOGGING_CATEGORY(qamqpBasic)
+
+#   define QAMQP_CATEGORY_DEBUG(category) \
+        if (!category().isDebugEnabled()); else \
+            QMessageLogger(QT_MESSAGELOG_FILE, QT_MESSAGELOG_LINE, QT_MESSAGELOG_FUNC, \
+                           category().categoryName()).debug
+#else
+#   define QAMQP_CATEGORY_DEBUG(category) if (!qAmqpDebugEnabled()); else qDebug
+#endif
+
+#define qAmqpFrameDebug QAMQP_CATEGORY_DEBUG(qamqpFrame)
+#define qAmqpConnectionDebug QAMQP_CATEGORY_DEBUG(qamqpConnection)
+#define qAmqpChannelDebug QAMQP_CATEGORY_DEBUG(qamqpChannel)
+#define qAmqpBasicDebug QAMQP_CATEGORY_DEBUG(qamqpBasic)
+
+#endif // QAMQPLOGGING_P_H
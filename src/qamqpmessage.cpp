@@ -1,14 +1,87 @@
 #include <QHash>
 
+#include "qamqpcodec_p.h"
 #include "qamqpmessage.h"
 #include "qamqpmessage_p.h"
 
 QAmqpMessagePrivate::QAmqpMessagePrivate()
     : deliveryTag(0),
+      redelivered(false),
+      propertiesDecoded(true),
+      headersDecoded(true),
+      headerFieldsIndexed(true),
       leftSize(0)
 {
 }
 
+void QAmqpMessagePrivate::setRawHeader(const QByteArray &header)
+{
+    rawHeader = header;
+    properties.clear();
+    headers.clear();
+    headerFields = QAmqpFieldTable();
+    propertiesDecoded = false;
+    headersDecoded = false;
+    headerFieldsIndexed = false;
+}
+
+void QAmqpMessagePrivate::decodeProperties() const
+{
+    if (propertiesDecoded)
+        return;
+
+    properties = QAmqpContentFrame::decodeProperties(rawHeader);
+    propertiesDecoded = true;
+}
+
+const QAmqpMessage::PropertyHash &QAmqpMessagePrivate::decodedProperties() const
+{
+    decodeProperties();
+    return properties;
+}
+
+const QHash<QString, QVariant> &QAmqpMessagePrivate::decodedHeaders() const
+{
+    decodeHeaders();
+    return headers;
+}
+
+void QAmqpMessagePrivate::decodeHeaders() const
+{
+    if (headersDecoded)
+        return;
+
+    if (propertiesDecoded)
+        headers = properties.value(QAmqpMessage::Headers).toHash();
+    else
+        headers = QAmqpContentFrame::decodeProperty(rawHeader, QAmqpMessage::Headers).toHash();
+    headersDecoded = true;
+}
+
+/*!
+ * Looks up a single header in the encoded headers table without decoding
+ * the rest of the table. The table is indexed on first use.
+ */
+bool QAmqpMessagePrivate::findHeader(const QString &header, QVariant *value) const
+{
+    if (!headerFieldsIndexed) {
+        QAmqpCodecReader reader(rawHeader);
+        if (QAmqpContentFrame::seekProperty(reader, QAmqpMessage::Headers)) {
+            const QByteArray entries = reader.readLongStringData();
+            headerFields = QAmqpFieldTable(QByteArray(entries.constData(), entries.size()));
+        }
+        headerFieldsIndexed = true;
+    }
+
+    const int index = headerFields.indexOf(header);
+    if (index < 0)
+        return false;
+
+    if (value)
+        *value = headerFields.value(index);
+    return true;
+}
+
 //////////////////////////////////////////////////////////////////////////
 
 QAmqpMessage::QAmqpMessage()
@@ -41,8 +114,8 @@ bool QAmqpMessage::operator==(const QAmqpMessage &message) const
             message.d->exchangeName == d->exchangeName &&
             message.d->routingKey == d->routingKey &&
             message.d->payload == d->payload &&
-            message.d->properties == d->properties &&
-            message.d->headers == d->headers &&
+            message.d->decodedProperties() == d->decodedProperties() &&
+            message.d->decodedHeaders() == d->decodedHeaders() &&
             message.d->leftSize == d->leftSize);
 }
 
@@ -80,36 +153,59 @@ QByteArray QAmqpMessage::payload() const
 
 bool QAmqpMessage::hasProperty(Property property) const
 {
+    if (!d->propertiesDecoded) {
+        QAmqpCodecReader reader(d->rawHeader);
+        return QAmqpContentFrame::seekProperty(reader, property);
+    }
+
     return d->properties.contains(property);
 }
 
 void QAmqpMessage::setProperty(Property property, const QVariant &value)
 {
+    d->decodeProperties();
     d->properties.insert(property, value);
 }
 
 QVariant QAmqpMessage::property(Property property, const QVariant &defaultValue) const
 {
+    if (!d->propertiesDecoded) {
+        if (!hasProperty(property))
+            return defaultValue;
+        return QAmqpContentFrame::decodeProperty(d->rawHeader, property);
+    }
+
     return d->properties.value(property, defaultValue);
 }
 
 bool QAmqpMessage::hasHeader(const QString &header) const
 {
+    if (!d->headersDecoded)
+        return d->findHeader(header, 0);
     return d->headers.contains(header);
 }
 
 void QAmqpMessage::setHeader(const QString &header, const QVariant &value)
 {
+    d->decodeHeaders();
     d->headers.insert(header, value);
 }
 
 QVariant QAmqpMessage::header(const QString &header, const QVariant &defaultValue) const
 {
+    if (!d->headersDecoded) {
+        QVariant value;
+        if (!d->findHeader(header, &value))
+            return defaultValue;
+        return value;
+    }
+
     return d->headers.value(header, defaultValue);
 }
 
 QHash<QString, QVariant> QAmqpMessage::headers() const
 {
+    d->decodeHeaders();
     return d->headers;
 }
 
@@ -4,6 +4,7 @@
 #include <QHash>
 #include <QSharedData>
 
+#include "qamqpfieldtable_p.h"
 #include "qamqpframe_p.h"
 #include "qamqpmessage.h"
 
@@ -12,13 +13,28 @@ class QAmqpMessagePrivate : public QSharedData
 public:
     QAmqpMessagePrivate();
 
+    void setRawHeader(const QByteArray &header);
+    void decodeProperties() const;
+    void decodeHeaders() const;
+    const QAmqpMessage::PropertyHash &decodedProperties() const;
+    const QHash<QString, QVariant> &decodedHeaders() const;
+    bool findHeader(const QString &header, QVariant *value) const;
+
     qlonglong deliveryTag;
     bool redelivered;
     QString exchangeName;
     QString routingKey;
     QByteArray payload;
-    QHash<QAmqpMessage::Property, QVariant> properties;
-    QHash<QString, QVariant> headers;
+
+    // received messages keep the encoded content header, properties and
+    // headers are only decoded from it when they are asked for
+    QByteArray rawHeader;
+    mutable bool propertiesDecoded;
+    mutable bool headersDecoded;
+    mutable QHash<QAmqpMessage::Property, QVariant> properties;
+    mutable QHash<QString, QVariant> headers;
+    mutable QAmqpFieldTable headerFields;
+    mutable bool headerFieldsIndexed;
     int leftSize;
 
 };
@@ -0,0 +1,166 @@
+#include <QDebug>
+
+#include "qamqpexchange.h"
+#include "qamqpexchange_p.h"
+#include "qamqplogging_p.h"
+#include "qamqppublisher_p.h"
+#include "qamqppublisher.h"
+
+QAmqpPublisherLink::QAmqpPublisherLink(QAmqpPublisher *publisher)
+    : publisher(publisher),
+      notified(false)
+{
+}
+
+void QAmqpPublisherLink::post(const QVector<qlonglong> &publishIds, bool confirmed)
+{
+    QMutexLocker locker(&mutex);
+    if (!publisher)
+        return;
+
+    results.reserve(results.size() + publishIds.size());
+    foreach (qlonglong publishId, publishIds)
+        results.append(qMakePair(publishId, confirmed));
+
+    if (!notified) {
+        notified = true;
+        QMetaObject::invokeMethod(publisher, "_q_deliverResults", Qt::QueuedConnection);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+QAmqpPublishQueue::QAmqpPublishQueue(QAmqpExchange *exchange)
+    : notified(0),
+      exchange(exchange)
+{
+}
+
+void QAmqpPublishQueue::post(const QAmqpPostedPublish &publish)
+{
+    queue.enqueue(publish);
+    if (!notified.testAndSetOrdered(0, 1))
+        return;
+
+    QMutexLocker locker(&mutex);
+    if (exchange)
+        QMetaObject::invokeMethod(exchange, "_q_drainPublishQueue", Qt::QueuedConnection);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+QAmqpPublisherPrivate::QAmqpPublisherPrivate(QAmqpPublisher *q)
+    : lastPublishId(0),
+      q_ptr(q)
+{
+}
+
+qlonglong QAmqpPublisherPrivate::post(QAmqpPostedPublish &publish)
+{
+    publish.link = link;
+    publish.publishId = ++lastPublishId;
+    queue->post(publish);
+    return publish.publishId;
+}
+
+void QAmqpPublisherPrivate::_q_deliverResults()
+{
+    Q_Q(QAmqpPublisher);
+    QVector<QPair<qlonglong, bool> > results;
+    {
+        QMutexLocker locker(&link->mutex);
+        qSwap(results, link->results);
+        link->notified = false;
+    }
+
+    for (int i = 0; i < results.size(); ++i) {
+        if (results.at(i).second)
+            Q_EMIT q->confirmed(results.at(i).first);
+        else
+            Q_EMIT q->rejected(results.at(i).first);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*!
+ * Creates a publisher for exchange. Unlike QAmqpExchange::publish(), the
+ * publish() methods of a publisher may be called from the thread the
+ * publisher lives in while the exchange lives in another one, messages are
+ * handed over through a lock-free queue and written out in batches on the
+ * exchange's thread. Messages published through one publisher go out in the
+ * order they were published.
+ *
+ * Use one publisher per producing thread and create it while the exchange is
+ * alive. When confirms are enabled on the exchange, confirmed() and
+ * rejected() are emitted on the publisher's thread with the id publish()
+ * returned, messages still unconfirmed when the connection is lost are
+ * reported as rejected.
+ */
+QAmqpPublisher::QAmqpPublisher(QAmqpExchange *exchange, QObject *parent)
+    : QObject(parent),
+      d_ptr(new QAmqpPublisherPrivate(this))
+{
+    Q_D(QAmqpPublisher);
+    d->queue = exchange->d_func()->publishQueue;
+    d->link = QSharedPointer<QAmqpPublisherLink>(new QAmqpPublisherLink(this));
+}
+
+QAmqpPublisher::~QAmqpPublisher()
+{
+    Q_D(QAmqpPublisher);
+    QMutexLocker locker(&d->link->mutex);
+    d->link->publisher = 0;
+}
+
+/*!
+ * Publishes message like QAmqpExchange::publish() and returns the id its
+ * confirm will be reported with.
+ */
+qlonglong QAmqpPublisher::publish(const QByteArray &message, const QString &routingKey,
+                                  const QString &mimeType, const QAmqpMessage::PropertyHash &properties,
+                                  int publishOptions)
+{
+    return publish(message, routingKey, mimeType, QAmqpTable(), properties, publishOptions);
+}
+
+qlonglong QAmqpPublisher::publish(const QByteArray &message, const QString &routingKey,
+                                  const QString &mimeType, const QAmqpTable &headers,
+                                  const QAmqpMessage::PropertyHash &properties, int publishOptions)
+{
+    Q_D(QAmqpPublisher);
+    QAmqpPostedPublish publish;
+    publish.message = message;
+    publish.routingKey = routingKey;
+    publish.publishOptions = publishOptions;
+    publish.properties = properties;
+    if (!publish.properties.contains(QAmqpMessage::ContentType))
+        publish.properties.insert(QAmqpMessage::ContentType, mimeType);
+    if (!publish.properties.contains(QAmqpMessage::ContentEncoding))
+        publish.properties.insert(QAmqpMessage::ContentEncoding, QLatin1String("utf-8"));
+    if (!publish.properties.contains(QAmqpMessage::Headers))
+        publish.properties.insert(QAmqpMessage::Headers, headers);
+    return d->post(publish);
+}
+
+/*!
+ * Publishes message using a template, like QAmqpExchange::publish(). Returns
+ * the id its confirm will be reported with, or 0 if the template is invalid.
+ */
+qlonglong QAmqpPublisher::publish(const QAmqpPublishTemplate &publishTemplate, const QByteArray &message,
+                                  const QAmqpMessage::PropertyHash &properties)
+{
+    Q_D(QAmqpPublisher);
+    if (!publishTemplate.isValid()) {
+        qAmqpBasicDebug() << Q_FUNC_INFO << "invalid publish template";
+        return 0;
+    }
+
+    QAmqpPostedPublish publish;
+    publish.message = message;
+    publish.properties = properties;
+    publish.publishTemplate = publishTemplate;
+    return d->post(publish);
+}
+
+#include "moc_qamqppublisher.cpp"
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2012-2014 Alexey Shcherbakov
+ * Copyright (C) 2014-2015 Matt Broadstone
+ * Contact: https://github.com/mbroadst/qamqp
+ *
+ * This file is part of the QAMQP Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QAMQPPUBLISHER_H
+#define QAMQPPUBLISHER_H
+
+#include <QObject>
+
+#include "qamqpglobal.h"
+#include "qamqpmessage.h"
+#include "qamqppublishtemplate.h"
+#include "qamqptable.h"
+
+class QAmqpExchange;
+class QAmqpPublisherPrivate;
+class QAMQP_EXPORT QAmqpPublisher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QAmqpPublisher(QAmqpExchange *exchange, QObject *parent = 0);
+    virtual ~QAmqpPublisher();
+
+    qlonglong publish(const QByteArray &message, const QString &routingKey, const QString &mimeType,
+                      const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash(),
+                      int publishOptions = 0);
+    qlonglong publish(const QByteArray &message, const QString &routingKey,
+                      const QString &mimeType, const QAmqpTable &headers,
+                      const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash(),
+                      int publishOptions = 0);
+    qlonglong publish(const QAmqpPublishTemplate &publishTemplate, const QByteArray &message,
+                      const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash());
+
+Q_SIGNALS:
+    void confirmed(qlonglong publishId);
+    void rejected(qlonglong publishId);
+
+private:
+    Q_DISABLE_COPY(QAmqpPublisher)
+    Q_DECLARE_PRIVATE(QAmqpPublisher)
+    QScopedPointer<QAmqpPublisherPrivate> d_ptr;
+
+    Q_PRIVATE_SLOT(d_func(), void _q_deliverResults())
+};
+
+#endif // QAMQPPUBLISHER_H
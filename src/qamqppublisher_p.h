@@ -0,0 +1,85 @@
+#ifndef QAMQPPUBLISHER_P_H
+#define QAMQPPUBLISHER_P_H
+
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QVector>
+
+#include "qamqpiothread_p.h"
+#include "qamqppublisher.h"
+
+class QAmqpExchange;
+
+/*!
+ * QAmqpPublisherLink carries publish results from the exchange's thread back
+ * to the thread a publisher lives in. Results are buffered under the mutex
+ * and the publisher is woken with a single queued call per burst.
+ */
+class QAmqpPublisherLink
+{
+public:
+    explicit QAmqpPublisherLink(QAmqpPublisher *publisher);
+
+    // exchange thread
+    void post(const QVector<qlonglong> &publishIds, bool confirmed);
+
+    QMutex mutex;
+    QAmqpPublisher *publisher;      // reset when the publisher is destroyed
+    QVector<QPair<qlonglong, bool> > results;
+    bool notified;
+};
+
+struct QAmqpPostedPublish
+{
+    QAmqpPostedPublish() : publishOptions(0), publishId(0) {}
+
+    QByteArray message;
+    QString routingKey;
+    QAmqpMessage::PropertyHash properties;
+    int publishOptions;
+
+    // valid when publishing through a template, routingKey and publishOptions
+    // are taken from the template then
+    QAmqpPublishTemplate publishTemplate;
+
+    QSharedPointer<QAmqpPublisherLink> link;
+    qlonglong publishId;
+};
+
+/*!
+ * QAmqpPublishQueue is shared between an exchange and its publishers.
+ * Publishers enqueue from their own threads, the exchange drains the queue
+ * on its thread. Only the first post after a drain schedules the next one.
+ */
+class QAmqpPublishQueue
+{
+public:
+    explicit QAmqpPublishQueue(QAmqpExchange *exchange);
+
+    // any thread
+    void post(const QAmqpPostedPublish &publish);
+
+    QAmqpMpscQueue<QAmqpPostedPublish> queue;
+    QAtomicInt notified;
+    QMutex mutex;
+    QAmqpExchange *exchange;        // reset when the exchange is destroyed
+};
+
+class QAmqpPublisherPrivate
+{
+public:
+    QAmqpPublisherPrivate(QAmqpPublisher *q);
+
+    qlonglong post(QAmqpPostedPublish &publish);
+    void _q_deliverResults();
+
+    QSharedPointer<QAmqpPublishQueue> queue;
+    QSharedPointer<QAmqpPublisherLink> link;
+    qlonglong lastPublishId;
+
+    Q_DECLARE_PUBLIC(QAmqpPublisher)
+    QAmqpPublisher * const q_ptr;
+};
+
+#endif // QAMQPPUBLISHER_P_H
@@ -0,0 +1,92 @@
+#include "qamqpcodec_p.h"
+#include "qamqpframe_p.h"
+#include "qamqppublishtemplate.h"
+#include "qamqppublishtemplate_p.h"
+
+QAmqpPublishTemplatePrivate::QAmqpPublishTemplatePrivate()
+    : publishOptions(0)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// default constructed templates are never modified, they share one private
+// so that posting a publish without a template does not allocate
+Q_GLOBAL_STATIC_WITH_ARGS(QSharedDataPointer<QAmqpPublishTemplatePrivate>, sharedNull,
+                          (new QAmqpPublishTemplatePrivate))
+
+QAmqpPublishTemplate::QAmqpPublishTemplate()
+    : d(*sharedNull())
+{
+}
+
+/*!
+ * Creates a template for publishing messages with the given routing key,
+ * mime type, headers and properties. Everything but the exchange name is
+ * encoded here once, publishing with QAmqpExchange::publish() then only
+ * encodes the body size and any per message properties.
+ */
+QAmqpPublishTemplate::QAmqpPublishTemplate(const QString &routingKey, const QString &mimeType,
+                                           const QAmqpTable &headers,
+                                           const QAmqpMessage::PropertyHash &properties,
+                                           int publishOptions)
+    : d(new QAmqpPublishTemplatePrivate)
+{
+    d->routingKey = routingKey;
+    d->publishOptions = publishOptions;
+
+    QAmqpCodecWriter writer(&d->methodArguments);
+    writer.writeShortString(routingKey);
+    writer.writeOctet(quint8(publishOptions));
+
+    // same defaults as QAmqpExchange::publish()
+    d->properties.insert(QAmqpMessage::ContentType, mimeType);
+    d->properties.insert(QAmqpMessage::ContentEncoding, QLatin1String("utf-8"));
+    d->properties.insert(QAmqpMessage::Headers, headers);
+
+    QAmqpMessage::PropertyHash::ConstIterator it;
+    QAmqpMessage::PropertyHash::ConstIterator itEnd = properties.constEnd();
+    for (it = properties.constBegin(); it != itEnd; ++it)
+        d->properties.insert(it.key(), it.value());
+
+    QAmqpContentFrame content(QAmqpFrame::Basic);
+    itEnd = d->properties.constEnd();
+    for (it = d->properties.constBegin(); it != itEnd; ++it)
+        content.setProperty(it.key(), it.value());
+    d->header = content.encodedHeader();
+}
+
+QAmqpPublishTemplate::QAmqpPublishTemplate(const QAmqpPublishTemplate &other)
+    : d(other.d)
+{
+}
+
+QAmqpPublishTemplate &QAmqpPublishTemplate::operator=(const QAmqpPublishTemplate &other)
+{
+    d = other.d;
+    return *this;
+}
+
+QAmqpPublishTemplate::~QAmqpPublishTemplate()
+{
+}
+
+bool QAmqpPublishTemplate::isValid() const
+{
+    return !d->header.isEmpty();
+}
+
+QString QAmqpPublishTemplate::routingKey() const
+{
+    return d->routingKey;
+}
+
+QAmqpMessage::PropertyHash QAmqpPublishTemplate::properties() const
+{
+    return d->properties;
+}
+
+int QAmqpPublishTemplate::publishOptions() const
+{
+    return d->publishOptions;
+}
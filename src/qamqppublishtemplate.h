@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2012-2014 Alexey Shcherbakov
+ * Copyright (C) 2014-2015 Matt Broadstone
+ * Contact: https://github.com/mbroadst/qamqp
+ *
+ * This file is part of the QAMQP Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QAMQPPUBLISHTEMPLATE_H
+#define QAMQPPUBLISHTEMPLATE_H
+
+#include <QSharedDataPointer>
+#include <QString>
+
+#include "qamqpglobal.h"
+#include "qamqpmessage.h"
+#include "qamqptable.h"
+
+class QAmqpPublishTemplatePrivate;
+class QAMQP_EXPORT QAmqpPublishTemplate
+{
+public:
+    QAmqpPublishTemplate();
+    QAmqpPublishTemplate(const QString &routingKey, const QString &mimeType,
+                         const QAmqpTable &headers = QAmqpTable(),
+                         const QAmqpMessage::PropertyHash &properties = QAmqpMessage::PropertyHash(),
+                         int publishOptions = 0);
+    QAmqpPublishTemplate(const QAmqpPublishTemplate &other);
+    QAmqpPublishTemplate &operator=(const QAmqpPublishTemplate &other);
+    ~QAmqpPublishTemplate();
+
+#if QT_VERSION >= 0x050000
+    inline void swap(QAmqpPublishTemplate &other) { qSwap(d, other.d); }
+#endif
+
+    bool isValid() const;
+    QString routingKey() const;
+    QAmqpMessage::PropertyHash properties() const;
+    int publishOptions() const;
+
+private:
+    QSharedDataPointer<QAmqpPublishTemplatePrivate> d;
+    friend class QAmqpExchange;
+    friend class QAmqpExchangePrivate;
+
+#if QT_VERSION < 0x050000
+public:
+    typedef QSharedDataPointer<QAmqpPublishTemplatePrivate> DataPtr;
+    inline DataPtr &data_ptr() { return d; }
+#endif
+};
+
+Q_DECLARE_SHARED(QAmqpPublishTemplate)
+
+#endif // QAMQPPUBLISHTEMPLATE_H
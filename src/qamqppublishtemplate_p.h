@@ -0,0 +1,27 @@
+#ifndef QAMQPPUBLISHTEMPLATE_P_H
+#define QAMQPPUBLISHTEMPLATE_P_H
+
+#include <QByteArray>
+#include <QSharedData>
+
+#include "qamqppublishtemplate.h"
+
+class QAmqpPublishTemplatePrivate : public QSharedData
+{
+public:
+    QAmqpPublishTemplatePrivate();
+
+    QString routingKey;
+    QAmqpMessage::PropertyHash properties;
+    int publishOptions;
+
+    // basic.publish arguments following the exchange name: the routing key
+    // and the publish flags
+    QByteArray methodArguments;
+
+    // the encoded content header payload, the body size is patched in and
+    // per message properties are merged in when publishing
+    QByteArray header;
+};
+
+#endif // QAMQPPUBLISHTEMPLATE_P_H
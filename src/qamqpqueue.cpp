@@ -1,10 +1,16 @@
+#include <limits.h>
+
 #include <QCoreApplication>
 #include <QDebug>
-#include <QDataStream>
 #include <QFile>
+#include <QThreadPool>
+#include <QTimer>
 
 #include "qamqpclient.h"
 #include "qamqpclient_p.h"
+#include "qamqpcodec_p.h"
+#include "qamqpdelivery.h"
+#include "qamqplogging_p.h"
 #include "qamqpqueue.h"
 #include "qamqpqueue_p.h"
 #include "qamqpexchange.h"
@@ -12,15 +18,39 @@
 #include "qamqptable.h"
 using namespace QAMQP;
 
+// bodies up to this size are allocated in one go when their header arrives,
+// larger ones grow as their body frames come in
+static const int bodyReserveLimit = 1024 * 1024;
+
 QAmqpQueuePrivate::QAmqpQueuePrivate(QAmqpQueue *q)
     : QAmqpChannelPrivate(q),
       delayedDeclare(false),
       declared(false),
       recievingMessage(false),
+      maxMessageSize(0),
       consuming(false),
       consumeRequested(false),
+      consumeOptions(0),
+      getNoAck(true),
+      lastDeliveryTag(0),
       messageCount(0),
-      consumerCount(0)
+      consumerCount(0),
+      batchHandler(0),
+      batchPending(false),
+      bufferLowMessages(0),
+      bufferHighMessages(0),
+      bufferLowBytes(0),
+      bufferHighBytes(0),
+      bufferedBytes(0),
+      bufferedCount(0),
+      bufferFull(false),
+      backpressureMode(QAmqpQueue::NoBackpressure),
+      backpressureCancelled(false),
+      backpressureResumePending(false),
+      backpressurePrefetchCount(0),
+      backpressurePrefetchSize(0),
+      ackBatchThreshold(0),
+      ackBatchInterval(0)
 {
 }
 
@@ -28,8 +58,12 @@ QAmqpQueuePrivate::~QAmqpQueuePrivate()
 {
     if (!client.isNull()) {
         QAmqpClientPrivate *priv = client->d_func();
-        priv->contentHandlerByChannel[channelNumber].removeAll(this);
-        priv->bodyHandlersByChannel[channelNumber].removeAll(this);
+        priv->removeContentHandler(channelNumber, this, this);
+        const int pending = batchPending ? priv->pendingBatches.indexOf(this) : -1;
+        if (pending != -1)
+            priv->pendingBatches.remove(pending);
+        if (bufferFull && backpressureMode == QAmqpQueue::PauseReading)
+            priv->resumeReading();
     }
 }
 
@@ -42,6 +76,16 @@ void QAmqpQueuePrivate::resetInternalState()
     recievingMessage = false;
     consuming = false;
     consumeRequested = false;
+    backpressureResumePending = false;
+
+    // delivery tags die with the channel, settling them later is an error
+    if (settlements)
+        settlements->generation.ref();
+    unregisterConsumer();
+    lastDeliveryTag = 0;
+    ackWindow.reset();
+    if (ackTimer)
+        ackTimer->stop();
 }
 
 bool QAmqpQueuePrivate::_q_method(const QAmqpMethodFrame &frame)
@@ -99,82 +143,397 @@ bool QAmqpQueuePrivate::_q_method(const QAmqpMethodFrame &frame)
 
 void QAmqpQueuePrivate::_q_content(const QAmqpContentFrame &frame)
 {
-    Q_Q(QAmqpQueue);
     Q_ASSERT(frame.channel() == channelNumber);
     if (frame.channel() != channelNumber)
         return;
 
     if (!currentMessage.isValid()) {
-        qAmqpDebug() << "received content-header without delivered message";
+        qAmqpBasicDebug() << "received content-header without delivered message";
         return;
     }
 
-    currentMessage.d->leftSize = frame.bodySize();
-    QAmqpMessage::PropertyHash::ConstIterator it;
-    QAmqpMessage::PropertyHash::ConstIterator itEnd = frame.properties_.constEnd();
-    for (it = frame.properties_.constBegin(); it != itEnd; ++it) {
-        QAmqpMessage::Property property = (it.key());
-        if (property == QAmqpMessage::Headers)
-            currentMessage.d->headers = (it.value()).toHash();
-        currentMessage.d->properties[property] = it.value();
+    const qlonglong bodySize = frame.bodySize();
+    const qlonglong limit = maxMessageSize > 0 ? qMin<qlonglong>(maxMessageSize, INT_MAX) : INT_MAX;
+    if (bodySize < 0 || bodySize > limit) {
+        Q_Q(QAmqpQueue);
+        qAmqpBasicDebug() << "received content-header with invalid body size: " << bodySize;
+        currentMessage = QAmqpMessage();
+        error = QAMQP::ContentTooLargeError;
+        errorString = QString::fromLatin1("message body of %1 bytes exceeds the limit of %2 bytes")
+                          .arg(bodySize).arg(limit);
+        Q_EMIT q->error(error);
+        close(QAMQP::ContentTooLargeError, errorString, QAmqpFrame::Basic, bmDeliver);
+        return;
     }
 
-    if (currentMessage.d->leftSize == 0) {
-        // message with an empty body
-        q->enqueue(currentMessage);
-        Q_EMIT q->messageReceived();
-    }
+    // the announced size alone must not allocate a huge body up front
+    currentMessage.d->payload.clear();
+    currentMessage.d->payload.reserve(int(qMin<qlonglong>(bodySize, bodyReserveLimit)));
+    currentMessage.d->leftSize = int(bodySize);
+    currentMessage.d->setRawHeader(frame.buffer_);
+
+    // message with an empty body
+    if (currentMessage.d->leftSize == 0)
+        completeMessage();
 }
 
 void QAmqpQueuePrivate::_q_body(const QAmqpContentBodyFrame &frame)
 {
-    Q_Q(QAmqpQueue);
     Q_ASSERT(frame.channel() == channelNumber);
     if (frame.channel() != channelNumber)
         return;
 
     if (!currentMessage.isValid()) {
-        qAmqpDebug() << "received content-body without delivered message";
+        qAmqpBasicDebug() << "received content-body without delivered message";
+        return;
+    }
+
+    const QByteArray &body = frame.body();
+    if (body.size() > currentMessage.d->leftSize) {
+        qAmqpBasicDebug() << "received content-body larger than announced: " << body.size();
+        currentMessage = QAmqpMessage();
+        return;
+    }
+
+    currentMessage.d->payload.append(body.constData(), body.size());
+    currentMessage.d->leftSize -= body.size();
+    if (currentMessage.d->leftSize == 0)
+        completeMessage();
+}
+
+/*!
+ * Routes the channel's content frames here, several queues sharing a
+ * channel take turns as their deliveries arrive.
+ */
+void QAmqpQueuePrivate::claimContentFrames()
+{
+    if (client.isNull())
+        return;
+
+    QAmqpChannelSlot &slot = client->d_func()->channelSlot(channelNumber);
+    slot.contentHandler = this;
+    slot.bodyHandler = this;
+}
+
+void QAmqpQueuePrivate::completeMessage()
+{
+    Q_Q(QAmqpQueue);
+    if (batchHandler && !dispatcher) {
+        batch.append(currentMessage);
+        if (!batchPending && !client.isNull()) {
+            batchPending = true;
+            client->d_func()->pendingBatches.append(this);
+        }
         return;
     }
 
-    currentMessage.d->payload.append(frame.body());
-    currentMessage.d->leftSize -= frame.body().size();
-    if (currentMessage.d->leftSize == 0) {
-        q->enqueue(currentMessage);
+    if (!dispatcher) {
+        bufferMessage(currentMessage);
         Q_EMIT q->messageReceived();
+        return;
     }
+
+    QAmqpDeliveryPrivate *delivery = new QAmqpDeliveryPrivate;
+    delivery->message = currentMessage;
+    delivery->settlements = settlements;
+    delivery->generation = qAmqpLoadAcquire(settlements->generation);
+    dispatcher->dispatch(dispatcher, QAmqpDelivery(delivery));
 }
 
-void QAmqpQueuePrivate::declareOk(const QAmqpMethodFrame &frame)
+void QAmqpQueuePrivate::bufferMessage(const QAmqpMessage &message)
 {
     Q_Q(QAmqpQueue);
-    declared = true;
+    syncBufferAccounting();
+    q->enqueue(message);
+    bufferedBytes += message.d->payload.size();
+    ++bufferedCount;
+    if (bufferFull)
+        return;
+
+    if ((bufferHighMessages > 0 && q->size() >= bufferHighMessages) ||
+        (bufferHighBytes > 0 && bufferedBytes >= bufferHighBytes)) {
+        bufferFull = true;
+        applyBackpressure();
+        Q_EMIT q->bufferHighWatermarkReached();
+    }
+}
+
+void QAmqpQueuePrivate::checkBufferDrained()
+{
+    Q_Q(QAmqpQueue);
+    syncBufferAccounting();
+    if (!bufferFull)
+        return;
 
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
+    if (q->size() > bufferLowMessages || bufferedBytes > bufferLowBytes)
+        return;
 
-    name = QAmqpFrame::readAmqpField(stream, QAmqpMetaType::ShortString).toString();
+    bufferFull = false;
+    releaseBackpressure();
+    Q_EMIT q->bufferDrained();
+}
 
-    stream >> messageCount >> consumerCount;
+/*!
+ * Recounts the buffered bytes if messages were added or removed through
+ * QList API the accounting does not see. Only the count is compared, so
+ * this costs nothing as long as dequeue() and friends are used.
+ */
+void QAmqpQueuePrivate::syncBufferAccounting()
+{
+    Q_Q(QAmqpQueue);
+    if (q->size() == bufferedCount)
+        return;
 
-    qAmqpDebug("-> queue#declareOk( queue-name=%s, message-count=%d, consumer-count=%d )",
-               qPrintable(name), messageCount, consumerCount);
+    bufferedBytes = 0;
+    for (int i = 0; i < q->size(); ++i)
+        bufferedBytes += q->at(i).d->payload.size();
+    bufferedCount = q->size();
+}
 
-    Q_EMIT q->declared();
+void QAmqpQueuePrivate::applyBackpressure()
+{
+    Q_Q(QAmqpQueue);
+    switch (backpressureMode) {
+    case QAmqpQueue::ReduceQos:
+        // only unacknowledged deliveries are bounded by this
+        backpressurePrefetchCount = requestedPrefetchCount;
+        backpressurePrefetchSize = requestedPrefetchSize;
+        q->qos(1, 0);
+        break;
+    case QAmqpQueue::CancelConsumer:
+        if (backpressureResumePending) {
+            // the earlier cancel is still in flight, just don't resume
+            backpressureResumePending = false;
+            break;
+        }
+
+        backpressureCancelled = consuming && q->cancel();
+        break;
+    case QAmqpQueue::PauseReading:
+        if (!client.isNull())
+            client->d_func()->pauseReading();
+        break;
+    case QAmqpQueue::NoBackpressure:
+        break;
+    }
+
+    qAmqpBasicDebug() << "queue" << name << "buffer full, backpressure mode" << backpressureMode;
 }
 
-void QAmqpQueuePrivate::purgeOk(const QAmqpMethodFrame &frame)
+void QAmqpQueuePrivate::releaseBackpressure()
+{
+    Q_Q(QAmqpQueue);
+    switch (backpressureMode) {
+    case QAmqpQueue::ReduceQos:
+        q->qos(backpressurePrefetchCount, backpressurePrefetchSize);
+        break;
+    case QAmqpQueue::CancelConsumer:
+        if (!backpressureCancelled)
+            break;
+
+        // the consumer only stops with cancel-ok, see cancelOk()
+        if (consuming) {
+            backpressureResumePending = true;
+            break;
+        }
+
+        backpressureCancelled = false;
+        q->consume(consumeOptions);
+        break;
+    case QAmqpQueue::PauseReading:
+        if (!client.isNull())
+            client->d_func()->resumeReading();
+        break;
+    case QAmqpQueue::NoBackpressure:
+        break;
+    }
+
+    qAmqpBasicDebug() << "queue" << name << "buffer drained";
+}
+
+/*!
+ * Hands the messages completed during the last read to the batch handler.
+ * Called by the client once the read has been dispatched.
+ */
+void QAmqpQueuePrivate::flushBatch()
+{
+    batchPending = false;
+    if (batch.isEmpty())
+        return;
+
+    // the handler may re-enter the event loop and complete more messages
+    QVector<QAmqpMessage> messages;
+    qSwap(messages, batch);
+    if (batchHandler)
+        batchHandler->handleMessages(messages);
+
+    // hand the storage back for the next read
+    messages.resize(0);
+    if (batch.isEmpty())
+        qSwap(messages, batch);
+}
+
+void QAmqpQueuePrivate::_q_flushSettlements()
+{
+    // re-arm first, anything settled from here on schedules another flush
+    settlements->notified.fetchAndStoreOrdered(0);
+
+    const int generation = qAmqpLoadAcquire(settlements->generation);
+    QVector<QAmqpSettlementQueue::Settlement> batch;
+    QAmqpSettlementQueue::Settlement settlement;
+    while (settlements->queue.dequeue(&settlement)) {
+        if (settlement.generation != generation)
+            continue;
+
+        // acks from the handlers complete in any order, the window sorts them out
+        if (settlement.action == QAmqpSettlementQueue::Ack) {
+            if (ackBatchThreshold > 0 && ackWindow.ack(settlement.deliveryTag, false))
+                continue;
+        } else {
+            ackWindow.settle(settlement.deliveryTag, false);
+        }
+
+        batch.append(settlement);
+    }
+
+    if (ackWindow.pendingAcks() > 0)
+        scheduleAcks();
+
+    if (batch.isEmpty())
+        return;
+
+    if (!opened) {
+        qAmqpBasicDebug() << Q_FUNC_INFO << "channel is not open, dropping" << batch.size() << "settlements";
+        return;
+    }
+
+    // class-id, method-id, delivery-tag and the multiple or requeue bit
+    const qint32 payloadSize = 2 + 2 + 8 + 1;
+    const qint64 frameSize = QAmqpFrame::HEADER_SIZE + payloadSize + QAmqpFrame::FRAME_END_SIZE;
+    QByteArray *buffer = beginWrite(frameSize * batch.size());
+    if (!buffer)
+        return;
+
+    qAmqpBasicDebug("<- basic#ack/reject( queue=%s, settled=%d )", qPrintable(name), batch.size());
+
+    QAmqpCodecWriter writer(buffer);
+    for (int i = 0; i < batch.size(); ++i) {
+        const QAmqpSettlementQueue::Settlement &entry = batch.at(i);
+        const bool ack = entry.action == QAmqpSettlementQueue::Ack;
+        QAmqpFrame::writeFrameHeader(writer, QAmqpFrame::Method, channelNumber, payloadSize);
+        writer.writeShort(quint16(QAmqpFrame::Basic));
+        writer.writeShort(quint16(ack ? bmAck : bmReject));
+        writer.writeLongLong(quint64(entry.deliveryTag));
+        writer.writeBoolean(entry.action == QAmqpSettlementQueue::Requeue);
+        QAmqpFrame::writeFrameEnd(writer);
+    }
+    endWrite();
+}
+
+/*!
+ * Holds back an ack to be coalesced with others, returns false if it has to
+ * go out right away instead.
+ */
+bool QAmqpQueuePrivate::batchAck(qlonglong deliveryTag, bool multiple)
+{
+    if (ackBatchThreshold <= 0 || !ackWindow.ack(deliveryTag, multiple))
+        return false;
+
+    scheduleAcks();
+    return true;
+}
+
+void QAmqpQueuePrivate::scheduleAcks()
+{
+    Q_Q(QAmqpQueue);
+    if (ackWindow.pendingAcks() >= ackBatchThreshold) {
+        flushAcks(false);
+        if (ackWindow.pendingAcks() == 0)
+            return;
+    }
+
+    if (!ackTimer) {
+        ackTimer = new QTimer(q);
+        ackTimer->setSingleShot(true);
+        QObject::connect(ackTimer, SIGNAL(timeout()), q, SLOT(_q_flushAcks()));
+    }
+
+    if (!ackTimer->isActive())
+        ackTimer->start(ackBatchInterval);
+}
+
+/*!
+ * Sends the acked prefix of the window as a single multiple ack. With
+ * stragglers set, acks waiting behind an outstanding delivery go out one by
+ * one as well, so none is held back longer than the batch interval.
+ */
+void QAmqpQueuePrivate::flushAcks(bool stragglers)
+{
+    QVector<qlonglong> single;
+    const qlonglong multipleTag = ackWindow.take(stragglers, &single);
+    const int count = single.size() + (multipleTag ? 1 : 0);
+    if (count == 0)
+        return;
+
+    if (!opened) {
+        qAmqpBasicDebug() << Q_FUNC_INFO << "channel is not open, dropping" << count << "acks";
+        return;
+    }
+
+    // class-id, method-id, delivery-tag and the multiple bit
+    const qint32 payloadSize = 2 + 2 + 8 + 1;
+    const qint64 frameSize = QAmqpFrame::HEADER_SIZE + payloadSize + QAmqpFrame::FRAME_END_SIZE;
+    QByteArray *buffer = beginWrite(frameSize * count);
+    if (!buffer)
+        return;
+
+    qAmqpBasicDebug("<- basic#ack( queue=%s, multiple-up-to=%lld, single=%d )",
+                    qPrintable(name), multipleTag, single.size());
+
+    QAmqpCodecWriter writer(buffer);
+    for (int i = -1; i < single.size(); ++i) {
+        if (i == -1 && !multipleTag)
+            continue;
+
+        QAmqpFrame::writeFrameHeader(writer, QAmqpFrame::Method, channelNumber, payloadSize);
+        writer.writeShort(quint16(QAmqpFrame::Basic));
+        writer.writeShort(quint16(bmAck));
+        writer.writeLongLong(quint64(i == -1 ? multipleTag : single.at(i)));
+        writer.writeBoolean(i == -1);
+        QAmqpFrame::writeFrameEnd(writer);
+    }
+    endWrite();
+}
+
+void QAmqpQueuePrivate::_q_flushAcks()
+{
+    flushAcks(true);
+}
+
+void QAmqpQueuePrivate::declareOk(const QAmqpMethodFrame &frame)
 {
     Q_Q(QAmqpQueue);
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
+    declared = true;
+
+    QAmqpCodecReader reader(frame.arguments());
+    name = reader.readShortString();
+    messageCount = qint32(reader.readLong());
+    consumerCount = qint32(reader.readLong());
 
+    qAmqpChannelDebug("-> queue#declareOk( queue-name=%s, message-count=%d, consumer-count=%d )",
+                      qPrintable(name), messageCount, consumerCount);
+
+    Q_EMIT q->declared();
+}
 
-    stream >> messageCount;
+void QAmqpQueuePrivate::purgeOk(const QAmqpMethodFrame &frame)
+{
+    Q_Q(QAmqpQueue);
+    QAmqpCodecReader reader(frame.arguments());
+    messageCount = qint32(reader.readLong());
 
-    qAmqpDebug("-> queue#purgeOk( queue-name=%s, message-count=%d )",
-               qPrintable(name), messageCount);
+    qAmqpChannelDebug("-> queue#purgeOk( queue-name=%s, message-count=%d )",
+                      qPrintable(name), messageCount);
 
     Q_EMIT q->purged(messageCount);
 }
@@ -184,13 +543,11 @@ void QAmqpQueuePrivate::deleteOk(const QAmqpMethodFrame &frame)
     Q_Q(QAmqpQueue);
     declared = false;
 
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
-
-    stream >> messageCount;
+    QAmqpCodecReader reader(frame.arguments());
+    messageCount = qint32(reader.readLong());
 
-    qAmqpDebug("-> queue#deleteOk( queue-name=%s, message-count=%d )",
-               qPrintable(name), messageCount);
+    qAmqpChannelDebug("-> queue#deleteOk( queue-name=%s, message-count=%d )",
+                      qPrintable(name), messageCount);
 
 
     Q_EMIT q->removed();
@@ -200,7 +557,7 @@ void QAmqpQueuePrivate::bindOk(const QAmqpMethodFrame &frame)
 {
     Q_UNUSED(frame)
     Q_Q(QAmqpQueue);
-    qAmqpDebug("-> queue[ %s ]#bindOk()", qPrintable(name));
+    qAmqpChannelDebug("-> queue[ %s ]#bindOk()", qPrintable(name));
     Q_EMIT q->bound();
 }
 
@@ -208,56 +565,101 @@ void QAmqpQueuePrivate::unbindOk(const QAmqpMethodFrame &frame)
 {
     Q_UNUSED(frame)
     Q_Q(QAmqpQueue);
-    qAmqpDebug("-> queue[ %s ]#unbindOk()", qPrintable(name));
+    qAmqpChannelDebug("-> queue[ %s ]#unbindOk()", qPrintable(name));
     Q_EMIT q->unbound();
 }
 
 void QAmqpQueuePrivate::getOk(const QAmqpMethodFrame &frame)
 {
-    qAmqpDebug("-> queue[ %s ]#getOk()", qPrintable(name));
+    qAmqpBasicDebug("-> queue[ %s ]#getOk()", qPrintable(name));
 
-    QByteArray data = frame.arguments();
-    QDataStream in(&data, QIODevice::ReadOnly);
+    QAmqpCodecReader in(frame.arguments());
 
+    QAmqpShortStringCache *cache = shortStringCache();
     QAmqpMessage message;
-    message.d->deliveryTag = QAmqpFrame::readAmqpField(in, QAmqpMetaType::LongLongUint).toLongLong();
-    message.d->redelivered = QAmqpFrame::readAmqpField(in, QAmqpMetaType::Boolean).toBool();
-    message.d->exchangeName = QAmqpFrame::readAmqpField(in, QAmqpMetaType::ShortString).toString();
-    message.d->routingKey = QAmqpFrame::readAmqpField(in, QAmqpMetaType::ShortString).toString();
+    message.d->deliveryTag = qlonglong(in.readLongLong());
+    message.d->redelivered = in.readBoolean();
+    message.d->exchangeName = in.readShortString(cache);
+    message.d->routingKey = in.readShortString(cache);
     currentMessage = message;
+    trackDelivery(message.d->deliveryTag, getNoAck);
+    claimContentFrames();
 }
 
 void QAmqpQueuePrivate::consumeOk(const QAmqpMethodFrame &frame)
 {
     Q_Q(QAmqpQueue);
-    QByteArray data = frame.arguments();
-    QDataStream stream(&data, QIODevice::ReadOnly);
-    consumerTag = QAmqpFrame::readAmqpField(stream, QAmqpMetaType::ShortString).toString();
+    QAmqpCodecReader reader(frame.arguments());
+    const QByteArray tag = reader.readShortStringData();
+    consumerTag = QString::fromUtf8(tag.constData(), tag.size());
+    consumerTagData = QByteArray(tag.constData(), tag.size());
     consuming = true;
     consumeRequested = false;
+    registerConsumer();
 
-    qAmqpDebug("-> queue[ %s ]#consumeOk( consumer-tag=%s )", qPrintable(name), qPrintable(consumerTag));
+    qAmqpBasicDebug("-> queue[ %s ]#consumeOk( consumer-tag=%s )", qPrintable(name), qPrintable(consumerTag));
 
     Q_EMIT q->consuming(consumerTag);
 }
 
 void QAmqpQueuePrivate::deliver(const QAmqpMethodFrame &frame)
 {
-    qAmqpDebug() << Q_FUNC_INFO;
-    QByteArray data = frame.arguments();
-    QDataStream in(&data, QIODevice::ReadOnly);
-    QString consumer = QAmqpFrame::readAmqpField(in, QAmqpMetaType::ShortString).toString();
-    if (consumerTag != consumer) {
-        qAmqpDebug() << Q_FUNC_INFO << "invalid consumer tag: " << consumer;
+    QAmqpCodecReader in(frame.arguments());
+    const QByteArray consumer = in.readShortStringData();
+    if (consumer != consumerTagData) {
+        qAmqpBasicDebug() << Q_FUNC_INFO << "invalid consumer tag: " << consumer;
         return;
     }
 
+    QAmqpShortStringCache *cache = shortStringCache();
     QAmqpMessage message;
-    message.d->deliveryTag = QAmqpFrame::readAmqpField(in, QAmqpMetaType::LongLongUint).toLongLong();
-    message.d->redelivered = QAmqpFrame::readAmqpField(in, QAmqpMetaType::Boolean).toBool();
-    message.d->exchangeName = QAmqpFrame::readAmqpField(in, QAmqpMetaType::ShortString).toString();
-    message.d->routingKey = QAmqpFrame::readAmqpField(in, QAmqpMetaType::ShortString).toString();
+    message.d->deliveryTag = qlonglong(in.readLongLong());
+    message.d->redelivered = in.readBoolean();
+    message.d->exchangeName = in.readShortString(cache);
+    message.d->routingKey = in.readShortString(cache);
     currentMessage = message;
+    trackDelivery(message.d->deliveryTag, consumeOptions & QAmqpQueue::coNoAck);
+    claimContentFrames();
+}
+
+/*!
+ * Puts this queue in line for the next queue or basic reply on its channel,
+ * to be called after sending a request that has one.
+ */
+void QAmqpQueuePrivate::expectReply()
+{
+    if (opened && !client.isNull())
+        client->d_func()->channelSlot(channelNumber).pendingReplies.enqueue(this);
+}
+
+void QAmqpQueuePrivate::registerConsumer()
+{
+    if (!client.isNull() && !consumerTagData.isEmpty())
+        client->d_func()->channelSlot(channelNumber).consumers.insert(consumerTagData, this);
+}
+
+void QAmqpQueuePrivate::unregisterConsumer()
+{
+    if (client.isNull() || consumerTagData.isEmpty())
+        return;
+
+    QHash<QByteArray, QAmqpMethodFrameHandler*> &consumers =
+        client->d_func()->channelSlot(channelNumber).consumers;
+    if (consumers.value(consumerTagData) == this)
+        consumers.remove(consumerTagData);
+}
+
+bool QAmqpQueuePrivate::nackSupported() const
+{
+    return !client.isNull() &&
+        client->d_func()->serverCapabilities.value(QLatin1String("basic.nack")).toBool();
+}
+
+void QAmqpQueuePrivate::trackDelivery(qlonglong deliveryTag, bool noAck)
+{
+    lastDeliveryTag = deliveryTag;
+    if (ackBatchThreshold > 0)
+        ackWindow.deliver(deliveryTag, noAck);
 }
 
 void QAmqpQueuePrivate::declare()
@@ -266,20 +668,22 @@ void QAmqpQueuePrivate::declare()
     frame.setChannel(channelNumber);
 
     QByteArray args;
-    QDataStream out(&args, QIODevice::WriteOnly);
+    QAmqpCodecWriter out(&args);
 
-    out << qint16(0);   //reserved 1
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, name);
-    out << qint8(options);
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::Hash, arguments);
+    out.writeShort(0);   //reserved 1
+    out.writeShortString(name);
+    out.writeOctet(quint8(options));
+    out.writeTable(arguments);
 
-    qAmqpDebug("<- queue#declare( queue=%s, passive=%d, durable=%d, exclusive=%d, auto-delete=%d, no-wait=%d )",
-               qPrintable(name), options & QAmqpQueue::Passive, options & QAmqpQueue::Durable,
-               options & QAmqpQueue::Exclusive, options & QAmqpQueue::AutoDelete,
-               options & QAmqpQueue::NoWait);
+    qAmqpChannelDebug("<- queue#declare( queue=%s, passive=%d, durable=%d, exclusive=%d, auto-delete=%d, no-wait=%d )",
+                      qPrintable(name), options & QAmqpQueue::Passive, options & QAmqpQueue::Durable,
+                      options & QAmqpQueue::Exclusive, options & QAmqpQueue::AutoDelete,
+                      options & QAmqpQueue::NoWait);
 
     frame.setArguments(args);
     sendFrame(frame);
+    if (!(options & QAmqpQueue::NoWait))
+        expectReply();
 
     if (delayedDeclare)
         delayedDeclare = false;
@@ -288,21 +692,29 @@ void QAmqpQueuePrivate::declare()
 void QAmqpQueuePrivate::cancelOk(const QAmqpMethodFrame &frame)
 {
     Q_Q(QAmqpQueue);
-    qAmqpDebug() << Q_FUNC_INFO;
-    QByteArray data = frame.arguments();
-    QDataStream in(&data, QIODevice::ReadOnly);
-    QString consumer = QAmqpFrame::readAmqpField(in, QAmqpMetaType::ShortString).toString();
+    qAmqpBasicDebug() << Q_FUNC_INFO;
+    QAmqpCodecReader in(frame.arguments());
+    QString consumer = in.readShortString();
     if (consumerTag != consumer) {
-        qAmqpDebug() << Q_FUNC_INFO << "invalid consumer tag: " << consumer;
+        qAmqpBasicDebug() << Q_FUNC_INFO << "invalid consumer tag: " << consumer;
         return;
     }
 
-    qAmqpDebug("-> queue[ %s ]#cancelOk( consumer-tag=%s )", qPrintable(name), qPrintable(consumerTag));
+    qAmqpBasicDebug("-> queue[ %s ]#cancelOk( consumer-tag=%s )", qPrintable(name), qPrintable(consumerTag));
 
+    unregisterConsumer();
     consumerTag.clear();
+    consumerTagData.clear();
     consuming = false;
     consumeRequested = false;
     Q_EMIT q->cancelled(consumer);
+
+    // the buffer drained before the backpressure cancel completed
+    if (backpressureResumePending) {
+        backpressureResumePending = false;
+        backpressureCancelled = false;
+        q->consume(consumeOptions);
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -312,10 +724,14 @@ QAmqpQueue::QAmqpQueue(int channelNumber, QAmqpClient *parent)
 {
     Q_D(QAmqpQueue);
     d->init(channelNumber, parent);
+    d->settlements = QSharedPointer<QAmqpSettlementQueue>(new QAmqpSettlementQueue(this));
 }
 
 QAmqpQueue::~QAmqpQueue()
 {
+    Q_D(QAmqpQueue);
+    QMutexLocker locker(&d->settlements->mutex);
+    d->settlements->owner = 0;
 }
 
 void QAmqpQueue::channelOpened()
@@ -354,6 +770,184 @@ qint32 QAmqpQueue::consumerCount() const
     return d->consumerCount;
 }
 
+/*!
+ * Bounds the messages buffered by this queue. Once highMessages messages or
+ * highBytes payload bytes are buffered, bufferHighWatermarkReached() is
+ * emitted and the backpressure mode is applied. Once the buffer is down to
+ * lowMessages and lowBytes through dequeue() or clear(), it is lifted again
+ * and bufferDrained() is emitted. A high watermark of 0 disables that
+ * limit.
+ *
+ * Messages have to leave the buffer through dequeue(), takeFirst(),
+ * removeFirst() or clear(). Other QList API goes unnoticed until the next
+ * of those calls or the next delivery, the buffered bytes are recounted
+ * then, but backpressure stays applied until that happens.
+ */
+void QAmqpQueue::setBufferWatermarks(int lowMessages, int highMessages,
+                                     qint64 lowBytes, qint64 highBytes)
+{
+    Q_D(QAmqpQueue);
+    d->bufferLowMessages = qMax(0, qMin(lowMessages, highMessages));
+    d->bufferHighMessages = qMax(0, highMessages);
+    d->bufferLowBytes = qMax(qint64(0), qMin(lowBytes, highBytes));
+    d->bufferHighBytes = qMax(qint64(0), highBytes);
+    d->checkBufferDrained();
+}
+
+QAmqpQueue::BackpressureMode QAmqpQueue::backpressureMode() const
+{
+    Q_D(const QAmqpQueue);
+    return d->backpressureMode;
+}
+
+/*!
+ * Sets what happens while the buffer is over its high watermark:
+ *
+ * ReduceQos lowers the prefetch count to 1 until the buffer drains, which
+ * only holds back deliveries that need acknowledging. CancelConsumer
+ * cancels the consumer and consumes again afterwards. PauseReading stops
+ * reading from the connection altogether, which also holds back every
+ * other channel of the client, and is the only mode that bounds coNoAck
+ * consumers. Changing the mode while the buffer is full releases the
+ * current backpressure and applies the new mode right away.
+ */
+void QAmqpQueue::setBackpressureMode(BackpressureMode mode)
+{
+    Q_D(QAmqpQueue);
+    if (d->bufferFull) {
+        qAmqpBasicDebug() << Q_FUNC_INFO << "buffer is full, releasing current backpressure first";
+        d->releaseBackpressure();
+        d->backpressureMode = mode;
+        d->applyBackpressure();
+        return;
+    }
+
+    d->backpressureMode = mode;
+}
+
+qint64 QAmqpQueue::bufferedBytes() const
+{
+    Q_D(const QAmqpQueue);
+    return d->bufferedBytes;
+}
+
+bool QAmqpQueue::isBufferFull() const
+{
+    Q_D(const QAmqpQueue);
+    return d->bufferFull;
+}
+
+QAmqpMessage QAmqpQueue::dequeue()
+{
+    Q_D(QAmqpQueue);
+    d->syncBufferAccounting();
+    QAmqpMessage message = QQueue<QAmqpMessage>::dequeue();
+    d->bufferedBytes -= message.d->payload.size();
+    --d->bufferedCount;
+    d->checkBufferDrained();
+    return message;
+}
+
+QAmqpMessage QAmqpQueue::takeFirst()
+{
+    return dequeue();
+}
+
+void QAmqpQueue::removeFirst()
+{
+    dequeue();
+}
+
+void QAmqpQueue::clear()
+{
+    Q_D(QAmqpQueue);
+    QQueue<QAmqpMessage>::clear();
+    d->checkBufferDrained();
+}
+
+QAmqpMessageBatchHandler *QAmqpQueue::batchHandler() const
+{
+    Q_D(const QAmqpQueue);
+    return d->batchHandler;
+}
+
+/*!
+ * Calls handler once per socket read with every message this queue
+ * completed during that read, in order, instead of enqueueing them and
+ * emitting messageReceived() for each. The call is made directly, no
+ * signals are involved. handler is not owned by the queue, passing 0
+ * switches back to the local queue.
+ *
+ * setBatchCallback() does the same for any functor callable with a
+ * const QVector<QAmqpMessage> &, which the queue keeps a copy of.
+ *
+ * A delivery handler set with setDeliveryHandler() takes precedence.
+ */
+void QAmqpQueue::setBatchHandler(QAmqpMessageBatchHandler *handler)
+{
+    setBatchHandler(handler, false);
+}
+
+void QAmqpQueue::setBatchHandler(QAmqpMessageBatchHandler *handler, bool owned)
+{
+    Q_D(QAmqpQueue);
+    if (handler == d->batchHandler)
+        return;
+
+    // messages completed so far still go to the old handler
+    d->flushBatch();
+    d->batchHandler = handler;
+    d->ownedBatchHandler.reset(owned ? handler : 0);
+}
+
+QAmqpDeliveryHandler *QAmqpQueue::deliveryHandler() const
+{
+    Q_D(const QAmqpQueue);
+    return d->dispatcher ? d->dispatcher->handler : 0;
+}
+
+/*!
+ * Hands every message received from now on to handler on pool's threads,
+ * or QThreadPool::globalInstance() if pool is 0, instead of enqueueing it
+ * and emitting messageReceived(). Unordered deliveries run as soon as a
+ * thread is free, OrderedByRoutingKey keeps deliveries with the same
+ * routing key in arrival order and runs them one at a time.
+ *
+ * Handlers ack or reject through QAmqpDelivery from their thread. Passing
+ * a null handler switches back to the local queue, deliveries already
+ * dispatched still run. handler and pool must outlive those.
+ */
+void QAmqpQueue::setDeliveryHandler(QAmqpDeliveryHandler *handler, QThreadPool *pool,
+                                    DispatchOrder order)
+{
+    Q_D(QAmqpQueue);
+    if (!handler) {
+        d->dispatcher.clear();
+        return;
+    }
+
+    if (!pool)
+        pool = QThreadPool::globalInstance();
+    d->dispatcher = QSharedPointer<QAmqpDeliveryDispatcher>(
+        new QAmqpDeliveryDispatcher(handler, pool, 0, order));
+}
+
+/*!
+ * Like the QThreadPool overload, but deliveries are run by executor.
+ */
+void QAmqpQueue::setDeliveryHandler(QAmqpDeliveryHandler *handler, QAmqpExecutor *executor,
+                                    DispatchOrder order)
+{
+    Q_D(QAmqpQueue);
+    if (!handler || !executor) {
+        d->dispatcher.clear();
+        return;
+    }
+
+    d->dispatcher = QSharedPointer<QAmqpDeliveryDispatcher>(
+        new QAmqpDeliveryDispatcher(handler, 0, executor, order));
+}
+
 void QAmqpQueue::declare(int options, const QAmqpTable &arguments)
 {
     Q_D(QAmqpQueue);
@@ -372,7 +966,7 @@ void QAmqpQueue::remove(int options)
 {
     Q_D(QAmqpQueue);
     if (!d->declared) {
-        qAmqpDebug() << Q_FUNC_INFO << "trying to remove undeclared queue, aborting...";
+        qAmqpChannelDebug() << Q_FUNC_INFO << "trying to remove undeclared queue, aborting...";
         return;
     }
 
@@ -380,17 +974,19 @@ void QAmqpQueue::remove(int options)
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream out(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter out(&arguments);
 
-    out << qint16(0);   //reserved 1
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, d->name);
-    out << qint8(options);
+    out.writeShort(0);   //reserved 1
+    out.writeShortString(d->name);
+    out.writeOctet(quint8(options));
 
-    qAmqpDebug("<- queue#delete( queue=%s, if-unused=%d, if-empty=%d )",
-               qPrintable(d->name), options & QAmqpQueue::roIfUnused, options & QAmqpQueue::roIfEmpty);
+    qAmqpChannelDebug("<- queue#delete( queue=%s, if-unused=%d, if-empty=%d )",
+                      qPrintable(d->name), options & QAmqpQueue::roIfUnused, options & QAmqpQueue::roIfEmpty);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
+    if (!(options & QAmqpQueue::roNoWait))
+        d->expectReply();
 }
 
 void QAmqpQueue::purge()
@@ -404,21 +1000,22 @@ void QAmqpQueue::purge()
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream out(&arguments, QIODevice::WriteOnly);
-    out << qint16(0);   //reserved 1
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, d->name);
-    out << qint8(0);    // no-wait
+    QAmqpCodecWriter out(&arguments);
+    out.writeShort(0);   //reserved 1
+    out.writeShortString(d->name);
+    out.writeOctet(quint8(0));    // no-wait
 
-    qAmqpDebug("<- queue#purge( queue=%s, no-wait=%d )", qPrintable(d->name), 0);
+    qAmqpChannelDebug("<- queue#purge( queue=%s, no-wait=%d )", qPrintable(d->name), 0);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
+    d->expectReply();
 }
 
 void QAmqpQueue::bind(QAmqpExchange *exchange, const QString &key)
 {
     if (!exchange) {
-        qAmqpDebug() << Q_FUNC_INFO << "invalid exchange provided";
+        qAmqpChannelDebug() << Q_FUNC_INFO << "invalid exchange provided";
         return;
     }
 
@@ -437,28 +1034,29 @@ void QAmqpQueue::bind(const QString &exchangeName, const QString &key)
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream out(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter out(&arguments);
 
-    out << qint16(0);   //  reserved 1
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, d->name);
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, exchangeName);
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, key);
+    out.writeShort(0);   //  reserved 1
+    out.writeShortString(d->name);
+    out.writeShortString(exchangeName);
+    out.writeShortString(key);
 
-    out << qint8(0);    //  no-wait
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::Hash, QAmqpTable());
+    out.writeOctet(quint8(0));    //  no-wait
+    out.writeTable(QAmqpTable());
 
-    qAmqpDebug("<- queue#bind( queue=%s, exchange=%s, routing-key=%s, no-wait=%d )",
-               qPrintable(d->name), qPrintable(exchangeName), qPrintable(key),
-               0);
+    qAmqpChannelDebug("<- queue#bind( queue=%s, exchange=%s, routing-key=%s, no-wait=%d )",
+                      qPrintable(d->name), qPrintable(exchangeName), qPrintable(key),
+                      0);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
+    d->expectReply();
 }
 
 void QAmqpQueue::unbind(QAmqpExchange *exchange, const QString &key)
 {
     if (!exchange) {
-        qAmqpDebug() << Q_FUNC_INFO << "invalid exchange provided";
+        qAmqpChannelDebug() << Q_FUNC_INFO << "invalid exchange provided";
         return;
     }
 
@@ -469,7 +1067,7 @@ void QAmqpQueue::unbind(const QString &exchangeName, const QString &key)
 {
     Q_D(QAmqpQueue);
     if (!d->opened) {
-        qAmqpDebug() << Q_FUNC_INFO << "queue is not open";
+        qAmqpChannelDebug() << Q_FUNC_INFO << "queue is not open";
         return;
     }
 
@@ -477,35 +1075,36 @@ void QAmqpQueue::unbind(const QString &exchangeName, const QString &key)
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream out(&arguments, QIODevice::WriteOnly);
-    out << qint16(0);   //reserved 1
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, d->name);
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, exchangeName);
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, key);
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::Hash, QAmqpTable());
+    QAmqpCodecWriter out(&arguments);
+    out.writeShort(0);   //reserved 1
+    out.writeShortString(d->name);
+    out.writeShortString(exchangeName);
+    out.writeShortString(key);
+    out.writeTable(QAmqpTable());
 
-    qAmqpDebug("<- queue#unbind( queue=%s, exchange=%s, routing-key=%s )",
-               qPrintable(d->name), qPrintable(exchangeName), qPrintable(key));
+    qAmqpChannelDebug("<- queue#unbind( queue=%s, exchange=%s, routing-key=%s )",
+                      qPrintable(d->name), qPrintable(exchangeName), qPrintable(key));
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
+    d->expectReply();
 }
 
 bool QAmqpQueue::consume(int options)
 {
     Q_D(QAmqpQueue);
     if (!d->opened) {
-        qAmqpDebug() << Q_FUNC_INFO << "queue is not open";
+        qAmqpBasicDebug() << Q_FUNC_INFO << "queue is not open";
         return false;
     }
 
     if (d->consumeRequested) {
-        qAmqpDebug() << Q_FUNC_INFO << "already attempting to consume";
+        qAmqpBasicDebug() << Q_FUNC_INFO << "already attempting to consume";
         return false;
     }
 
     if (d->consuming) {
-        qAmqpDebug() << Q_FUNC_INFO << "already consuming with tag: " << d->consumerTag;
+        qAmqpBasicDebug() << Q_FUNC_INFO << "already consuming with tag: " << d->consumerTag;
         return false;
     }
 
@@ -513,23 +1112,28 @@ bool QAmqpQueue::consume(int options)
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream out(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter out(&arguments);
 
-    out << qint16(0);   //reserved 1
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, d->name);
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, d->consumerTag);
+    out.writeShort(0);   //reserved 1
+    out.writeShortString(d->name);
+    out.writeShortString(d->consumerTag);
 
-    out << qint8(options);
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::Hash, QAmqpTable());
+    out.writeOctet(quint8(options));
+    out.writeTable(QAmqpTable());
 
-    qAmqpDebug("<- basic#consume( queue=%s, consumer-tag=%s, no-local=%d, no-ack=%d, exclusive=%d, no-wait=%d )",
-               qPrintable(d->name), qPrintable(d->consumerTag),
-               options & QAmqpQueue::coNoLocal, options & QAmqpQueue::coNoAck,
-               options & QAmqpQueue::coExclusive, options & QAmqpQueue::coNoWait);
+    qAmqpBasicDebug("<- basic#consume( queue=%s, consumer-tag=%s, no-local=%d, no-ack=%d, exclusive=%d, no-wait=%d )",
+                    qPrintable(d->name), qPrintable(d->consumerTag),
+                    options & QAmqpQueue::coNoLocal, options & QAmqpQueue::coNoAck,
+                    options & QAmqpQueue::coExclusive, options & QAmqpQueue::coNoWait);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
     d->consumeRequested = true;
+    d->consumeOptions = options;
+    if (options & QAmqpQueue::coNoWait)
+        d->registerConsumer();
+    else
+        d->expectReply();
     return true;
 }
 
@@ -537,6 +1141,7 @@ void QAmqpQueue::setConsumerTag(const QString &consumerTag)
 {
     Q_D(QAmqpQueue);
     d->consumerTag = consumerTag;
+    d->consumerTagData = consumerTag.toUtf8();
 }
 
 QString QAmqpQueue::consumerTag() const
@@ -561,7 +1166,7 @@ void QAmqpQueue::get(bool noAck)
 {
     Q_D(QAmqpQueue);
     if (!d->opened) {
-        qAmqpDebug() << Q_FUNC_INFO << "channel is not open";
+        qAmqpBasicDebug() << Q_FUNC_INFO << "channel is not open";
         return;
     }
 
@@ -569,16 +1174,18 @@ void QAmqpQueue::get(bool noAck)
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream out(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter out(&arguments);
 
-    out << qint16(0);   //reserved 1
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, d->name);
-    out << qint8(noAck ? 1 : 0); // no-ack
+    out.writeShort(0);   //reserved 1
+    out.writeShortString(d->name);
+    out.writeBoolean(noAck); // no-ack
 
-    qAmqpDebug("<- basic#get( queue=%s, no-ack=%d )", qPrintable(d->name), noAck);
+    qAmqpBasicDebug("<- basic#get( queue=%s, no-ack=%d )", qPrintable(d->name), noAck);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
+    d->expectReply();
+    d->getNoAck = noAck;
 }
 
 void QAmqpQueue::ack(const QAmqpMessage &message)
@@ -590,20 +1197,24 @@ void QAmqpQueue::ack(qlonglong deliveryTag, bool multiple)
 {
     Q_D(QAmqpQueue);
     if (!d->opened) {
-        qAmqpDebug() << Q_FUNC_INFO << "channel is not open";
+        qAmqpBasicDebug() << Q_FUNC_INFO << "channel is not open";
         return;
     }
 
+    if (d->batchAck(deliveryTag, multiple))
+        return;
+    d->ackWindow.settle(deliveryTag, multiple);
+
     QAmqpMethodFrame frame(QAmqpFrame::Basic, QAmqpQueuePrivate::bmAck);
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream out(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter out(&arguments);
 
-    out << deliveryTag;
-    out << qint8(multiple ? 1 : 0); // multiple
+    out.writeLongLong(quint64(deliveryTag));
+    out.writeBoolean(multiple); // multiple
 
-    qAmqpDebug("<- basic#ack( delivery-tag=%llu, multiple=%d )", deliveryTag, multiple);
+    qAmqpBasicDebug("<- basic#ack( delivery-tag=%llu, multiple=%d )", deliveryTag, multiple);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
@@ -618,7 +1229,7 @@ void QAmqpQueue::reject(qlonglong deliveryTag, bool requeue)
 {
     Q_D(QAmqpQueue);
     if (!d->opened) {
-        qAmqpDebug() << Q_FUNC_INFO << "channel is not open";
+        qAmqpBasicDebug() << Q_FUNC_INFO << "channel is not open";
         return;
     }
 
@@ -626,27 +1237,168 @@ void QAmqpQueue::reject(qlonglong deliveryTag, bool requeue)
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream out(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter out(&arguments);
 
-    out << deliveryTag;
-    out << qint8(requeue ? 1 : 0);
+    out.writeLongLong(quint64(deliveryTag));
+    out.writeBoolean(requeue);
 
-    qAmqpDebug("<- basic#reject( delivery-tag=%llu, requeue=%d )", deliveryTag, requeue);
+    qAmqpBasicDebug("<- basic#reject( delivery-tag=%llu, requeue=%d )", deliveryTag, requeue);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
+    d->ackWindow.settle(deliveryTag, false);
+}
+
+void QAmqpQueue::nack(const QAmqpMessage &message, bool requeue)
+{
+    nack(message.deliveryTag(), false, requeue);
+}
+
+/*!
+ * Rejects deliveryTag, or with multiple set every delivery up to and
+ * including it that was not acked yet, in a single frame. A tag of 0 with
+ * multiple set covers every outstanding delivery on the channel.
+ *
+ * Acks held back by ack batching are sent first, so a multiple nack never
+ * covers a delivery that was acked. Brokers without the basic.nack
+ * capability get a basic.reject per delivery instead. For a multiple nack
+ * the deliveries are taken from those ack batching tracks, without ack
+ * batching error() is emitted with QAMQP::NotImplementedError.
+ */
+void QAmqpQueue::nack(qlonglong deliveryTag, bool multiple, bool requeue)
+{
+    Q_D(QAmqpQueue);
+    if (!d->opened) {
+        qAmqpBasicDebug() << Q_FUNC_INFO << "channel is not open";
+        return;
+    }
+
+    if (!d->nackSupported()) {
+        if (!multiple) {
+            reject(deliveryTag, requeue);
+            return;
+        }
+
+        // only the ack window knows which deliveries a multiple nack covers
+        if (d->ackBatchThreshold <= 0) {
+            qAmqpBasicDebug() << Q_FUNC_INFO << "broker does not support basic.nack";
+            d->error = QAMQP::NotImplementedError;
+            d->errorString =
+                QLatin1String("broker does not support basic.nack, multiple nacks need ack batching");
+            Q_EMIT error(d->error);
+            return;
+        }
+
+        if (d->ackWindow.pendingAcks() > 0)
+            flushAcks();
+
+        const QVector<qlonglong> tags = d->ackWindow.outstanding(deliveryTag);
+        for (int i = 0; i < tags.size(); ++i)
+            reject(tags.at(i), requeue);
+        return;
+    }
+
+    if (multiple && d->ackWindow.pendingAcks() > 0)
+        flushAcks();
+
+    QAmqpMethodFrame frame(QAmqpFrame::Basic, QAmqpQueuePrivate::bmNack);
+    frame.setChannel(d->channelNumber);
+
+    QByteArray arguments;
+    QAmqpCodecWriter out(&arguments);
+
+    out.writeLongLong(quint64(deliveryTag));
+    out.writeOctet(quint8((multiple ? 0x01 : 0) | (requeue ? 0x02 : 0)));
+
+    qAmqpBasicDebug("<- basic#nack( delivery-tag=%llu, multiple=%d, requeue=%d )",
+                    deliveryTag, multiple, requeue);
+
+    frame.setArguments(arguments);
+    d->sendFrame(frame);
+    d->ackWindow.settle(deliveryTag, multiple);
+}
+
+/*!
+ * Sends every ack held back by ack batching right away.
+ */
+void QAmqpQueue::flushAcks()
+{
+    Q_D(QAmqpQueue);
+    if (d->ackTimer)
+        d->ackTimer->stop();
+    d->flushAcks(true);
+}
+
+/*!
+ * Coalesces acks: ack() and QAmqpDelivery::ack() only mark deliveries as
+ * acked, and once threshold of them form a prefix of the outstanding
+ * deliveries they are settled with a single multiple ack. Acks may come in
+ * any order, those waiting behind a delivery that is still outstanding go
+ * out on their own after msecs at the latest. flushAcks() sends everything
+ * held back immediately. A threshold of 0 disables batching, any held back
+ * acks are flushed.
+ *
+ * Batching should be enabled before the first delivery on the channel,
+ * otherwise a multiple ack could settle earlier deliveries that were never
+ * acked, and every ack goes out on its own.
+ */
+void QAmqpQueue::setAckBatching(int threshold, int msecs)
+{
+    Q_D(QAmqpQueue);
+    const bool enabled = d->ackBatchThreshold > 0;
+    d->ackBatchThreshold = qMax(threshold, 0);
+    d->ackBatchInterval = qMax(msecs, 0);
+    if (enabled == (threshold > 0))
+        return;
+
+    if (enabled) {
+        flushAcks();
+        d->ackWindow.reset();
+    } else {
+        d->ackWindow.reset(d->lastDeliveryTag == 0);
+    }
+}
+
+int QAmqpQueue::ackBatchThreshold() const
+{
+    Q_D(const QAmqpQueue);
+    return d->ackBatchThreshold;
+}
+
+int QAmqpQueue::ackBatchInterval() const
+{
+    Q_D(const QAmqpQueue);
+    return d->ackBatchInterval;
+}
+
+/*!
+ * Limits the body size of messages this queue accepts to bytes. A delivery
+ * announcing a larger body closes the channel with
+ * QAMQP::ContentTooLargeError. 0, the default, only rejects bodies that do
+ * not fit a QByteArray.
+ */
+void QAmqpQueue::setMaxMessageSize(qint64 bytes)
+{
+    Q_D(QAmqpQueue);
+    d->maxMessageSize = qMax<qint64>(bytes, 0);
+}
+
+qint64 QAmqpQueue::maxMessageSize() const
+{
+    Q_D(const QAmqpQueue);
+    return d->maxMessageSize;
 }
 
 bool QAmqpQueue::cancel(bool noWait)
 {
     Q_D(QAmqpQueue);
     if (!d->consuming) {
-        qAmqpDebug() << Q_FUNC_INFO << "not consuming!";
+        qAmqpBasicDebug() << Q_FUNC_INFO << "not consuming!";
         return false;
     }
 
     if (d->consumerTag.isEmpty()) {
-        qAmqpDebug() << Q_FUNC_INFO << "consuming with an empty consumer tag, failing...";
+        qAmqpBasicDebug() << Q_FUNC_INFO << "consuming with an empty consumer tag, failing...";
         return false;
     }
 
@@ -654,14 +1406,16 @@ bool QAmqpQueue::cancel(bool noWait)
     frame.setChannel(d->channelNumber);
 
     QByteArray arguments;
-    QDataStream out(&arguments, QIODevice::WriteOnly);
+    QAmqpCodecWriter out(&arguments);
 
-    QAmqpFrame::writeAmqpField(out, QAmqpMetaType::ShortString, d->consumerTag);
-    out << (noWait ? qint8(0x01) : qint8(0x0));
+    out.writeShortString(d->consumerTag);
+    out.writeBoolean(noWait);
 
-    qAmqpDebug("<- basic#cancel( consumer-tag=%s, no-wait=%d )", qPrintable(d->consumerTag), noWait);
+    qAmqpBasicDebug("<- basic#cancel( consumer-tag=%s, no-wait=%d )", qPrintable(d->consumerTag), noWait);
 
     frame.setArguments(arguments);
     d->sendFrame(frame);
     return true;
 }
+
+#include "moc_qamqpqueue.cpp"
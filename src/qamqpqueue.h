@@ -21,10 +21,12 @@
 #include <QQueue>
 
 #include "qamqpchannel.h"
+#include "qamqpdelivery.h"
 #include "qamqpmessage.h"
 #include "qamqpglobal.h"
 #include "qamqptable.h"
 
+class QThreadPool;
 class QAmqpClient;
 class QAmqpClientPrivate;
 class QAmqpExchange;
@@ -38,6 +40,8 @@ class QAMQP_EXPORT QAmqpQueue : public QAmqpChannel, public QQueue<QAmqpMessage>
     Q_ENUMS(QueueOption)
     Q_ENUMS(ConsumeOption)
     Q_ENUMS(RemoveOption)
+    Q_ENUMS(DispatchOrder)
+    Q_ENUMS(BackpressureMode)
 
 public:
     enum QueueOption {
@@ -67,6 +71,18 @@ public:
     };
     Q_DECLARE_FLAGS(RemoveOptions, RemoveOption)
 
+    enum DispatchOrder {
+        Unordered,
+        OrderedByRoutingKey
+    };
+
+    enum BackpressureMode {
+        NoBackpressure,
+        ReduceQos,
+        CancelConsumer,
+        PauseReading
+    };
+
     ~QAmqpQueue();
 
     bool isConsuming() const;
@@ -78,6 +94,41 @@ public:
     qint32 messageCount() const;
     qint32 consumerCount() const;
 
+    QAmqpDeliveryHandler *deliveryHandler() const;
+    void setDeliveryHandler(QAmqpDeliveryHandler *handler, QThreadPool *pool = 0,
+                            DispatchOrder order = Unordered);
+    void setDeliveryHandler(QAmqpDeliveryHandler *handler, QAmqpExecutor *executor,
+                            DispatchOrder order = Unordered);
+
+    void setBufferWatermarks(int lowMessages, int highMessages,
+                             qint64 lowBytes = 0, qint64 highBytes = 0);
+    BackpressureMode backpressureMode() const;
+    void setBackpressureMode(BackpressureMode mode);
+    qint64 bufferedBytes() const;
+    bool isBufferFull() const;
+
+    void setAckBatching(int threshold, int msecs = 100);
+    int ackBatchThreshold() const;
+    int ackBatchInterval() const;
+
+    void setMaxMessageSize(qint64 bytes);
+    qint64 maxMessageSize() const;
+
+    // shadow QQueue, messages have to leave the buffer through these for
+    // the watermarks to see them
+    QAmqpMessage dequeue();
+    QAmqpMessage takeFirst();
+    void removeFirst();
+    void clear();
+
+    QAmqpMessageBatchHandler *batchHandler() const;
+    void setBatchHandler(QAmqpMessageBatchHandler *handler);
+    template <typename Functor>
+    void setBatchCallback(Functor callback)
+    {
+        setBatchHandler(new QAmqpFunctorBatchHandler<Functor>(callback), true);
+    }
+
 Q_SIGNALS:
     void declared();
     void bound();
@@ -89,6 +140,8 @@ Q_SIGNALS:
     void empty();
     void consuming(const QString &consumerTag);
     void cancelled(const QString &consumerTag);
+    void bufferHighWatermarkReached();
+    void bufferDrained();
 
 public Q_SLOTS:
     // AMQP Queue
@@ -108,6 +161,9 @@ public Q_SLOTS:
     void ack(qlonglong deliveryTag, bool multiple);
     void reject(const QAmqpMessage &message, bool requeue);
     void reject(qlonglong deliveryTag, bool requeue);
+    void nack(const QAmqpMessage &message, bool requeue = true);
+    void nack(qlonglong deliveryTag, bool multiple, bool requeue = true);
+    void flushAcks();
 
 protected:
     // reimp Channel
@@ -116,12 +172,15 @@ protected:
 
 private:
     explicit QAmqpQueue(int channelNumber = -1, QAmqpClient *parent = 0);
+    void setBatchHandler(QAmqpMessageBatchHandler *handler, bool owned);
 
     Q_DISABLE_COPY(QAmqpQueue)
     Q_DECLARE_PRIVATE(QAmqpQueue)
     friend class QAmqpClient;
     friend class QAmqpClientPrivate;
 
+    Q_PRIVATE_SLOT(d_func(), void _q_flushSettlements())
+    Q_PRIVATE_SLOT(d_func(), void _q_flushAcks())
 };
 
 #endif  // QAMQPQUEUE_H
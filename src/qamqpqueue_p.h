@@ -1,10 +1,17 @@
 #ifndef QAMQPQUEUE_P_H
 #define QAMQPQUEUE_P_H
 
+#include <QPointer>
 #include <QQueue>
+#include <QScopedPointer>
+#include <QSharedPointer>
 #include <QStringList>
 
+#include "qamqpackwindow_p.h"
 #include "qamqpchannel_p.h"
+#include "qamqpdelivery_p.h"
+
+class QTimer;
 
 class QAmqpQueuePrivate: public QAmqpChannelPrivate,
                          public QAmqpContentFrameHandler,
@@ -41,6 +48,32 @@ public:
     void deliver(const QAmqpMethodFrame &frame);
     void getOk(const QAmqpMethodFrame &frame);
     void cancelOk(const QAmqpMethodFrame &frame);
+    void claimContentFrames();
+    void trackDelivery(qlonglong deliveryTag, bool noAck);
+
+    // routing on channels shared with other queues
+    void expectReply();
+    void registerConsumer();
+    void unregisterConsumer();
+    bool nackSupported() const;
+    void completeMessage();
+    void flushBatch();
+
+    // local buffer limits
+    void bufferMessage(const QAmqpMessage &message);
+    void checkBufferDrained();
+    void syncBufferAccounting();
+    void applyBackpressure();
+    void releaseBackpressure();
+
+    // deliveries settled from worker threads
+    void _q_flushSettlements();
+
+    // ack coalescing
+    bool batchAck(qlonglong deliveryTag, bool multiple);
+    void scheduleAcks();
+    void flushAcks(bool stragglers);
+    void _q_flushAcks();
 
     QString type;
     int options;
@@ -49,14 +82,50 @@ public:
     QQueue<QPair<QString, QString> > delayedBindings;
 
     QString consumerTag;
+    QByteArray consumerTagData;     // as sent on the wire, for comparing deliveries
     bool recievingMessage;
     QAmqpMessage currentMessage;
+    qint64 maxMessageSize;      // largest accepted body, 0 leaves only INT_MAX
     bool consuming;
     bool consumeRequested;
+    int consumeOptions;
+    bool getNoAck;
+    qlonglong lastDeliveryTag;
 
     qint32 messageCount;
     qint32 consumerCount;
 
+    // set while completed messages go to a delivery handler instead of
+    // the local queue
+    QSharedPointer<QAmqpDeliveryDispatcher> dispatcher;
+    QSharedPointer<QAmqpSettlementQueue> settlements;
+
+    // messages completed during the current read, for the batch handler
+    QAmqpMessageBatchHandler *batchHandler;
+    QScopedPointer<QAmqpMessageBatchHandler> ownedBatchHandler;
+    QVector<QAmqpMessage> batch;
+    bool batchPending;
+
+    int bufferLowMessages;
+    int bufferHighMessages;
+    qint64 bufferLowBytes;
+    qint64 bufferHighBytes;
+    qint64 bufferedBytes;
+    int bufferedCount;          // messages bufferedBytes accounts for
+    bool bufferFull;
+    QAmqpQueue::BackpressureMode backpressureMode;
+    // what backpressure changed, to be restored once the buffer drains
+    bool backpressureCancelled;
+    bool backpressureResumePending;     // consume again once cancel-ok arrives
+    qint16 backpressurePrefetchCount;
+    qint32 backpressurePrefetchSize;
+
+    // acks held back to go out as one multiple ack, 0 disables
+    int ackBatchThreshold;
+    int ackBatchInterval;
+    QAmqpAckWindow ackWindow;
+    QPointer<QTimer> ackTimer;
+
     Q_DECLARE_PUBLIC(QAmqpQueue)
 
 };
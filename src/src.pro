@@ -9,6 +9,12 @@ build_pass:CONFIG(debug, debug|release) {
 QT += core network
 QT -= gui
 DEFINES += QAMQP_BUILD
+
+# debug logging is compiled out of release builds, unless
+# CONFIG += qamqp_debug_logging is given
+CONFIG(release, debug|release):!qamqp_debug_logging {
+    DEFINES += QAMQP_NO_DEBUG
+}
 CONFIG += $${QAMQP_LIBRARY_TYPE}
 VERSION = $${QAMQP_VERSION}
 win32:DESTDIR = $$OUT_PWD
@@ -42,21 +48,36 @@ GIT_TAG = $$system(git describe --abbrev=0)
 VERSION = $$replace(GIT_TAG, v,)
 
 PRIVATE_HEADERS += \
+    qamqpackwindow_p.h \
     qamqpchannel_p.h \
+    qamqpchannelallocator_p.h \
     qamqpchannelhash_p.h \
     qamqpclient_p.h \
+    qamqpcodec_p.h \
+    qamqpconfirmtracker_p.h \
+    qamqpconnectionpool_p.h \
+    qamqpdelivery_p.h \
     qamqpexchange_p.h \
+    qamqpfieldtable_p.h \
     qamqpframe_p.h \
+    qamqpiothread_p.h \
+    qamqplogging_p.h \
     qamqpmessage_p.h \
+    qamqppublisher_p.h \
+    qamqppublishtemplate_p.h \
     qamqpqueue_p.h
 
 INSTALL_HEADERS += \
     qamqpauthenticator.h \
     qamqpchannel.h \
     qamqpclient.h \
+    qamqpconnectionpool.h \
+    qamqpdelivery.h \
     qamqpexchange.h \
     qamqpglobal.h \
     qamqpmessage.h \
+    qamqppublisher.h \
+    qamqppublishtemplate.h \
     qamqpqueue.h \
     qamqptable.h
 
@@ -65,13 +86,24 @@ HEADERS += \
     $${PRIVATE_HEADERS}
 
 SOURCES += \
+    qamqpackwindow.cpp \
     qamqpauthenticator.cpp \
     qamqpchannel.cpp \
+    qamqpchannelallocator.cpp \
     qamqpchannelhash.cpp \
     qamqpclient.cpp \
+    qamqpcodec.cpp \
+    qamqpconfirmtracker.cpp \
+    qamqpconnectionpool.cpp \
+    qamqpdelivery.cpp \
     qamqpexchange.cpp \
+    qamqpfieldtable.cpp \
     qamqpframe.cpp \
+    qamqpiothread.cpp \
+    qamqplogging.cpp \
     qamqpmessage.cpp \
+    qamqppublisher.cpp \
+    qamqppublishtemplate.cpp \
     qamqpqueue.cpp \
     qamqptable.cpp
 
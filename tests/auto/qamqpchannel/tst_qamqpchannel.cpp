@@ -18,6 +18,9 @@ private Q_SLOTS:
     void resume();
     void sharedChannel();
     void defineWithChannelNumber();
+    void channelNumbersPerClient();
+    void channelNumbersRecycled();
+    void channelMaxEnforced();
 
 private:
     QScopedPointer<QAmqpClient> client;
@@ -93,5 +96,41 @@ void tst_QAMQPChannel::defineWithChannelNumber()
     QCOMPARE(queue->channelNumber(), 25);
 }
 
+void tst_QAMQPChannel::channelNumbersPerClient()
+{
+    QAmqpClient first;
+    QAmqpClient second;
+    QCOMPARE(first.createQueue("test-per-client-a")->channelNumber(), 1);
+    QCOMPARE(second.createQueue("test-per-client-a")->channelNumber(), 1);
+    QCOMPARE(first.createQueue("test-per-client-b")->channelNumber(), 2);
+}
+
+void tst_QAMQPChannel::channelNumbersRecycled()
+{
+    QAmqpQueue *queue = client->createQueue("test-recycled-a");
+    declareQueueAndVerifyConsuming(queue);
+    const int channelNumber = queue->channelNumber();
+
+    queue->close();
+    QVERIFY(waitForSignal(queue, SIGNAL(closed())));
+    delete queue;
+
+    queue = client->createQueue("test-recycled-b");
+    QCOMPARE(queue->channelNumber(), channelNumber);
+    declareQueueAndVerifyConsuming(queue);
+}
+
+void tst_QAMQPChannel::channelMaxEnforced()
+{
+    QAmqpClient limited;
+    limited.setChannelMax(2);
+    QCOMPARE(limited.createQueue("test-channel-max-a")->channelNumber(), 1);
+    QCOMPARE(limited.createQueue("test-channel-max-b")->channelNumber(), 2);
+
+    QAmqpQueue *queue = limited.createQueue("test-channel-max-c");
+    QCOMPARE(queue->channelNumber(), 0);
+    QCOMPARE(queue->error(), QAMQP::ResourceError);
+}
+
 QTEST_MAIN(tst_QAMQPChannel)
 #include "tst_qamqpchannel.moc"
@@ -24,6 +24,8 @@ private Q_SLOTS:
     void validateUri();
     void issue38();
     void issue38_take2();
+    void writeBufferWatermarks();
+    void ioThread();
 
 public Q_SLOTS:     // temporarily disabled
     void autoReconnect();
@@ -328,6 +330,72 @@ void tst_QAMQPClient::issue38_take2()
     QVERIFY(waitForSignal(&client,SIGNAL(disconnected())));
 }
 
+void tst_QAMQPClient::writeBufferWatermarks()
+{
+    QAmqpClient client;
+    client.setWriteBufferWatermarks(1024, 4096);
+    QCOMPARE(client.writeBufferLowWatermark(), qint64(1024));
+    QCOMPARE(client.writeBufferHighWatermark(), qint64(4096));
+
+    client.connectToHost();
+    QVERIFY(waitForSignal(&client, SIGNAL(connected())));
+    QVERIFY(!client.isWriteBufferFull());
+
+    QSignalSpy fullSpy(&client, SIGNAL(writeBufferHighWatermarkReached()));
+    QAmqpExchange *defaultExchange = client.createExchange();
+    QVERIFY(waitForSignal(defaultExchange, SIGNAL(opened())));
+    for (int i = 0; i < 10; ++i)
+        defaultExchange->publish(QByteArray(1024, 'x'), "test-write-buffer", "text/plain");
+
+    QCOMPARE(fullSpy.count(), 1);
+    QVERIFY(client.isWriteBufferFull());
+    QVERIFY(waitForSignal(&client, SIGNAL(writeBufferDrained())));
+    QVERIFY(!client.isWriteBufferFull());
+    QVERIFY(client.bytesToWrite() <= client.writeBufferLowWatermark());
+
+    client.disconnectFromHost();
+    QVERIFY(waitForSignal(&client, SIGNAL(disconnected())));
+}
+
+void tst_QAMQPClient::ioThread()
+{
+    QAmqpClient client;
+    client.setIoThreadEnabled(true);
+    QVERIFY(client.isIoThreadEnabled());
+    client.connectToHost();
+    QVERIFY(waitForSignal(&client, SIGNAL(connected())));
+
+    QAmqpQueue *queue = client.createQueue("test-io-thread");
+    queue->declare(QAmqpQueue::AutoDelete);
+    QVERIFY(waitForSignal(queue, SIGNAL(declared())));
+    queue->consume(QAmqpQueue::coNoAck);
+    QVERIFY(waitForSignal(queue, SIGNAL(consuming(QString))));
+
+    const int messageCount = 100;
+    QAmqpExchange *defaultExchange = client.createExchange();
+    for (int i = 0; i < messageCount; ++i)
+        defaultExchange->publish(QString("message %1").arg(i), "test-io-thread");
+
+    for (int i = 0; i < messageCount; ++i) {
+        if (queue->isEmpty())
+            QVERIFY(waitForSignal(queue, SIGNAL(messageReceived())));
+        QCOMPARE(queue->dequeue().payload(), QString("message %1").arg(i).toUtf8());
+    }
+
+    // can't be changed while connected
+    client.setIoThreadEnabled(false);
+    QVERIFY(client.isIoThreadEnabled());
+
+    client.disconnectFromHost();
+    QVERIFY(waitForSignal(&client, SIGNAL(disconnected())));
+
+    client.setIoThreadEnabled(false);
+    QVERIFY(!client.isIoThreadEnabled());
+    client.connectToHost();
+    QVERIFY(waitForSignal(&client, SIGNAL(connected())));
+    client.disconnectFromHost();
+    QVERIFY(waitForSignal(&client, SIGNAL(disconnected())));
+}
 
 QTEST_MAIN(tst_QAMQPClient)
 #include "tst_qamqpclient.moc"
@@ -0,0 +1,108 @@
+#include <QtTest/QtTest>
+
+#include "signalspy.h"
+#include "qamqptestcase.h"
+
+#include "qamqpclient.h"
+#include "qamqpconnectionpool.h"
+#include "qamqpexchange.h"
+#include "qamqppublisher.h"
+#include "qamqpqueue.h"
+
+class tst_QAMQPConnectionPool : public TestCase
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void connect();
+    void leastLoadedPlacement();
+    void hashOfNamePlacement();
+    void publishAcrossMembers();
+
+};
+
+void tst_QAMQPConnectionPool::connect()
+{
+    QAmqpConnectionPool pool(3);
+    QCOMPARE(pool.size(), 3);
+    pool.connectToHost();
+    QVERIFY(waitForSignal(&pool, SIGNAL(connected())));
+    QVERIFY(pool.isConnected());
+
+    for (int i = 0; i < pool.size(); ++i) {
+        QVERIFY(pool.client(i));
+        QVERIFY(pool.client(i)->thread() != QThread::currentThread());
+        QVERIFY(pool.client(i)->thread() != pool.client((i + 1) % pool.size())->thread());
+    }
+
+    pool.disconnectFromHost();
+    QVERIFY(waitForSignal(&pool, SIGNAL(disconnected())));
+    QVERIFY(!pool.isConnected());
+}
+
+void tst_QAMQPConnectionPool::leastLoadedPlacement()
+{
+    QAmqpConnectionPool pool(2);
+    pool.connectToHost();
+    QVERIFY(waitForSignal(&pool, SIGNAL(connected())));
+
+    QAmqpQueue *first = pool.createQueue("test-pool-first");
+    QAmqpQueue *second = pool.createQueue("test-pool-second");
+    QVERIFY(first && second);
+    QVERIFY(first->thread() != second->thread());
+    QCOMPARE(pool.channelCount(0), 1);
+    QCOMPARE(pool.channelCount(1), 1);
+
+    // the same name is handed out again
+    QCOMPARE(pool.createQueue("test-pool-first"), first);
+    QCOMPARE(pool.channelCount(0), 1);
+}
+
+void tst_QAMQPConnectionPool::hashOfNamePlacement()
+{
+    QAmqpConnectionPool pool(4);
+    pool.setPlacementPolicy(QAmqpConnectionPool::HashOfName);
+    QCOMPARE(pool.placementPolicy(), QAmqpConnectionPool::HashOfName);
+
+    QAmqpExchange *exchange = pool.createExchange("test-pool-hash");
+    QVERIFY(exchange);
+    QCOMPARE(exchange->thread(), pool.client(int(qHash(QString("test-pool-hash")) % 4))->thread());
+    QCOMPARE(pool.createExchange("test-pool-hash"), exchange);
+}
+
+void tst_QAMQPConnectionPool::publishAcrossMembers()
+{
+    QAmqpClient client;
+    client.connectToHost();
+    QVERIFY(waitForSignal(&client, SIGNAL(connected())));
+    QAmqpQueue *queue = client.createQueue("test-pool-publish");
+    declareQueueAndVerifyConsuming(queue);
+
+    QAmqpConnectionPool pool(2);
+    pool.connectToHost();
+    QVERIFY(waitForSignal(&pool, SIGNAL(connected())));
+
+    const int messageCount = 10;
+    QList<QAmqpPublisher*> publishers;
+    for (int i = 0; i < pool.size(); ++i) {
+        QAmqpExchange *exchange = pool.createExchange();
+        QVERIFY(exchange);
+        QAmqpPublisher *publisher = new QAmqpPublisher(exchange, this);
+        for (int j = 0; j < messageCount; ++j)
+            publisher->publish(QString("%1:%2").arg(i).arg(j).toUtf8(), "test-pool-publish", "text/plain");
+        publishers.append(publisher);
+    }
+
+    for (int i = 0; i < pool.size() * messageCount; ++i) {
+        if (queue->isEmpty())
+            QVERIFY(waitForSignal(queue, SIGNAL(messageReceived())));
+        QAmqpMessage message = queue->dequeue();
+        verifyStandardMessageHeaders(message, "test-pool-publish");
+    }
+
+    qDeleteAll(publishers);
+    queue->remove(QAmqpQueue::roForce);
+    QVERIFY(waitForSignal(queue, SIGNAL(removed())));
+}
+
+QTEST_MAIN(tst_QAMQPConnectionPool)
+#include "tst_qamqpconnectionpool.moc"
@@ -5,8 +5,42 @@
 
 #include "qamqpclient.h"
 #include "qamqpexchange.h"
+#include "qamqppublisher.h"
 #include "qamqpqueue.h"
 
+class PublisherWorker : public QObject
+{
+    Q_OBJECT
+public:
+    PublisherWorker(QAmqpExchange *exchange, int id, int messageCount, QAtomicInt *confirmed)
+        : wrongThread(false), exchange(exchange), id(id), messageCount(messageCount),
+          confirmed(confirmed) {}
+
+    bool wrongThread;
+
+public Q_SLOTS:
+    void run()
+    {
+        QAmqpPublisher *publisher = new QAmqpPublisher(exchange, this);
+        connect(publisher, SIGNAL(confirmed(qlonglong)), this, SLOT(messageConfirmed()));
+        for (int i = 0; i < messageCount; ++i)
+            publisher->publish(QString("%1:%2").arg(id).arg(i).toUtf8(), "test-publisher", "text/plain");
+    }
+
+    void messageConfirmed()
+    {
+        if (QThread::currentThread() != thread())
+            wrongThread = true;
+        confirmed->ref();
+    }
+
+private:
+    QAmqpExchange *exchange;
+    int id;
+    int messageCount;
+    QAtomicInt *confirmed;
+};
+
 class tst_QAMQPExchange : public TestCase
 {
     Q_OBJECT
@@ -25,9 +59,14 @@ private Q_SLOTS:
     void invalidImmediateRouting();
     void confirmsSupport();
     void confirmDontLoseMessages();
+    void confirmDeliveryTags();
+    void confirmsSettledPipeline();
     void passiveDeclareNotFound();
     void cleanupOnDeletion();
     void testQueuedPublish();
+    void publishBatch();
+    void publishTemplate();
+    void publisherThreads();
 
 private:
     QScopedPointer<QAmqpClient> client;
@@ -199,6 +238,73 @@ void tst_QAMQPExchange::confirmDontLoseMessages()
     QVERIFY(defaultExchange->waitForConfirms());
 }
 
+void tst_QAMQPExchange::confirmDeliveryTags()
+{
+    QAmqpExchange *defaultExchange = client->createExchange();
+    QCOMPARE(defaultExchange->publish("noop", "confirms-test"), qlonglong(0));
+    defaultExchange->enableConfirms();
+    QVERIFY(waitForSignal(defaultExchange, SIGNAL(confirmsEnabled())));
+    defaultExchange->setConfirmTimeout(30000);
+
+    QSignalSpy confirmedSpy(defaultExchange, SIGNAL(messageConfirmed(qlonglong)));
+    QSignalSpy batchSpy(defaultExchange, SIGNAL(messagesConfirmed(QVector<qlonglong>)));
+    QSignalSpy timedOutSpy(defaultExchange, SIGNAL(confirmsTimedOut(QVector<qlonglong>)));
+
+    const int messageCount = 1000;
+    for (int i = 0; i < messageCount; ++i)
+        QCOMPARE(defaultExchange->publish("noop", "confirms-test"), qlonglong(i + 1));
+    QCOMPARE(defaultExchange->unconfirmedCount(), messageCount);
+
+    QList<QAmqpExchange::PublishEntry> entries;
+    entries.append(QAmqpExchange::PublishEntry("noop", "confirms-test"));
+    entries.append(QAmqpExchange::PublishEntry("noop", "confirms-test"));
+    QCOMPARE(defaultExchange->publishBatch(entries), qlonglong(messageCount + 1));
+
+    QVERIFY(defaultExchange->waitForConfirms());
+    QCOMPARE(defaultExchange->unconfirmedCount(), 0);
+    QCOMPARE(confirmedSpy.size(), messageCount + 2);
+    for (int i = 0; i < confirmedSpy.size(); ++i)
+        QCOMPARE(confirmedSpy.at(i).at(0).toLongLong(), qlonglong(i + 1));
+
+    // one batch per ack frame, the broker acks with multiple set
+    QVERIFY(!batchSpy.isEmpty());
+    QVERIFY(batchSpy.size() <= messageCount + 2);
+    QVERIFY(timedOutSpy.isEmpty());
+}
+
+void tst_QAMQPExchange::confirmsSettledPipeline()
+{
+    QAmqpExchange *defaultExchange = client->createExchange();
+    QVERIFY(defaultExchange->confirmsSettled().isFinished());
+    QVERIFY(!defaultExchange->confirmsSettled().result());
+
+    defaultExchange->enableConfirms();
+    QVERIFY(waitForSignal(defaultExchange, SIGNAL(confirmsEnabled())));
+    QVERIFY(defaultExchange->confirmsSettled().result());
+
+    // keep every batch in flight, no waiting in between
+    const int batchCount = 10;
+    const int batchSize = 100;
+    QList<QFuture<bool> > settled;
+    for (int batch = 0; batch < batchCount; ++batch) {
+        QList<QAmqpExchange::PublishEntry> entries;
+        for (int i = 0; i < batchSize; ++i)
+            entries.append(QAmqpExchange::PublishEntry("noop", "confirms-test"));
+        const qlonglong firstTag = defaultExchange->publishBatch(entries);
+        QCOMPARE(firstTag, qlonglong(batch * batchSize + 1));
+        settled.append(defaultExchange->confirmsSettled(firstTag + batchSize - 1));
+    }
+
+    for (int i = 0; i < 500 && !settled.last().isFinished(); ++i)
+        QTest::qWait(10);
+
+    for (int batch = 0; batch < batchCount; ++batch) {
+        QVERIFY(settled.at(batch).isFinished());
+        QVERIFY(settled.at(batch).result());
+    }
+    QCOMPARE(defaultExchange->confirmWatermark(), qlonglong(batchCount * batchSize));
+}
+
 void tst_QAMQPExchange::passiveDeclareNotFound()
 {
     QAmqpExchange *nonExistentExchange = client->createExchange("this-does-not-exist");
@@ -242,5 +348,126 @@ void tst_QAMQPExchange::testQueuedPublish()
     QVERIFY(defaultExchange->waitForConfirms());
 }
 
+void tst_QAMQPExchange::publishBatch()
+{
+    QAmqpQueue *queue = client->createQueue("test-publish-batch");
+    declareQueueAndVerifyConsuming(queue);
+
+    QAmqpExchange *defaultExchange = client->createExchange();
+    defaultExchange->enableConfirms();
+    QVERIFY(waitForSignal(defaultExchange, SIGNAL(confirmsEnabled())));
+
+    // one entry spans several body frames
+    const int messageCount = 100;
+    QList<QAmqpExchange::PublishEntry> entries;
+    for (int i = 0; i < messageCount; ++i)
+        entries.append(QAmqpExchange::PublishEntry(QString("message %1").arg(i).toUtf8(), "test-publish-batch"));
+    entries.append(QAmqpExchange::PublishEntry(QByteArray(client->frameMax() * 2, 'x'), "test-publish-batch"));
+    defaultExchange->publishBatch(entries);
+    QVERIFY(defaultExchange->waitForConfirms());
+
+    int messageReceivedCount = 0;
+    while (messageReceivedCount < entries.size()) {
+        if (queue->isEmpty())
+            QVERIFY(waitForSignal(queue, SIGNAL(messageReceived())));
+
+        QAmqpMessage message = queue->dequeue();
+        verifyStandardMessageHeaders(message, "test-publish-batch");
+        QCOMPARE(message.payload(), entries.at(messageReceivedCount).payload);
+        messageReceivedCount++;
+    }
+
+    QCOMPARE(messageReceivedCount, messageCount + 1);
+}
+
+void tst_QAMQPExchange::publishTemplate()
+{
+    QAmqpQueue *queue = client->createQueue("test-publish-template");
+    declareQueueAndVerifyConsuming(queue);
+
+    QAmqpTable headers;
+    headers.insert("source", "template");
+    QAmqpMessage::PropertyHash properties;
+    properties.insert(QAmqpMessage::AppId, "tst_qamqpexchange");
+    QAmqpPublishTemplate publishTemplate("test-publish-template", "application/octet-stream",
+                                         headers, properties);
+    QVERIFY(publishTemplate.isValid());
+
+    QAmqpExchange *defaultExchange = client->createExchange();
+    const int messageCount = 10;
+    for (int i = 0; i < messageCount; ++i) {
+        QAmqpMessage::PropertyHash messageProperties;
+        messageProperties.insert(QAmqpMessage::MessageId, QString::number(i));
+        if (i % 2)
+            messageProperties.insert(QAmqpMessage::AppId, "override");
+        defaultExchange->publish(publishTemplate, QString("message %1").arg(i).toUtf8(), messageProperties);
+    }
+
+    for (int i = 0; i < messageCount; ++i) {
+        if (queue->isEmpty())
+            QVERIFY(waitForSignal(queue, SIGNAL(messageReceived())));
+
+        QAmqpMessage message = queue->dequeue();
+        verifyStandardMessageHeaders(message, "test-publish-template");
+        QCOMPARE(message.payload(), QString("message %1").arg(i).toUtf8());
+        QCOMPARE(message.property(QAmqpMessage::ContentType).toString(), QLatin1String("application/octet-stream"));
+        QCOMPARE(message.property(QAmqpMessage::MessageId).toString(), QString::number(i));
+        QCOMPARE(message.property(QAmqpMessage::AppId).toString(),
+                 QLatin1String(i % 2 ? "override" : "tst_qamqpexchange"));
+        QCOMPARE(message.header("source").toString(), QLatin1String("template"));
+    }
+}
+
+void tst_QAMQPExchange::publisherThreads()
+{
+    QAmqpQueue *queue = client->createQueue("test-publisher");
+    declareQueueAndVerifyConsuming(queue);
+
+    QAmqpExchange *defaultExchange = client->createExchange();
+    defaultExchange->enableConfirms();
+    QVERIFY(waitForSignal(defaultExchange, SIGNAL(confirmsEnabled())));
+
+    const int threadCount = 4;
+    const int messageCount = 250;
+    QAtomicInt confirmed(0);
+    QList<QThread*> threads;
+    QList<PublisherWorker*> workers;
+    for (int i = 0; i < threadCount; ++i) {
+        QThread *thread = new QThread(this);
+        PublisherWorker *worker = new PublisherWorker(defaultExchange, i, messageCount, &confirmed);
+        worker->moveToThread(thread);
+        connect(thread, SIGNAL(started()), worker, SLOT(run()));
+        connect(thread, SIGNAL(finished()), worker, SLOT(deleteLater()));
+        threads.append(thread);
+        workers.append(worker);
+        thread->start();
+    }
+
+    // messages from each thread arrive in the order they were published
+    QVector<int> nextIndex(threadCount, 0);
+    for (int i = 0; i < threadCount * messageCount; ++i) {
+        if (queue->isEmpty())
+            QVERIFY(waitForSignal(queue, SIGNAL(messageReceived())));
+
+        QAmqpMessage message = queue->dequeue();
+        QCOMPARE(message.property(QAmqpMessage::ContentType).toString(), QLatin1String("text/plain"));
+        const QList<QByteArray> parts = message.payload().split(':');
+        QCOMPARE(parts.size(), 2);
+        const int thread = parts.at(0).toInt();
+        QCOMPARE(parts.at(1).toInt(), nextIndex[thread]);
+        nextIndex[thread]++;
+    }
+
+    for (int i = 0; i < 500 && confirmed.fetchAndAddOrdered(0) < threadCount * messageCount; ++i)
+        QTest::qWait(10);
+    QCOMPARE(confirmed.fetchAndAddOrdered(0), threadCount * messageCount);
+
+    for (int i = 0; i < threadCount; ++i) {
+        QVERIFY(!workers.at(i)->wrongThread);
+        threads.at(i)->quit();
+        QVERIFY(threads.at(i)->wait());
+    }
+}
+
 QTEST_MAIN(tst_QAMQPExchange)
 #include "tst_qamqpexchange.moc"
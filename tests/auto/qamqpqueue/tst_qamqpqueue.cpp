@@ -7,9 +7,53 @@
 #include "signalspy.h"
 
 #include "qamqpclient.h"
+#include "qamqpdelivery.h"
 #include "qamqpqueue.h"
 #include "qamqpexchange.h"
 
+class OrderedDeliveryHandler : public QAmqpDeliveryHandler
+{
+public:
+    OrderedDeliveryHandler() : wrongThread(false) {}
+
+    virtual void handleDelivery(const QAmqpDelivery &delivery)
+    {
+        QMutexLocker locker(&mutex);
+        if (QThread::currentThread() == QCoreApplication::instance()->thread())
+            wrongThread = true;
+        received.append(delivery.message().payload().toInt());
+        delivery.ack();
+    }
+
+    int receivedCount()
+    {
+        QMutexLocker locker(&mutex);
+        return received.size();
+    }
+
+    QMutex mutex;
+    QList<int> received;
+    bool wrongThread;
+};
+
+struct BatchCollector
+{
+    QList<QAmqpMessage> messages;
+    int batches;
+};
+
+struct BatchCallback
+{
+    explicit BatchCallback(BatchCollector *collector) : collector(collector) {}
+    void operator()(const QVector<QAmqpMessage> &messages)
+    {
+        collector->batches++;
+        collector->messages += messages.toList();
+    }
+
+    BatchCollector *collector;
+};
+
 class tst_QAMQPQueue : public TestCase
 {
     Q_OBJECT
@@ -47,8 +91,15 @@ private Q_SLOTS:
     void invalidRoutingKey();
     void tableFieldDataTypes();
     void messageProperties();
+    void lazyMessageHeaders();
     void emptyMessage();
     void cleanupOnDeletion();
+    void deliveryHandler();
+    void batchCallback();
+    void bufferBackpressure();
+    void ackBatching();
+    void nackMultiple();
+    void sharedChannelConsumers();
 
 private:
     QScopedPointer<QAmqpClient> client;
@@ -661,6 +712,42 @@ void tst_QAMQPQueue::messageProperties()
     QCOMPARE(message.property(QAmqpMessage::ClusterID).toString(), QLatin1String("some-cluster-id"));
 }
 
+void tst_QAMQPQueue::lazyMessageHeaders()
+{
+    QAmqpQueue *queue = client->createQueue("test-lazy-message-headers");
+    declareQueueAndVerifyConsuming(queue);
+
+    QAmqpTable headers;
+    headers.insert("trace-id", QLatin1String("abc123"));
+    headers.insert("span-id", qint32(42));
+
+    QAmqpMessage::PropertyHash properties;
+    properties.insert(QAmqpMessage::MessageId, "some-message-id");
+
+    QAmqpExchange *defaultExchange = client->createExchange();
+    defaultExchange->publish("dummy", "test-lazy-message-headers", "text.plain", headers, properties);
+    QVERIFY(waitForSignal(queue, SIGNAL(messageReceived())));
+    QAmqpMessage message = queue->dequeue();
+
+    // single lookups before anything is decoded
+    QVERIFY(message.hasHeader("span-id"));
+    QVERIFY(!message.hasHeader("missing"));
+    QCOMPARE(message.header("missing", 7).toInt(), 7);
+    QCOMPARE(message.header("trace-id").toString(), QLatin1String("abc123"));
+    QVERIFY(message.hasProperty(QAmqpMessage::MessageId));
+    QVERIFY(!message.hasProperty(QAmqpMessage::ReplyTo));
+    QCOMPARE(message.property(QAmqpMessage::ReplyTo, "none").toString(), QLatin1String("none"));
+
+    // full decoding, then modification
+    QCOMPARE(message.headers().size(), 2);
+    QCOMPARE(message.headers().value("span-id").toInt(), 42);
+    message.setHeader("extra", true);
+    QCOMPARE(message.headers().size(), 3);
+    message.setProperty(QAmqpMessage::ReplyTo, "another-queue");
+    QCOMPARE(message.property(QAmqpMessage::MessageId).toString(), QLatin1String("some-message-id"));
+    QCOMPARE(message.property(QAmqpMessage::ReplyTo).toString(), QLatin1String("another-queue"));
+}
+
 void tst_QAMQPQueue::emptyMessage()
 {
     QAmqpQueue *queue = client->createQueue("test-issue-43");
@@ -693,5 +780,216 @@ void tst_QAMQPQueue::cleanupOnDeletion()
     QVERIFY(waitForSignal(queue, SIGNAL(closed())));
 }
 
+void tst_QAMQPQueue::deliveryHandler()
+{
+    QThreadPool pool;
+    pool.setMaxThreadCount(4);
+    OrderedDeliveryHandler handler;
+
+    QAmqpQueue *queue = client->createQueue("test-delivery-handler");
+    queue->setDeliveryHandler(&handler, &pool, QAmqpQueue::OrderedByRoutingKey);
+    QCOMPARE(queue->deliveryHandler(), static_cast<QAmqpDeliveryHandler*>(&handler));
+
+    // the broker only keeps delivering if acks from the workers arrive
+    queue->qos(10);
+    QVERIFY(waitForSignal(queue, SIGNAL(qosDefined())));
+    declareQueueAndVerifyConsuming(queue);
+
+    const int messageCount = 100;
+    QAmqpExchange *defaultExchange = client->createExchange();
+    for (int i = 0; i < messageCount; ++i)
+        defaultExchange->publish(QString::number(i), "test-delivery-handler");
+
+    for (int i = 0; i < 500 && handler.receivedCount() < messageCount; ++i)
+        QTest::qWait(10);
+    QVERIFY(pool.waitForDone());
+
+    QVERIFY(!handler.wrongThread);
+    QVERIFY(queue->isEmpty());
+    QCOMPARE(handler.received.size(), messageCount);
+    for (int i = 0; i < messageCount; ++i)
+        QCOMPARE(handler.received.at(i), i);
+}
+
+void tst_QAMQPQueue::batchCallback()
+{
+    BatchCollector collector;
+    collector.batches = 0;
+
+    QAmqpQueue *queue = client->createQueue("test-batch-callback");
+    queue->setBatchCallback(BatchCallback(&collector));
+    QVERIFY(queue->batchHandler());
+    QSignalSpy spy(queue, SIGNAL(messageReceived()));
+    declareQueueAndVerifyConsuming(queue);
+
+    const int messageCount = 50;
+    QAmqpExchange *defaultExchange = client->createExchange();
+    for (int i = 0; i < messageCount; ++i)
+        defaultExchange->publish(QString("message %1").arg(i), "test-batch-callback");
+
+    for (int i = 0; i < 500 && collector.messages.size() < messageCount; ++i)
+        QTest::qWait(10);
+
+    QCOMPARE(collector.messages.size(), messageCount);
+    QVERIFY(collector.batches >= 1 && collector.batches <= messageCount);
+    for (int i = 0; i < messageCount; ++i) {
+        verifyStandardMessageHeaders(collector.messages.at(i), "test-batch-callback");
+        QCOMPARE(collector.messages.at(i).payload(), QString("message %1").arg(i).toUtf8());
+    }
+
+    QVERIFY(spy.isEmpty());
+    QVERIFY(queue->isEmpty());
+}
+
+void tst_QAMQPQueue::bufferBackpressure()
+{
+    QAmqpQueue *queue = client->createQueue("test-buffer-backpressure");
+    queue->setBufferWatermarks(2, 5);
+    queue->setBackpressureMode(QAmqpQueue::PauseReading);
+    QSignalSpy drainedSpy(queue, SIGNAL(bufferDrained()));
+    declareQueueAndVerifyConsuming(queue);
+
+    const int messageCount = 20;
+    QAmqpExchange *defaultExchange = client->createExchange();
+    for (int i = 0; i < messageCount; ++i)
+        defaultExchange->publish(QString("message %1").arg(i), "test-buffer-backpressure");
+
+    // reading stops right at the high watermark
+    QVERIFY(waitForSignal(queue, SIGNAL(bufferHighWatermarkReached())));
+    QTest::qWait(100);
+    QVERIFY(queue->isBufferFull());
+    QCOMPARE(queue->size(), 5);
+    QVERIFY(queue->bufferedBytes() > 0);
+
+    int received = 0;
+    for (int i = 0; i < 1000 && received < messageCount; ++i) {
+        while (!queue->isEmpty()) {
+            QAmqpMessage message = queue->dequeue();
+            QCOMPARE(message.payload(), QString("message %1").arg(received).toUtf8());
+            ++received;
+        }
+        QTest::qWait(10);
+    }
+
+    QCOMPARE(received, messageCount);
+    QVERIFY(!drainedSpy.isEmpty());
+    QVERIFY(!queue->isBufferFull());
+    QCOMPARE(queue->bufferedBytes(), qint64(0));
+}
+
+void tst_QAMQPQueue::ackBatching()
+{
+    QAmqpQueue *queue = client->createQueue("test-ack-batching");
+    queue->setAckBatching(10, 50);
+    QCOMPARE(queue->ackBatchThreshold(), 10);
+
+    // the broker stops delivering unless the held back acks go out
+    queue->qos(20);
+    QVERIFY(waitForSignal(queue, SIGNAL(qosDefined())));
+    declareQueueAndVerifyConsuming(queue);
+
+    const int messageCount = 100;
+    QAmqpExchange *defaultExchange = client->createExchange();
+    for (int i = 0; i < messageCount; ++i)
+        defaultExchange->publish(QString::number(i), "test-ack-batching");
+
+    // ack whatever arrived in reverse order, so most acks are out of order
+    int received = 0;
+    for (int i = 0; i < 500 && received < messageCount; ++i) {
+        QList<QAmqpMessage> messages;
+        while (!queue->isEmpty())
+            messages.prepend(queue->dequeue());
+        for (int j = 0; j < messages.size(); ++j)
+            queue->ack(messages.at(j));
+        received += messages.size();
+        QTest::qWait(10);
+    }
+    QCOMPARE(received, messageCount);
+    queue->flushAcks();
+
+    // anything left unacked would be requeued once the channel closes
+    queue->close();
+    QVERIFY(waitForSignal(queue, SIGNAL(closed())));
+    queue = client->createQueue("test-ack-batching");
+    queue->declare();
+    QVERIFY(waitForSignal(queue, SIGNAL(declared())));
+    QCOMPARE(queue->messageCount(), 0);
+}
+
+void tst_QAMQPQueue::nackMultiple()
+{
+    QAmqpQueue *queue = client->createQueue("test-nack-multiple");
+    queue->setAckBatching(100, 1000);
+    declareQueueAndVerifyConsuming(queue);
+
+    const int messageCount = 20;
+    QAmqpExchange *defaultExchange = client->createExchange();
+    for (int i = 0; i < messageCount; ++i)
+        defaultExchange->publish(QString::number(i), "test-nack-multiple");
+
+    for (int i = 0; i < 500 && queue->size() < messageCount; ++i)
+        QTest::qWait(10);
+    QCOMPARE(queue->size(), messageCount);
+
+    // the first half is acked but held back, the nack must not requeue it
+    QList<QAmqpMessage> messages;
+    while (!queue->isEmpty())
+        messages.append(queue->dequeue());
+    for (int i = 0; i < messageCount / 2; ++i)
+        queue->ack(messages.at(i));
+    queue->nack(messages.last().deliveryTag(), true, true);
+
+    for (int i = 0; i < 500 && queue->size() < messageCount / 2; ++i)
+        QTest::qWait(10);
+    QCOMPARE(queue->size(), messageCount / 2);
+    for (int i = 0; i < messageCount / 2; ++i) {
+        QAmqpMessage message = queue->dequeue();
+        QVERIFY(message.isRedelivered());
+        QCOMPARE(message.payload(), QByteArray::number(messageCount / 2 + i));
+    }
+}
+
+void tst_QAMQPQueue::sharedChannelConsumers()
+{
+    QAmqpQueue *first = client->createQueue("test-shared-channel-1");
+    QVERIFY(waitForSignal(first, SIGNAL(opened())));
+
+    // joins the channel the first queue opened, no channel.open of its own
+    QAmqpQueue *second = client->createQueue("test-shared-channel-2", first->channelNumber());
+    QCOMPARE(second->channelNumber(), first->channelNumber());
+    QVERIFY(second->isOpen());
+
+    // both requests are in flight at once, each reply goes to its queue
+    first->declare();
+    second->declare();
+    QVERIFY(waitForSignal(second, SIGNAL(declared())));
+    QVERIFY(first->isDeclared());
+    QCOMPARE(first->name(), QString("test-shared-channel-1"));
+    QCOMPARE(second->name(), QString("test-shared-channel-2"));
+
+    QVERIFY(first->consume());
+    QVERIFY(second->consume());
+    QVERIFY(waitForSignal(second, SIGNAL(consuming(QString))));
+    QVERIFY(first->isConsuming());
+    QVERIFY(first->consumerTag() != second->consumerTag());
+
+    const int messageCount = 10;
+    QAmqpExchange *defaultExchange = client->createExchange();
+    for (int i = 0; i < messageCount; ++i) {
+        defaultExchange->publish(QString("first %1").arg(i), "test-shared-channel-1");
+        defaultExchange->publish(QString("second %1").arg(i), "test-shared-channel-2");
+    }
+
+    for (int i = 0; i < 500 && (first->size() < messageCount || second->size() < messageCount); ++i)
+        QTest::qWait(10);
+
+    QCOMPARE(first->size(), messageCount);
+    QCOMPARE(second->size(), messageCount);
+    for (int i = 0; i < messageCount; ++i) {
+        QCOMPARE(first->dequeue().payload(), QString("first %1").arg(i).toUtf8());
+        QCOMPARE(second->dequeue().payload(), QString("second %1").arg(i).toUtf8());
+    }
+}
+
 QTEST_MAIN(tst_QAMQPQueue)
 #include "tst_qamqpqueue.moc"